@@ -0,0 +1,99 @@
+#pragma once
+#include <switch.h>
+#include <vector>
+
+namespace Trinity
+{
+        // An arena allocator, like simple_allocator, except that it respects the alignment requirements of the objects allocated from it.
+        // simple_allocator::New<>() ignores alignof(T), so e.g structs declared with alignas(64) couldn't be allocated from it.
+        //
+        // Memory is allocated in banks aligned to CacheLineSize, and objects are laid out contiguously in
+        // the order they are allocated, so that e.g the iterators of a query, created while its exec_nodes tree is traversed,
+        // are close to each other in memory.
+        //
+        // Memory is released when the arena is destroyed. Destructors are not invoked; you are responsible for
+        // invoking them, if needed, before that.
+        class aligned_arena final
+        {
+              public:
+                static constexpr std::size_t CacheLineSize{64};
+
+              private:
+                const std::size_t bankSize;
+                std::vector<void *> banks;
+                uint8_t *cur{nullptr}, *end{nullptr};
+
+              private:
+                void *alloc_bank(const std::size_t size)
+                {
+                        auto p = aligned_alloc(CacheLineSize, (size + CacheLineSize - 1) & ~(CacheLineSize - 1));
+
+                        if (unlikely(!p))
+                                throw Switch::data_error("Failed to allocate memory");
+
+                        banks.push_back(p);
+                        return p;
+                }
+
+              public:
+                aligned_arena(const std::size_t bs = 4096)
+                    : bankSize{bs}
+                {
+                }
+
+                ~aligned_arena()
+                {
+                        for (auto p : banks)
+                                std::free(p);
+                }
+
+                aligned_arena(const aligned_arena &) = delete;
+
+                aligned_arena &operator=(const aligned_arena &) = delete;
+
+                // align must be a power of 2, not higher than CacheLineSize
+                void *Alloc(const std::size_t size, const std::size_t align = alignof(std::max_align_t))
+                {
+                        auto p = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(uintptr_t(align) - 1));
+
+                        if (likely(cur && p + size <= end))
+                        {
+                                cur = p + size;
+                                return p;
+                        }
+                        else if (size > bankSize / 4)
+                        {
+                                // large allocation; use a bank of its own so that we won't waste what remains in the current bank
+                                return alloc_bank(size);
+                        }
+                        else
+                        {
+                                p = static_cast<uint8_t *>(alloc_bank(bankSize));
+                                cur = p + size;
+                                end = p + bankSize;
+                                return p;
+                        }
+                }
+
+                // Aligned to a cache line, so that the object won't straddle cache lines unless it's larger than one
+                void *AllocCacheAligned(const std::size_t size)
+                {
+                        return Alloc(size, CacheLineSize);
+                }
+
+                template <typename T, typename... Arg>
+                T *New(Arg &&... args)
+                {
+                        static_assert(alignof(T) <= CacheLineSize);
+
+                        return new (Alloc(sizeof(T), alignof(T))) T(std::forward<Arg>(args)...);
+                }
+
+                // Like New<>(), except that the object is aligned to a cache line(see AllocCacheAligned()) even if alignof(T) is lower
+                template <typename T, typename... Arg>
+                T *NewCacheAligned(Arg &&... args)
+                {
+                        return new (AllocCacheAligned(sizeof(T))) T(std::forward<Arg>(args)...);
+                }
+        };
+}
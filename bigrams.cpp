@@ -0,0 +1,45 @@
+#include "bigrams.h"
+#include "numeric_terms.h"
+#include "terms.h"
+
+using namespace Trinity;
+
+void Bigrams::terms_set::serialize(IOBuffer *const out) const
+{
+        for (const auto &it : set)
+        {
+                out->pack(uint8_t(it.size()));
+                out->serialize(it.data(), it.size());
+        }
+}
+
+void Bigrams::terms_set::init(const range_base<const uint8_t *, std::size_t> content)
+{
+        clear();
+        for (const auto *p = content.start(), *const e = p + content.size(); p != e;)
+        {
+                const auto len = *p++;
+
+                if (!len || len > e - p)
+                        throw Switch::data_error("Unexpected bigrams contents");
+
+                insert(str8_t(reinterpret_cast<const char *>(p), len));
+                p += len;
+        }
+}
+
+void Bigrams::common_terms(IndexSourceTermsView *const terms, const uint32_t minDocuments, terms_set *const out)
+{
+        for (; !terms->done(); terms->next())
+        {
+                const auto[term, tctx] = terms->cur();
+
+                if (tctx.documents < minDocuments)
+                        continue;
+
+                if (memchr(term.data(), Separator, term.size()) || memchr(term.data(), NumericTerms::Separator, term.size()))
+                        continue;
+
+                out->insert(term);
+        }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "common.h"
+#include "trinity_limits.h"
+#include <buffer.h>
+#include <ext/flat_hash_map.h>
+#include <switch_mallocators.h>
+
+namespace Trinity
+{
+        struct IndexSourceTermsView;
+
+        // Next-word index: in addition to the hits of each term, a segment may index each pair of adjacent terms(a, b) as
+        // a single term, so that the phrase [a b] can be matched by looking up that term, instead of
+        // intersecting the postings lists of a and b and checking the positions of their hits for every document that matches both.
+        // This is mostly useful for phrases that involve very common terms, e.g [world of], or [iphone x], which is why
+        // we only index pairs where either term is in a set of `common` terms; indexing all pairs would more than double the index size.
+        //
+        // See SegmentIndexSession::set_bigrams() and IndexSource::indexed_bigrams()
+        //
+        // Terms are encoded as [a][Separator][b]
+        namespace Bigrams
+        {
+                static constexpr char_t Separator{0x1e};
+
+                // Returns the length of the term stored in out[], or 0 if it wouldn't fit in Limits::MaxTermLength
+                inline uint8_t encode(const str8_t a, const str8_t b, char_t *const out) noexcept
+                {
+                        const std::size_t len = a.size() + 1 + b.size();
+
+                        if (len > Limits::MaxTermLength)
+                                return 0;
+
+                        memcpy(out, a.data(), a.size());
+                        out[a.size()] = Separator;
+                        memcpy(out + a.size() + 1, b.data(), b.size());
+                        return len;
+                }
+
+                // The set of common terms; a pair is indexed if either of its terms is in the set.
+                // A segment persists the set it was indexed with, so that a pair that is covered by the set but
+                // its term is not in the segment means that the phrase can't match any of its documents.
+                class terms_set final
+                {
+                      private:
+                        simple_allocator allocator;
+                        ska::flat_hash_set<str8_t> set;
+
+                      public:
+                        // Terms that contain the Separator are ignored, for their pairs' encodings would be ambiguous
+                        void insert(const str8_t term)
+                        {
+                                if (term.size() && term.size() <= Limits::MaxTermLength && !memchr(term.data(), Separator, term.size()) && !set.count(term))
+                                        set.insert({allocator.CopyOf(term.data(), term.size()), term.size()});
+                        }
+
+                        inline bool contains(const str8_t term) const noexcept
+                        {
+                                return set.count(term);
+                        }
+
+                        // true if the pair (a, b) is indexed
+                        inline bool covers(const str8_t a, const str8_t b) const noexcept
+                        {
+                                return contains(a) || contains(b);
+                        }
+
+                        auto size() const noexcept
+                        {
+                                return set.size();
+                        }
+
+                        bool empty() const noexcept
+                        {
+                                return set.empty();
+                        }
+
+                        void clear()
+                        {
+                                set.clear();
+                                allocator.reuse();
+                        }
+
+                        template <typename L>
+                        void for_each(L &&l) const
+                        {
+                                for (const auto &it : set)
+                                        l(it);
+                        }
+
+                        // Serialized as [term length:u8][term] for each term
+                        void serialize(IOBuffer *out) const;
+
+                        void init(const range_base<const uint8_t *, std::size_t> content);
+                };
+
+                // Adds every term of `terms` that matches at least minDocuments documents to `out`, so that
+                // the set can be derived from the terms frequencies of existing segments(i.e a frequency threshold), instead of a stopwords list.
+                // Terms that are not text tokens(bigram and numeric terms) are ignored.
+                void common_terms(IndexSourceTermsView *terms, const uint32_t minDocuments, terms_set *out);
+        }
+}
@@ -78,7 +78,9 @@ namespace Trinity
 			{
 				// append_index_chunk() is implemented
 				AppendIndexChunk = 1,
-				Merge = 1<<1
+				Merge = 1<<1,
+				// new_worker_session() and append_worker_session() are implemented
+				ParallelEncode = 1<<2
 			};
 
 			const uint8_t caps;
@@ -187,6 +189,26 @@ namespace Trinity
 			{
 
 			}
+
+			// Terms are independent of each other, so their postings lists can be encoded in parallel, by multiple threads.
+			// SegmentIndexSession::commit() will do that if Capabilities::ParallelEncode is set.
+			//
+			// new_worker_session() returns a new session for the same codec, that will be used by a single thread in order to encode
+			// a subset of all terms, using an encoder obtained from that session's new_encoder().
+			// Its state should be memory resident; its begin() and end() methods will not be invoked and it must never be flushed.
+			virtual IndexSession *new_worker_session()
+			{
+				std::abort();
+				return nullptr;
+			}
+
+			// Appends the state(indexOut and any codec specific buffers) of a worker session to this session, and rebases
+			// the `n` term_index_ctx in `tctxs`, which were produced by encoders of that worker session, so that
+			// they will reference the state of this session instead.
+			virtual void append_worker_session(IndexSession *ws, term_index_ctx *tctxs, const std::size_t n)
+			{
+				std::abort();
+			}
                 };
 
                 // Encoder interface for encoding a single term's posting list
@@ -301,6 +323,20 @@ namespace Trinity
 			// This is how you are going to access the postings list
 			virtual PostingsListIterator *new_iterator() = 0;
 
+			// Used by the execution engine's cost model(see costs.h)
+			// How many documents(at most) an iterator may need to decode in order to advance() to a target, if
+			// the postings list has a skiplist it can use. 0 if there is no skiplist, i.e advance() may need to decode every document
+			virtual uint32_t skiplist_granularity() const noexcept
+			{
+				return 0;
+			}
+
+			// Relative cost of decoding a single posting; 1 for bit-packed blocks
+			virtual uint8_t decode_cost() const noexcept
+			{
+				return 1;
+			}
+
                         Decoder()
                         {
                         }
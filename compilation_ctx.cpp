@@ -1,5 +1,7 @@
 #include "compilation_ctx.h"
 #include "common.h"
+#include "numeric_terms.h"
+#include <unordered_map>
 
 using namespace Trinity;
 
@@ -10,7 +12,7 @@ namespace // static/local this module
 
 compilation_ctx::phrase *compilation_ctx::register_phrase(const Trinity::phrase *p)
 {
-        auto ptr = (phrase *)allocator.Alloc(sizeof(phrase) + sizeof(exec_term_id_t) * p->size);
+        auto ptr = (phrase *)ctxAllocator.AllocCacheAligned(sizeof(phrase) + sizeof(exec_term_id_t) * p->size);
 
         ptr->size = p->size;
         for (uint32_t i{0}; i != p->size; ++i)
@@ -24,6 +26,44 @@ compilation_ctx::phrase *compilation_ctx::register_phrase(const Trinity::phrase
         return ptr;
 }
 
+uint32_t compilation_ctx::register_bigram(const Trinity::phrase *p)
+{
+        const auto set = p->size == 2 ? indexed_bigrams() : nullptr;
+
+        if (!set || !set->covers(p->terms[0].token, p->terms[1].token))
+                return UINT32_MAX;
+
+        char_t buf[Limits::MaxTermLength];
+
+        if (const auto len = Bigrams::encode(p->terms[0].token, p->terms[1].token, buf))
+        {
+                // resolve_query_term() implementations may retain the term
+                return resolve_query_term({allocator.CopyOf(buf, len), len});
+        }
+        else
+                return UINT32_MAX;
+}
+
+compilation_ctx::termsrun *compilation_ctx::register_numeric_range(const Trinity::numeric_range *r)
+{
+        std::vector<exec_term_id_t> ids;
+
+        NumericTerms::for_range(r->field, r->lo, r->hi, [&](const str8_t term) {
+                // resolve_query_term() implementations may retain the term
+                if (const auto id = resolve_query_term({allocator.CopyOf(term.data(), term.size()), term.size()}))
+                        ids.push_back(id);
+        });
+
+        if (ids.empty())
+                return nullptr;
+
+        auto ptr = (termsrun *)runsAllocator.AllocCacheAligned(sizeof(termsrun) + sizeof(exec_term_id_t) * ids.size());
+
+        ptr->size = ids.size();
+        memcpy(ptr->terms, ids.data(), sizeof(exec_term_id_t) * ids.size());
+        return ptr;
+}
+
 uint8_t compilation_ctx::phrase::intersection(const termsrun *const tr, exec_term_id_t *const out) const noexcept
 {
         uint16_t n{0};
@@ -258,6 +298,32 @@ static exec_node compile_node(const ast_node *const n, compilation_ctx &cctx, si
                                 else
                                         res.fp = ENT::constfalse;
                         }
+                        else if (const auto bigram = cctx.register_bigram(n->p); bigram != UINT32_MAX)
+                        {
+                                // A lookup of the bigram term instead of, or in addition to, checking the terms positions
+                                // If the bigram term is not indexed, no document can match the phrase.
+                                if (!bigram)
+                                        res.fp = ENT::constfalse;
+                                else if (!cctx.verifyBigramPhrases)
+                                {
+                                        res.u16 = bigram;
+                                        res.fp = ENT::matchterm;
+                                }
+                                else if (auto p = cctx.register_phrase(n->p))
+                                {
+                                        exec_node termNode, phraseMatchNode;
+
+                                        termNode.fp = ENT::matchterm;
+                                        termNode.u16 = bigram;
+                                        phraseMatchNode.fp = ENT::matchphrase;
+                                        phraseMatchNode.ptr = (void *)p;
+
+                                        res.ptr = cctx.register_binop(termNode, phraseMatchNode);
+                                        res.fp = ENT::logicaland;
+                                }
+                                else
+                                        res.fp = ENT::constfalse;
+                        }
                         else
                         {
                                 res.ptr = cctx.register_phrase(n->p);
@@ -299,6 +365,14 @@ static exec_node compile_node(const ast_node *const n, compilation_ctx &cctx, si
                         res.fp = ENT::constfalse;
                         break;
 
+                case ast_node::Type::NumericRange:
+                        res.ptr = cctx.register_numeric_range(n->range);
+                        if (res.ptr)
+                                res.fp = ENT::matchrange;
+                        else
+                                res.fp = ENT::constfalse;
+                        break;
+
                 case ast_node::Type::MatchSome:
                         res.fp = ENT::matchsome;
                         {
@@ -695,7 +769,7 @@ static void expand_node(exec_node &n, compilation_ctx &cctx, simple_allocator &a
                 }
                 else if (termsCnt > 1)
                 {
-                        auto run = (compilation_ctx::termsrun *)cctx.runsAllocator.Alloc(sizeof(compilation_ctx::termsrun) + sizeof(exec_term_id_t) * termsCnt);
+                        auto run = (compilation_ctx::termsrun *)cctx.runsAllocator.AllocCacheAligned(sizeof(compilation_ctx::termsrun) + sizeof(exec_term_id_t) * termsCnt);
                         exec_node runNode;
 
                         run->size = termsCnt;
@@ -1500,6 +1574,8 @@ static auto impl_repr(const ENT fp) noexcept
                 return "const true expr"_s8;
         else if (fp == ENT::matchsome)
                 return "[matchsome]"_s8;
+        else if (fp == ENT::matchrange)
+                return "[matchrange]"_s8;
         else if (fp == ENT::matchallnodes)
                 return "[matchallnodes]"_s8;
         else if (fp == ENT::matchanynodes)
@@ -1584,6 +1660,16 @@ static void PrintImpl(Buffer &b, const exec_node &n)
                 b.shrink_by(1);
                 b.append("]");
         }
+        else if (n.fp == ENT::matchrange)
+        {
+                const auto *__restrict__ run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                b.append("RANGE OF[");
+                for (uint32_t i{0}; i != run->size; ++i)
+                        b.append(run->terms[i], ',');
+                b.shrink_by(1);
+                b.append("]");
+        }
         else if (n.fp == ENT::matchallterms)
         {
                 const auto *__restrict__ run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
@@ -1888,11 +1974,340 @@ exec_node Trinity::compile_query(ast_node *root, compilation_ctx &cctx)
                 return {ENT::constfalse, {}};
         }
 
-        simple_allocator a(4096); 	// for temporaries
-
         // Reorder the tree to enable the compiler to create larger collections
         // root is from a clone of the original query, so we are free to modify it anyway we see fit with reorder_root()
-        return compile(reorder_root(root), cctx, a);
+        //
+        // Some exec_node contexts(partial_match_ctx, and binop_ctx when a matchsome is transformed) are allocated from the allocator passed to compile()
+        // and they are referenced by the compiled tree, so they must outlive this call; we can't use a temporary allocator here.
+        return share_execnodes(compile(reorder_root(root), cctx, cctx.allocator), cctx);
+}
+
+// exec_nodes that are identical iff they reference the same context(or term)
+// This holds for exec_nodes processed by share_execnode()
+static inline bool identical(const exec_node &a, const exec_node &b) noexcept
+{
+        if (a.fp != b.fp)
+                return false;
+        else if (a.fp == ENT::matchterm)
+                return a.u16 == b.u16;
+        else
+                return a.ptr == b.ptr;
+}
+
+static inline void append_identity(const exec_node &n, std::string *const key)
+{
+        key->push_back(char(n.fp));
+        if (n.fp == ENT::matchterm)
+                key->append(reinterpret_cast<const char *>(&n.u16), sizeof(n.u16));
+        else
+                key->append(reinterpret_cast<const char *>(&n.ptr), sizeof(n.ptr));
+}
+
+static void share_execnode(exec_node &n, compilation_ctx &cctx, std::unordered_map<std::string, exec_node> &map)
+{
+        std::string key;
+
+        key.push_back(char(n.fp));
+        switch (n.fp)
+        {
+                case ENT::matchallterms:
+                case ENT::matchanyterms:
+                case ENT::matchrange:
+                {
+                        // runs are sets of terms
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+                        exec_term_id_t terms[run->size];
+
+                        memcpy(terms, run->terms, sizeof(exec_term_id_t) * run->size);
+                        std::sort(terms, terms + run->size);
+                        key.append(reinterpret_cast<const char *>(terms), sizeof(exec_term_id_t) * run->size);
+                }
+                break;
+
+                case ENT::matchphrase:
+                {
+                        const auto p = static_cast<const compilation_ctx::phrase *>(n.ptr);
+
+                        key.append(reinterpret_cast<const char *>(p->termIDs), sizeof(exec_term_id_t) * p->size);
+                }
+                break;
+
+                case ENT::matchallphrases:
+                case ENT::matchanyphrases:
+                {
+                        const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+
+                        for (uint32_t i{0}; i != run->size; ++i)
+                        {
+                                const auto p = run->phrases[i];
+
+                                key.push_back(char(p->size));
+                                key.append(reinterpret_cast<const char *>(p->termIDs), sizeof(exec_term_id_t) * p->size);
+                        }
+                }
+                break;
+
+                case ENT::unaryand:
+                case ENT::unarynot:
+                case ENT::consttrueexpr:
+                {
+                        auto ctx = static_cast<compilation_ctx::unaryop_ctx *>(n.ptr);
+                        auto expr{ctx->expr};
+
+                        share_execnode(expr, cctx, map);
+                        if (!identical(expr, ctx->expr))
+                                n.ptr = ctx = cctx.register_unaryop(expr);
+
+                        append_identity(ctx->expr, &key);
+                }
+                break;
+
+                case ENT::logicaland:
+                case ENT::logicalor:
+                case ENT::logicalnot:
+                {
+                        auto ctx = static_cast<compilation_ctx::binop_ctx *>(n.ptr);
+                        auto lhs{ctx->lhs}, rhs{ctx->rhs};
+
+                        share_execnode(lhs, cctx, map);
+                        share_execnode(rhs, cctx, map);
+
+                        if (n.fp != ENT::logicalnot && identical(lhs, rhs))
+                        {
+                                // (X OR X), (X AND X) => X
+                                n = lhs;
+                                return;
+                        }
+
+                        if (n.fp == ENT::logicalor && lhs.fp == ENT::logicaland && rhs.fp == ENT::logicaland)
+                        {
+                                // ((X AND a) OR (X AND b)) => (X AND (a OR b))
+                                // so that X is evaluated once. This is very common for rewritten queries(see rewrite_query()), where
+                                // the alternatives of a tokens sequence are ANDed with the rest of the tokens in each branch.
+                                //
+                                // We don't factor out optional(ENT::consttrueexpr) expressions out of a disjunction; in a disjunction they
+                                // are no longer optional.
+                                const auto a = static_cast<const compilation_ctx::binop_ctx *>(lhs.ptr);
+                                const auto b = static_cast<const compilation_ctx::binop_ctx *>(rhs.ptr);
+                                const exec_node *common{nullptr}, *x, *y;
+
+                                if (identical(a->lhs, b->lhs))
+                                {
+                                        common = &a->lhs;
+                                        x = &a->rhs;
+                                        y = &b->rhs;
+                                }
+                                else if (identical(a->lhs, b->rhs))
+                                {
+                                        common = &a->lhs;
+                                        x = &a->rhs;
+                                        y = &b->lhs;
+                                }
+                                else if (identical(a->rhs, b->lhs))
+                                {
+                                        common = &a->rhs;
+                                        x = &a->lhs;
+                                        y = &b->rhs;
+                                }
+                                else if (identical(a->rhs, b->rhs))
+                                {
+                                        common = &a->rhs;
+                                        x = &a->lhs;
+                                        y = &b->lhs;
+                                }
+
+                                if (common && x->fp != ENT::consttrueexpr && y->fp != ENT::consttrueexpr)
+                                {
+                                        // the contexts of (lhs, rhs) may be shared, so we need new contexts
+                                        exec_node disjunction;
+
+                                        disjunction.fp = ENT::logicalor;
+                                        disjunction.ptr = cctx.register_binop(*x, *y);
+
+                                        n.fp = ENT::logicaland;
+                                        n.ptr = cctx.register_binop(*common, disjunction);
+                                        share_execnode(n, cctx, map);
+                                        return;
+                                }
+                        }
+
+                        if (!identical(lhs, ctx->lhs) || !identical(rhs, ctx->rhs))
+                                n.ptr = ctx = cctx.register_binop(lhs, rhs);
+
+                        append_identity(ctx->lhs, &key);
+                        append_identity(ctx->rhs, &key);
+                }
+                break;
+
+                case ENT::matchsome:
+                {
+                        auto pm = static_cast<compilation_ctx::partial_match_ctx *>(n.ptr);
+
+                        // matchsome contexts are not shared until now, so we can update the nodes in place
+                        key.append(reinterpret_cast<const char *>(&pm->min), sizeof(pm->min));
+                        for (uint32_t i{0}; i != pm->size; ++i)
+                        {
+                                share_execnode(pm->nodes[i], cctx, map);
+                                append_identity(pm->nodes[i], &key);
+                        }
+                }
+                break;
+
+                case ENT::matchallnodes:
+                case ENT::matchanynodes:
+                {
+                        auto g = static_cast<compilation_ctx::nodes_group *>(n.ptr);
+
+                        for (uint32_t i{0}; i != g->size; ++i)
+                        {
+                                share_execnode(g->nodes[i], cctx, map);
+                                append_identity(g->nodes[i], &key);
+                        }
+                }
+                break;
+
+                default:
+                        // terms and constants; nothing to share
+                        return;
+        }
+
+        if (const auto res = map.insert({std::move(key), n}); !res.second)
+                n = res.first->second;
+}
+
+exec_node Trinity::share_execnodes(exec_node root, compilation_ctx &cctx)
+{
+        std::unordered_map<std::string, exec_node> map;
+
+        share_execnode(root, cctx, map);
+        return root;
+}
+
+static exec_node clone_execnodes_impl(const exec_node n, compilation_ctx &cctx, std::unordered_map<const void *, void *> &cloned)
+{
+        exec_node res{n};
+
+        switch (n.fp)
+        {
+                case ENT::matchterm:
+                case ENT::constfalse:
+                case ENT::consttrue:
+                case ENT::dummyop:
+                        return res;
+
+                default:
+                        // shared contexts(see share_execnodes()) are cloned once
+                        if (const auto it = cloned.find(n.ptr); it != cloned.end())
+                        {
+                                res.ptr = it->second;
+                                return res;
+                        }
+                        break;
+        }
+
+        switch (n.fp)
+        {
+                case ENT::matchallterms:
+                case ENT::matchanyterms:
+                case ENT::matchrange:
+                {
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+                        const auto size = sizeof(compilation_ctx::termsrun) + sizeof(exec_term_id_t) * run->size;
+
+                        res.ptr = memcpy(cctx.runsAllocator.AllocCacheAligned(size), run, size);
+                }
+                break;
+
+                case ENT::matchphrase:
+                {
+                        const auto p = static_cast<const compilation_ctx::phrase *>(n.ptr);
+                        const auto size = sizeof(compilation_ctx::phrase) + sizeof(exec_term_id_t) * p->size;
+
+                        res.ptr = memcpy(cctx.ctxAllocator.AllocCacheAligned(size), p, size);
+                }
+                break;
+
+                case ENT::matchallphrases:
+                case ENT::matchanyphrases:
+                {
+                        const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+                        auto ptr = (compilation_ctx::phrasesrun *)cctx.allocator.Alloc(sizeof(compilation_ctx::phrasesrun) + run->size * sizeof(compilation_ctx::phrase *));
+
+                        ptr->size = run->size;
+                        for (uint32_t i{0}; i != run->size; ++i)
+                        {
+                                const auto p = run->phrases[i];
+                                const auto size = sizeof(compilation_ctx::phrase) + sizeof(exec_term_id_t) * p->size;
+
+                                ptr->phrases[i] = (compilation_ctx::phrase *)memcpy(cctx.allocator.Alloc(size), p, size);
+                        }
+
+                        res.ptr = ptr;
+                }
+                break;
+
+                case ENT::unaryand:
+                case ENT::unarynot:
+                case ENT::consttrueexpr:
+                        res.ptr = cctx.register_unaryop(clone_execnodes_impl(static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr)->expr, cctx, cloned));
+                        break;
+
+                case ENT::logicaland:
+                case ENT::logicalor:
+                case ENT::logicalnot:
+                {
+                        const auto ctx = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+
+                        res.ptr = cctx.register_binop(clone_execnodes_impl(ctx->lhs, cctx, cloned), clone_execnodes_impl(ctx->rhs, cctx, cloned));
+                }
+                break;
+
+                case ENT::matchsome:
+                {
+                        const auto pm = static_cast<const compilation_ctx::partial_match_ctx *>(n.ptr);
+                        auto ptr = (compilation_ctx::partial_match_ctx *)cctx.allocator.Alloc(sizeof(compilation_ctx::partial_match_ctx) + sizeof(exec_node) * pm->size);
+
+                        ptr->min = pm->min;
+                        ptr->size = pm->size;
+                        for (uint32_t i{0}; i != pm->size; ++i)
+                                ptr->nodes[i] = clone_execnodes_impl(pm->nodes[i], cctx, cloned);
+
+                        res.ptr = ptr;
+                }
+                break;
+
+                case ENT::matchallnodes:
+                case ENT::matchanynodes:
+                {
+                        const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+                        auto ptr = (compilation_ctx::nodes_group *)cctx.allocator.Alloc(sizeof(compilation_ctx::nodes_group) + sizeof(exec_node) * g->size);
+
+                        ptr->size = g->size;
+                        for (uint32_t i{0}; i != g->size; ++i)
+                                ptr->nodes[i] = clone_execnodes_impl(g->nodes[i], cctx, cloned);
+
+                        res.ptr = ptr;
+                }
+                break;
+
+                case ENT::SPECIALIMPL_COLLECTION_LOGICALOR:
+                case ENT::SPECIALIMPL_COLLECTION_LOGICALAND:
+                        // only created by prepare_tree()
+                        std::abort();
+
+                default:
+                        break;
+        }
+
+        cloned.insert({n.ptr, res.ptr});
+        return res;
+}
+
+exec_node Trinity::clone_execnodes(const exec_node n, compilation_ctx &cctx)
+{
+        std::unordered_map<const void *, void *> cloned;
+
+        return clone_execnodes_impl(n, cctx, cloned);
 }
 
 void Trinity::group_execnodes(exec_node &n, simple_allocator &a)
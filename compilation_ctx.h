@@ -1,4 +1,6 @@
 #pragma once
+#include "arena.h"
+#include "bigrams.h"
 #include "common.h"
 #include "queries.h"
 #include "runtime.h"
@@ -24,6 +26,8 @@ namespace Trinity
                 logicalnot,
                 logicalor,
                 matchsome,
+                // a termsrun; the terms a numeric range was expanded to. See ast_node::Type::NumericRange
+                matchrange,
                 // matchallnodes and matchanynodes are handled by the compiler/optimizer, though
                 // no exec. nodes of that type are generated during compilation.
                 matchallnodes,
@@ -50,7 +54,11 @@ namespace Trinity
         struct compilation_ctx
         {
                 simple_allocator allocator{4096 * 6};
-                simple_allocator runsAllocator{4096}, ctxAllocator{4096};
+                // exec_node contexts, aligned to cache lines; see aligned_arena
+                aligned_arena runsAllocator{4096}, ctxAllocator{4096};
+                // If set, phrases compiled to their bigram term(see register_bigram()) are still verified, i.e compiled to (bigram AND phrase), where
+                // the bigram term only narrows down the candidates; this is needed if the phrase's terms and their hits are to be matched(i.e unless ExecFlags::DocumentsOnly)
+                bool verifyBigramPhrases{true};
 
                 struct partial_match_ctx final
                 {
@@ -138,9 +146,16 @@ namespace Trinity
 
                 phrase *register_phrase(const Trinity::phrase *p);
 
+                // If the index source indexed the bigram of a phrase of two terms(see indexed_bigrams()), returns
+                // the resolved bigram term, which is 0 if no document has that phrase. Otherwise, returns UINT32_MAX
+                uint32_t register_bigram(const Trinity::phrase *p);
+
+                // Returns nullptr if none of the terms the range is expanded to can be resolved
+                termsrun *register_numeric_range(const Trinity::numeric_range *r);
+
                 binop_ctx *register_binop(const exec_node lhs, const exec_node rhs)
                 {
-                        auto ptr = ctxAllocator.New<binop_ctx>();
+                        auto ptr = ctxAllocator.NewCacheAligned<binop_ctx>();
 
                         ptr->lhs = lhs;
                         ptr->rhs = rhs;
@@ -149,16 +164,35 @@ namespace Trinity
 
                 unaryop_ctx *register_unaryop(const exec_node expr)
                 {
-                        auto ptr = ctxAllocator.New<unaryop_ctx>();
+                        auto ptr = ctxAllocator.NewCacheAligned<unaryop_ctx>();
 
                         ptr->expr = expr;
                         return ptr;
                 }
 
                 virtual uint16_t resolve_query_term(const str8_t term) = 0;
+
+                // See IndexSource::indexed_bigrams()
+                virtual const Bigrams::terms_set *indexed_bigrams()
+                {
+                        return nullptr;
+                }
         };
 
 	exec_node compile_query(ast_node *root, compilation_ctx &cctx);
 
         void group_execnodes(exec_node &, simple_allocator &);
+
+        // Hash-consing of the exec_nodes tree; identical subtrees(e.g the same phrase or terms run, duplicated across the alternatives
+        // of a rewritten query) are replaced by a single instance, so the tree becomes a DAG where nodes that share a context are identical.
+        // It also factors out expressions common to both branches of a disjunction i.e ((X AND a) OR (X AND b)) => (X AND (a OR b))
+        // so that X is evaluated once per document. compile_query() invokes it.
+        //
+        // Contexts may be referenced by multiple exec_nodes, so passes that follow must not modify a context in ways that only
+        // make sense for one of them.
+        exec_node share_execnodes(exec_node root, compilation_ctx &cctx);
+
+        // Deep copy of a compiled exec_nodes tree(i.e before prepare_tree()); all contexts are allocated from cctx
+        // Shared contexts(see share_execnodes()) remain shared in the copy
+        exec_node clone_execnodes(const exec_node, compilation_ctx &cctx);
 }
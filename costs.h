@@ -0,0 +1,108 @@
+#pragma once
+#include "codecs.h"
+
+namespace Trinity
+{
+        // The cost model the execution engine uses in order to reorder exec_nodes and conjunctions' iterators, and to
+        // choose among alternative strategies; see reorder_execnode_impl(), DocsSetIterators::cost(), build_iterator() and build_span()
+        //
+        // Costs are expressed in (approximately) postings decoded, so they account for the codec(decode cost, skiplist granularity), and
+        // not just the number of documents of the terms involved.
+        //
+        // The selectivity of conjunctions is estimated by assuming that terms are distributed independently of each other. This is
+        // often off, but what matters here is the relative order of the estimates, and that's far better than only considering the lead.
+        namespace Costs
+        {
+                // Materializing a document's hits for a phrase term, relative to decoding a posting
+                static constexpr uint64_t HitsMaterialization{4};
+
+                // Collecting and sorting a posting into a materialized set(see docids_set::make()), relative to decoding a posting
+                static constexpr uint64_t UnionMaterialization{4};
+
+                // Estimated number of documents in both sets(of a and b documents), for an index of docsCnt documents.
+                // If docsCnt is not known(0), the smallest set is returned.
+                inline uint64_t intersection(const uint64_t a, const uint64_t b, const uint32_t docsCnt) noexcept
+                {
+                        if (!docsCnt || a > docsCnt || b > docsCnt)
+                                return std::min(a, b);
+                        else
+                                return std::max<uint64_t>(a && b, a * b / docsCnt);
+                }
+
+                // Cost of accessing all documents of the postings list via next()
+                inline uint64_t scan(const Codecs::Decoder *const dec) noexcept
+                {
+                        return uint64_t(dec->indexTermCtx.documents) * dec->decode_cost();
+                }
+
+                // Cost of advance()ing to `targets` distinct documents in ascending order
+                // With a skiplist, each advance() decodes at most skiplist_granularity() documents, but never more than all of them overall.
+                inline uint64_t advance(const Codecs::Decoder *const dec, const uint64_t targets) noexcept
+                {
+                        const uint64_t documents = dec->indexTermCtx.documents;
+
+                        if (const uint64_t g = dec->skiplist_granularity())
+                                return std::min(documents, targets * g) * dec->decode_cost();
+                        else
+                                return documents * dec->decode_cost();
+                }
+
+                // Cost of the disjunction of decoders[0, n), when it is advance()d to `targets` documents(UINT64_MAX if all its documents are accessed,
+                // e.g if it leads a conjunction). Every posting accessed also updates the disjunction's priority queue, which is O(log(n)).
+                inline uint64_t disjunction(const Codecs::Decoder *const *const decoders, const uint16_t n, const uint64_t targets) noexcept
+                {
+                        const uint64_t pqUpdate = 64 - SwitchBitOps::LeadingZeros(uint64_t(n));
+                        uint64_t cost{0};
+
+                        for (uint16_t i{0}; i != n; ++i)
+                        {
+                                const uint64_t accessed = std::min<uint64_t>(decoders[i]->indexTermCtx.documents, targets);
+
+                                cost += advance(decoders[i], accessed) + accessed * pqUpdate;
+                        }
+
+                        return cost;
+                }
+
+                // Cost of materializing the union of decoders[0, n) into a set that can then be accessed for next to nothing
+                inline uint64_t union_materialization(const Codecs::Decoder *const *const decoders, const uint16_t n) noexcept
+                {
+                        uint64_t cost{0};
+
+                        for (uint16_t i{0}; i != n; ++i)
+                                cost += scan(decoders[i]) + uint64_t(decoders[i]->indexTermCtx.documents) * UnionMaterialization;
+
+                        return cost;
+                }
+
+                // Cost of the conjunction of decoders[0, n), where decoders[0] is the lead, and every other decoder is advanced to the
+                // candidates produced by the decoders that precede it. If matches is not nullptr, it is set to the estimated matches.
+                inline uint64_t conjunction(const Codecs::Decoder *const *const decoders, const uint16_t n, const uint32_t docsCnt, uint64_t *const matches = nullptr) noexcept
+                {
+                        uint64_t cost = scan(decoders[0]);
+                        uint64_t candidates = decoders[0]->indexTermCtx.documents;
+
+                        for (uint16_t i{1}; i < n; ++i)
+                        {
+                                cost += advance(decoders[i], candidates);
+                                candidates = intersection(candidates, decoders[i]->indexTermCtx.documents, docsCnt);
+                        }
+
+                        if (matches)
+                                *matches = candidates;
+
+                        return cost;
+                }
+
+                // A phrase is the conjunction of its terms, in phrase order(the first term leads, see DocsSetIterators::Phrase), and
+                // for every document that matches all of them, we need to materialize the hits of all terms in order to check their positions.
+                // This accounts for both the phrase size and how popular each of the terms is.
+                inline uint64_t phrase(const Codecs::Decoder *const *const decoders, const uint16_t n, const uint32_t docsCnt) noexcept
+                {
+                        uint64_t matches;
+                        const auto cost = conjunction(decoders, n, docsCnt, &matches);
+
+                        return cost + matches * n * HitsMaterialization;
+                }
+        }
+}
@@ -2,60 +2,104 @@
 #include <ansifmt.h>
 #include <switch_bitops.h>
 
-// packs a list of updated/delete documents into a buffer that also contains
-// a skiplist for random access to the bitmaps
+// Trails containers packed updates; see pack_updates()
+// When interpreted as the (lowest, highest) pair of the legacy format, lowest > highest, so
+// it can't be mistaken for it.
+static constexpr uint64_t ContainersMagic{0x10000000fffffff0};
+
+static void pack_container(const uint16_t key, const uint16_t *const values, const uint32_t n, IOBuffer *const buf, const std::size_t base, std::vector<Trinity::docids_container_header> *const headers)
+{
+        uint32_t runs{1};
+
+        for (uint32_t i{1}; i < n; ++i)
+                runs += (values[i] != values[i - 1] + 1);
+
+        // Pick the smallest representation
+        const std::size_t arraySize = n * sizeof(uint16_t);
+        const std::size_t runsSize = runs * sizeof(uint16_t) * 2;
+        static constexpr std::size_t bitmapSize{(1 << 16) / 8};
+
+        if (runsSize < arraySize && runsSize < bitmapSize)
+        {
+                headers->push_back({key, Trinity::DocIDsContainerType::Run, 0, runs, uint32_t(buf->size() - base)});
+
+                for (uint32_t i{0}; i != n;)
+                {
+                        const auto start = values[i];
+
+                        while (++i != n && values[i] == values[i - 1] + 1)
+                                continue;
+
+                        buf->pack(uint16_t(start), uint16_t(values[i - 1] - start));
+                }
+        }
+        else if (n <= 4096)
+        {
+                headers->push_back({key, Trinity::DocIDsContainerType::Array, 0, n, uint32_t(buf->size() - base)});
+                buf->serialize(values, arraySize);
+        }
+        else
+        {
+                // bitmaps are accessed as u64 words
+                while ((buf->size() - base) & 7)
+                        buf->pack(uint8_t(0));
+
+                headers->push_back({key, Trinity::DocIDsContainerType::Bitmap, 0, n, uint32_t(buf->size() - base)});
+
+                buf->reserve(bitmapSize);
+
+                auto *const bm = (uint64_t *)buf->end();
+
+                memset(bm, 0, bitmapSize);
+                for (uint32_t i{0}; i != n; ++i)
+                        SwitchBitOps::Bitmap<uint64_t>::Set(bm, values[i]);
+
+                buf->advance_size(bitmapSize);
+        }
+}
+
+// packs a list of updated/delete documents into containers(see DocIDsContainerType), followed by
+// the containers headers and a trailer
+//
+// We used to pack them into fixed size(32k bits) bitmaps, with a skiplist for random access to them; unpack_updates() still supports that format
 void Trinity::pack_updates(std::vector<docid_t> &updatedDocumentIDs, IOBuffer *const buf)
 {
         if (updatedDocumentIDs.size())
         {
-                static constexpr size_t BANK_SIZE{32 * 1024};
-                static_assert((BANK_SIZE & 63) == 0, "Not divisable by 64");
-                IOBuffer skiplist;
+                const auto base = buf->size();
+                std::vector<docids_container_header> headers;
+                std::vector<uint16_t> values;
 
                 std::sort(updatedDocumentIDs.begin(), updatedDocumentIDs.end());
-
-#if 0 	// We are now throwing an exception if we attempt to erase or update the same document more than once in Trinity::SegmentIndexSession
-		// We could have filtered dupes int he main loop, but keep it simple
-		// We will throw an exception if we attempt to update a document twice, but we can safely erase a document however many times
+                // We are now throwing an exception if we attempt to erase or update the same document more than once in Trinity::SegmentIndexSession
+                // but this is cheap
                 updatedDocumentIDs.resize(std::unique(updatedDocumentIDs.begin(), updatedDocumentIDs.end()) - updatedDocumentIDs.begin());
-#endif
 
                 for (const auto *p = updatedDocumentIDs.data(), *const e = p + updatedDocumentIDs.size(); p != e;)
                 {
-                        // We can create a bitmap
-                        // which will come down to about 4k that can hold 32k documents
-                        // which allows for O(1) access
-                        // For 10million IDs, this comes down to about 2MBs which is not much, considering
-                        // how we are going to be advancing one range/time
-                        const auto id = *p, base = id;
-                        const auto upto = id + BANK_SIZE;
-
-                        buf->reserve(BANK_SIZE / 8);
+                        const uint16_t key = *p >> 16;
 
-                        auto *const bm = (uint64_t *)buf->end();
-
-                        memset(bm, 0, BANK_SIZE / 8);
-
-                        skiplist.pack(id);
+                        values.clear();
                         do
                         {
-                                const auto rel = *p - base;
-
-                                SwitchBitOps::Bitmap<uint64_t>::Set(bm, rel);
-                        } while (++p != e && *p < upto);
+                                values.push_back(*p & 0xffff);
+                        } while (++p != e && (*p >> 16) == key);
 
-                        buf->advance_size(BANK_SIZE / 8);
+                        pack_container(key, values.data(), values.size(), buf, base, &headers);
                 }
 
-                buf->pack(uint8_t(log2(BANK_SIZE)));                              // 1 byte will suffice
-                buf->serialize(skiplist.data(), skiplist.size());                 // skiplist
-                buf->pack(uint32_t(skiplist.size() / sizeof(docid_t)));           // TODO: use varint encoding here
+                while ((buf->size() - base) & 3)
+                        buf->pack(uint8_t(0));
+
+                buf->serialize(headers.data(), headers.size() * sizeof(docids_container_header));
+                buf->pack(uint32_t(headers.size()));
                 buf->pack(updatedDocumentIDs.front(), updatedDocumentIDs.back()); //lowest, highest
+                buf->pack(ContainersMagic);
         }
 }
 
 // see pack_updates()
-// use this function to unpack the represetnation we need to access the packed (into bitmaps)
+// use this function to unpack the represetnation we need to access the packed
 // updated documents
 Trinity::updated_documents Trinity::unpack_updates(const range_base<const uint8_t *, uint32_t> content)
 {
@@ -65,6 +109,26 @@ Trinity::updated_documents Trinity::unpack_updates(const range_base<const uint8_
         const auto *const b = content.start();
         const auto *p = b + content.size();
 
+        if (content.size() >= sizeof(uint64_t) + sizeof(docid_t) * 2 + sizeof(uint32_t) && *(uint64_t *)(p - sizeof(uint64_t)) == ContainersMagic)
+        {
+                p -= sizeof(uint64_t);
+                p -= sizeof(docid_t);
+                const auto highest = *(docid_t *)p;
+                p -= sizeof(docid_t);
+                const auto lowest = *(docid_t *)p;
+                p -= sizeof(uint32_t);
+                const auto containersCnt = *(uint32_t *)p;
+
+                p -= containersCnt * sizeof(docids_container_header);
+                require(p >= b);
+
+                updated_documents res{nullptr, 0, 0, b, lowest, highest};
+
+                res.containers = reinterpret_cast<const docids_container_header *>(p);
+                res.containersCnt = containersCnt;
+                return res;
+        }
+
         p -= sizeof(docid_t);
         const auto highest = *(docid_t *)p;
         p -= sizeof(docid_t);
@@ -81,10 +145,228 @@ Trinity::updated_documents Trinity::unpack_updates(const range_base<const uint8_
         return {skiplist, skiplistSize, bankSize, b, lowest, highest};
 }
 
+bool Trinity::docids_container_test(const DocIDsContainerType type, const uint32_t n, const uint8_t *const data, const uint16_t low) noexcept
+{
+        switch (type)
+        {
+                case DocIDsContainerType::Bitmap:
+                        return SwitchBitOps::Bitmap<uint64_t>::IsSet((uint64_t *)data, low);
+
+                case DocIDsContainerType::Array:
+                {
+                        const auto values = reinterpret_cast<const uint16_t *>(data);
+
+                        return std::binary_search(values, values + n, low);
+                }
+
+                case DocIDsContainerType::Run:
+                {
+                        const auto runs = reinterpret_cast<const uint16_t *>(data);
+                        int32_t btm{0};
+
+                        // last run where start <= low
+                        for (int32_t top{int32_t(n) - 1}; btm <= top;)
+                        {
+                                const auto mid = (btm + top) / 2;
+
+                                if (runs[mid * 2] <= low)
+                                        btm = mid + 1;
+                                else
+                                        top = mid - 1;
+                        }
+
+                        if (!btm)
+                                return false;
+
+                        const auto run = runs + (btm - 1) * 2;
+
+                        return low <= uint32_t(run[0]) + run[1];
+                }
+        }
+
+        return false;
+}
+
+bool Trinity::updated_documents_scanner::test_containers(const docid_t id) noexcept
+{
+        const uint16_t key = id >> 16;
+
+        if (id > maxDocID)
+        {
+                reset();
+                return false;
+        }
+
+        if (container->key < key)
+        {
+                container = std::lower_bound(container, containersEnd, key, [](const auto &c, const uint16_t k) noexcept {
+                        return c.key < k;
+                });
+
+                if (container == containersEnd)
+                {
+                        reset();
+                        return false;
+                }
+        }
+
+        if (container->key != key)
+                return false;
+
+        return docids_container_test(container->type, container->n, udBanks + container->offset, id & 0xffff);
+}
+
+// Array containers for upto 4096 values, bitmaps otherwise
+static Trinity::docids_set::container new_set_container(const uint16_t key, const std::vector<uint16_t> &values, std::vector<std::unique_ptr<uint64_t[]>> *const storage)
+{
+        const uint32_t n = values.size();
+
+        if (n <= 4096)
+        {
+                auto data = new uint64_t[(n * sizeof(uint16_t) + 7) / 8];
+
+                storage->emplace_back(data);
+                memcpy(data, values.data(), n * sizeof(uint16_t));
+                return {key, Trinity::DocIDsContainerType::Array, n, reinterpret_cast<const uint8_t *>(data)};
+        }
+        else
+        {
+                auto data = new uint64_t[1024];
+
+                storage->emplace_back(data);
+                memset(data, 0, 1024 * sizeof(uint64_t));
+                for (const auto v : values)
+                        SwitchBitOps::Bitmap<uint64_t>::Set(data, v);
+
+                return {key, Trinity::DocIDsContainerType::Bitmap, n, reinterpret_cast<const uint8_t *>(data)};
+        }
+}
+
+Trinity::docids_set Trinity::docids_set::make(std::vector<docid_t> &ids, std::vector<std::unique_ptr<uint64_t[]>> *const storage)
+{
+        std::vector<uint16_t> values;
+        docids_set res;
+
+        std::sort(ids.begin(), ids.end());
+        ids.resize(std::unique(ids.begin(), ids.end()) - ids.begin());
+
+        for (const auto *p = ids.data(), *const e = p + ids.size(); p != e;)
+        {
+                const uint16_t key = *p >> 16;
+
+                values.clear();
+                do
+                {
+                        values.push_back(*p & 0xffff);
+                } while (++p != e && (*p >> 16) == key);
+
+                res.containers.push_back(new_set_container(key, values, storage));
+        }
+
+        return res;
+}
+
+uint64_t Trinity::docids_set::cardinality() const noexcept
+{
+        uint64_t res{0};
+
+        for (const auto &c : containers)
+        {
+                if (c.type == DocIDsContainerType::Run)
+                {
+                        const auto runs = reinterpret_cast<const uint16_t *>(c.data);
+
+                        for (uint32_t i{0}; i != c.n; ++i)
+                                res += uint32_t(runs[i * 2 + 1]) + 1;
+                }
+                else
+                        res += c.n;
+        }
+
+        return res;
+}
+
+Trinity::docids_set Trinity::docids_set::make_union(const docids_set &prev, const updated_documents &ud, std::vector<std::unique_ptr<uint64_t[]>> *const storage)
+{
+        std::vector<docid_t> ids;
+        std::vector<uint16_t> values;
+        docids_set res;
+        const auto *it = prev.containers.data(), *const end = it + prev.containers.size();
+
+        for_each_updated_document(ud, [&ids](const docid_t id) {
+                ids.push_back(id);
+        });
+
+        for (const auto *p = ids.data(), *const e = p + ids.size(); p != e;)
+        {
+                const uint16_t key = *p >> 16;
+
+                // retain(share) containers of prev that are not affected
+                while (it != end && it->key < key)
+                        res.containers.push_back(*it++);
+
+                values.clear();
+                do
+                {
+                        values.push_back(*p & 0xffff);
+                } while (++p != e && (*p >> 16) == key);
+
+                if (it != end && it->key == key)
+                {
+                        const auto c = *it++;
+
+                        // merge with the values of prev's container
+                        switch (c.type)
+                        {
+                                case DocIDsContainerType::Array:
+                                        values.insert(values.end(), reinterpret_cast<const uint16_t *>(c.data), reinterpret_cast<const uint16_t *>(c.data) + c.n);
+                                        break;
+
+                                case DocIDsContainerType::Bitmap:
+                                        for (uint32_t k{0}; k != 1024; ++k)
+                                        {
+                                                for (auto w = reinterpret_cast<const uint64_t *>(c.data)[k]; w; w &= w - 1)
+                                                        values.push_back((k << 6) + SwitchBitOps::TrailingZeros(w));
+                                        }
+                                        break;
+
+                                case DocIDsContainerType::Run:
+                                        for (uint32_t k{0}; k != c.n; ++k)
+                                        {
+                                                const auto start = reinterpret_cast<const uint16_t *>(c.data)[k * 2];
+                                                const auto last = uint32_t(start) + reinterpret_cast<const uint16_t *>(c.data)[k * 2 + 1];
+
+                                                for (uint32_t v = start; v <= last; ++v)
+                                                        values.push_back(v);
+                                        }
+                                        break;
+                        }
+
+                        std::sort(values.begin(), values.end());
+                        values.resize(std::unique(values.begin(), values.end()) - values.begin());
+                }
+
+                res.containers.push_back(new_set_container(key, values, storage));
+        }
+
+        while (it != end)
+                res.containers.push_back(*it++);
+
+        return res;
+}
+
 bool Trinity::updated_documents_scanner::test(const docid_t id) noexcept
 {
         static constexpr bool trace{false}, traceAdvances{false};
 
+        if (containersEnd)
+        {
+                if (drained())
+                        return false;
+
+                return test_containers(id);
+        }
+
         if (trace)
                 SLog(ansifmt::bold, "Check for ", id, ", curBankRange = ", curBankRange, ", contains ", curBankRange.Contains(id), ansifmt::reset, "\n");
 
@@ -153,3 +435,59 @@ bool Trinity::updated_documents_scanner::test(const docid_t id) noexcept
                 return false;
         }
 }
+
+void Trinity::masked_documents_registry::mask_window(const docid_t base, const uint32_t size, uint64_t *const out) noexcept
+{
+        const uint32_t words = size / 64;
+
+        memset(out, 0, words * sizeof(uint64_t));
+        if (!merged)
+                return;
+
+        const uint16_t key = base >> 16;
+        const auto containers = merged->containers.data();
+        const uint32_t n = merged->containers.size();
+        const auto it = std::lower_bound(containers, containers + n, key, [](const auto &c, const uint16_t k) noexcept {
+                return c.key < k;
+        });
+
+        if (it == containers + n || it->key != key)
+                return;
+
+        const uint32_t low = base & 0xffff, high = low + size;
+
+        switch (it->type)
+        {
+                case DocIDsContainerType::Bitmap:
+                        memcpy(out, reinterpret_cast<const uint64_t *>(it->data) + low / 64, words * sizeof(uint64_t));
+                        break;
+
+                case DocIDsContainerType::Array:
+                {
+                        const auto values = reinterpret_cast<const uint16_t *>(it->data), end = values + it->n;
+
+                        for (auto p = std::lower_bound(values, end, low); p != end && *p < high; ++p)
+                                SwitchBitOps::Bitmap<uint64_t>::Set(out, *p - low);
+                }
+                break;
+
+                case DocIDsContainerType::Run:
+                {
+                        const auto runs = reinterpret_cast<const uint16_t *>(it->data);
+
+                        for (uint32_t i{0}; i != it->n; ++i)
+                        {
+                                const uint32_t start = runs[i * 2], last = start + runs[i * 2 + 1];
+
+                                if (last < low)
+                                        continue;
+                                else if (start >= high)
+                                        break;
+
+                                for (uint32_t v = std::max(start, low), upto = std::min(last + 1, high); v != upto; ++v)
+                                        SwitchBitOps::Bitmap<uint64_t>::Set(out, v - low);
+                        }
+                }
+                break;
+        }
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <switch.h>
+#include <switch_bitops.h>
 #include <memory>
+#include <vector>
 #include "common.h"
 
 // Efficient, lean, fixed-size bitmaps based document IDs tracking
@@ -13,6 +15,36 @@
 // almost as fast, takes up less memory and is great for random access
 namespace Trinity
 {
+	// Roaring-style(see https://roaringbitmap.org) representation of a set of document IDs.
+	// IDs are partitioned into chunks of 64k IDs by their high 16 bits(the key), and each chunk is represented
+	// by a container, depending on its cardinality and distribution:
+	// - Array: a sorted array of the IDs low 16 bits, for sparse chunks(upto 4096 IDs)
+	// - Bitmap: a 64k bits bitmap, for dense chunks
+	// - Run: a sorted array of (start, length - 1) u16 pairs, for chunks where IDs are mostly consecutive
+	//
+	// We used to always pack masked documents into 32k bits bitmap banks, so that even a single updated document
+	// in a range would cost 4KBs, and that's not the case anymore.
+	enum class DocIDsContainerType : uint8_t
+	{
+		Array = 0,
+		Bitmap,
+		Run
+	};
+
+	struct docids_container_header final
+	{
+		uint16_t key;
+		DocIDsContainerType type;
+		uint8_t reserved;
+		// Array: total values, Run: total runs, Bitmap: total bits set
+		uint32_t n;
+		// relative to the packed content
+		uint32_t offset;
+	};
+
+	// Returns true if `low` is set in the container
+	bool docids_container_test(const DocIDsContainerType type, const uint32_t n, const uint8_t *data, const uint16_t low) noexcept;
+
         struct updated_documents final
         {
 		// Each bitmaps bank can be accessed by a skiplist via binary search
@@ -25,6 +57,11 @@ namespace Trinity
 
 		docid_t lowestID;
 		docid_t highestID;
+
+		// If not nullptr, the documents were packed into containers(see DocIDsContainerType) instead, sorted by key, and
+		// banks points to the packed content; skiplist and bankSize are not used.
+		const docids_container_header *containers{nullptr};
+		uint32_t containersCnt{0};
 		
 		inline operator bool() const
 		{
@@ -32,6 +69,97 @@ namespace Trinity
 		}
         };
 
+	// Invokes l(id) for every document in `ud`, in ascending order
+	template <typename L>
+	void for_each_updated_document(const updated_documents &ud, L &&l)
+	{
+		if (ud.containers)
+		{
+			for (uint32_t i{0}; i != ud.containersCnt; ++i)
+			{
+				const auto &c = ud.containers[i];
+				const docid_t base = docid_t(c.key) << 16;
+				const auto data = ud.banks + c.offset;
+
+				switch (c.type)
+				{
+					case DocIDsContainerType::Array:
+						for (uint32_t k{0}; k != c.n; ++k)
+							l(base | reinterpret_cast<const uint16_t *>(data)[k]);
+						break;
+
+					case DocIDsContainerType::Run:
+						for (uint32_t k{0}; k != c.n; ++k)
+						{
+							const auto start = reinterpret_cast<const uint16_t *>(data)[k * 2];
+							const auto last = uint32_t(start) + reinterpret_cast<const uint16_t *>(data)[k * 2 + 1];
+
+							for (uint32_t v = start; v <= last; ++v)
+								l(base | v);
+						}
+						break;
+
+					case DocIDsContainerType::Bitmap:
+						for (uint32_t k{0}; k != 1024; ++k)
+						{
+							for (auto w = reinterpret_cast<const uint64_t *>(data)[k]; w; w &= w - 1)
+								l(base | ((k << 6) + SwitchBitOps::TrailingZeros(w)));
+						}
+						break;
+				}
+			}
+		}
+		else
+		{
+			const auto wordsPerBank = ud.bankSize / 64;
+
+			for (uint32_t i{0}; i != ud.skiplistSize; ++i)
+			{
+				const auto base = ud.skiplist[i];
+				const auto bank = reinterpret_cast<const uint64_t *>(ud.banks + i * (ud.bankSize / 8));
+
+				for (uint32_t k{0}; k != wordsPerBank; ++k)
+				{
+					for (auto w = bank[k]; w; w &= w - 1)
+						l(base + (k << 6) + SwitchBitOps::TrailingZeros(w));
+				}
+			}
+		}
+	}
+
+	// An in-memory set of document IDs, represented as containers(see DocIDsContainerType)
+	// IndexSourcesCollection builds the union of all masked documents of the sources more recent than each
+	// source as a docids_set, so that testing a document only requires a single container probe, instead of
+	// testing every updated_documents_scanner.
+	//
+	// Containers are not owned by the set; they may be shared among many sets.
+	struct docids_set final
+	{
+		struct container final
+		{
+			uint16_t key;
+			DocIDsContainerType type;
+			uint32_t n;
+			const uint8_t *data;
+		};
+
+		std::vector<container> containers;
+
+		inline bool empty() const noexcept
+		{
+			return containers.empty();
+		}
+
+		// Returns a new set; union of `prev` and all documents in `ud`.
+		// Containers of `prev` not affected are shared, and new containers are allocated in `storage`
+		static docids_set make_union(const docids_set &prev, const updated_documents &ud, std::vector<std::unique_ptr<uint64_t[]>> *storage);
+
+		// Returns a new set of all `ids`(sorted and deduped in place), with its containers allocated in `storage`
+		static docids_set make(std::vector<docid_t> &ids, std::vector<std::unique_ptr<uint64_t[]>> *storage);
+
+		uint64_t cardinality() const noexcept;
+	};
+
         // Facilitates fast set test operations for updated/deleted documents packed
         // as bitmaps using pack_updates()
         struct updated_documents_scanner final
@@ -45,6 +173,9 @@ namespace Trinity
 		docid_t maxDocID;
                 const docid_t *const udSkipList;
                 const uint8_t *const udBanks;
+		// For updated_documents packed as containers
+		const docids_container_header *container;
+		const docids_container_header *const containersEnd;
 
 
                 void reset()
@@ -54,9 +185,11 @@ namespace Trinity
                 }
 
                 updated_documents_scanner(const updated_documents &ud)
-                    : end{ud.skiplist + ud.skiplistSize}, bankSize{ud.bankSize}, skiplistBase{ud.skiplist}, udSkipList{ud.skiplist}, udBanks{ud.banks}, maxDocID{ud.highestID}
+                    : end{ud.skiplist + ud.skiplistSize}, bankSize{ud.bankSize}, skiplistBase{ud.skiplist}, udSkipList{ud.skiplist}, udBanks{ud.banks}, maxDocID{ud.highestID}, container{ud.containers}, containersEnd{ud.containers + ud.containersCnt}
                 {
-                        if (skiplistBase != end)
+                        if (container)
+                                curBankRange.Set(0, 0);
+                        else if (skiplistBase != end)
                         {
                                 curBankRange.Set(*skiplistBase, ud.bankSize);
                                 curBank = udBanks;
@@ -64,10 +197,11 @@ namespace Trinity
                 }
 
 		updated_documents_scanner(const updated_documents_scanner &o)
-			: end{o.end}, bankSize{o.bankSize}, skiplistBase{o.skiplistBase}, udSkipList{o.udSkipList}, udBanks{o.udBanks}
+			: end{o.end}, bankSize{o.bankSize}, skiplistBase{o.skiplistBase}, udSkipList{o.udSkipList}, udBanks{o.udBanks}, container{o.container}, containersEnd{o.containersEnd}
 		{
 			curBankRange = o.curBankRange;
 			curBank = o.curBank;
+			maxDocID = o.maxDocID;
 		}
 
 
@@ -80,9 +214,14 @@ namespace Trinity
                 // You are expected to test monotonically increasing document IDs
                 bool test(const docid_t id) noexcept;
 
+	      private:
+		bool test_containers(const docid_t id) noexcept;
+
+	      public:
+
 		inline bool operator==(const updated_documents_scanner &o) const noexcept
                 {
-                        return end == o.end && bankSize == o.bankSize && curBankRange == o.curBankRange && skiplistBase == o.skiplistBase && curBank == o.curBank && udSkipList == o.udSkipList && udBanks == o.udBanks;
+                        return end == o.end && bankSize == o.bankSize && curBankRange == o.curBankRange && skiplistBase == o.skiplistBase && curBank == o.curBank && udSkipList == o.udSkipList && udBanks == o.udBanks && container == o.container;
                 }
         };
 
@@ -92,10 +231,21 @@ namespace Trinity
 
 
 	// manages multiple scanners and tests among all of them, and if any of them is exchausted, it is removed from the collection
+	//
+	// Scanners can only move forward, so if a document ID lower than the last tested ID is tested(e.g translated IDs of segments
+	// with local IDs, see SegmentIndexSession::set_index_sort()), all scanners are rewound first. This is correct but expensive, so you should
+	// still test in ascending order, or use a registry that tests against a merged set.
 	struct masked_documents_registry final
 	{
 		bool test(const docid_t id)
                 {
+			if (merged)
+				return test_merged(id);
+
+			if (unlikely(id < lastTestedID))
+				rewind();
+			lastTestedID = id;
+
                         for (uint8_t i{0}; i < rem;)
                         {
 				auto it = scanners + i;
@@ -111,6 +261,14 @@ namespace Trinity
                         return false;
                 }
 
+		// If set, the registry tests against this set instead of the scanners
+		// See IndexSourcesCollection::commit()
+		const docids_set *merged{nullptr};
+		uint32_t mergedIdx{0};
+		// the updated_documents the scanners were created from, so that they can be rewound
+		const updated_documents *uds{nullptr};
+		docid_t lastTestedID{0};
+		uint8_t cnt{0};
                 uint8_t rem;
 		updated_documents_scanner scanners[0];		
 
@@ -119,16 +277,59 @@ namespace Trinity
 		{
 		}
 
+		void rewind()
+		{
+			for (uint32_t i{0}; i != cnt; ++i)
+				new (&scanners[i]) updated_documents_scanner(uds[i]);
+			rem = cnt;
+		}
+
 		inline auto size() const noexcept
 		{
 			return rem;
 		}
 
 		inline auto empty() const noexcept
+		{
+			return 0 == rem && !merged;
+		}
+
+		bool test_merged(const docid_t id) noexcept
+		{
+			const uint16_t key = id >> 16;
+			const auto containers = merged->containers.data();
+			const uint32_t n = merged->containers.size();
+
+			// Documents are usually tested in ascending order, so
+			// the container is likely the same as the last one
+			if (mergedIdx == n || containers[mergedIdx].key != key)
+			{
+				mergedIdx = std::lower_bound(containers, containers + n, key, [](const auto &c, const uint16_t k) noexcept {
+						    return c.key < k;
+					    }) -
+					    containers;
+
+				if (mergedIdx == n || containers[mergedIdx].key != key)
+					return false;
+			}
+
+			const auto &c = containers[mergedIdx];
+
+			return docids_container_test(c.type, c.n, c.data, id & 0xffff);
+		}
+
+		// Only registries that test against a merged set, or are empty, support window masks
+		inline bool supports_window_masks() const noexcept
 		{
 			return 0 == rem;
 		}
 
+		// Sets out[] to a bitmap of all masked documents in [base, base + size)
+		// base and size must be multiples of 64, and the window must not cross a 64k IDs boundary
+		// See MatchesProxy::window_mask()
+		void mask_window(const docid_t base, const uint32_t size, uint64_t *out) noexcept;
+
+		// ud[] must outlive the registry; see rewind()
 		static std::unique_ptr<Trinity::masked_documents_registry> make(const updated_documents *ud, const std::size_t n)
                 {
 			// ASAN will complain that about alloc-dealloc-mismatch
@@ -139,11 +340,24 @@ namespace Trinity
                         auto ptr = new (malloc(sizeof(masked_documents_registry) + sizeof(updated_documents_scanner) * n)) masked_documents_registry();
 
                         ptr->rem = n;
+			ptr->cnt = n;
+			ptr->uds = ud;
 
                         for (uint32_t i{0}; i != n; ++i)
                                 new (&ptr->scanners[i]) updated_documents_scanner(ud[i]);
 
                         return std::unique_ptr<Trinity::masked_documents_registry>(ptr);
                 }
+
+		static std::unique_ptr<Trinity::masked_documents_registry> make(const docids_set *s)
+		{
+                        auto ptr = new (malloc(sizeof(masked_documents_registry))) masked_documents_registry();
+
+			ptr->rem = 0;
+			if (s && !s->empty())
+				ptr->merged = s;
+
+                        return std::unique_ptr<Trinity::masked_documents_registry>(ptr);
+		}
         };
 }
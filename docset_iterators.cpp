@@ -1,8 +1,9 @@
 #include "docset_iterators.h"
 #include "codecs.h"
+#include "costs.h"
 #include "queryexec_ctx.h"
 
-// see reorder_execnode_impl()
+// see reorder_execnode_impl() and costs.h
 uint64_t Trinity::DocsSetIterators::Iterator::cost()
 {
 	return Trinity::DocsSetIterators::cost(this);
@@ -24,6 +25,9 @@ uint64_t Trinity::DocsSetIterators::cost(const Iterator *it)
                 case Type::VectorIDs:
                         return static_cast<const VectorIDs *>(it)->ids.size();
 
+                case Type::DocIDsSet:
+                        return static_cast<const DocIDsSet *>(it)->size;
+
                 case Type::Optional:
 			return cost(static_cast<const Optional *>(it)->main);
 
@@ -50,28 +54,139 @@ uint64_t Trinity::DocsSetIterators::cost(const Iterator *it)
                 break;
 
                 case Type::Conjuction:
-                        return cost(static_cast<const Conjuction *>(it)->its[0]);
+                {
+                        // its[0] leads; every other iterator is advanced to (at most) the documents the lead matches
+                        const auto self = static_cast<const Conjuction *>(it);
+                        const auto leadCost = cost(self->its[0]);
+                        auto sum{leadCost};
+
+                        for (uint32_t i{1}; i < self->size; ++i)
+                                sum += std::min(cost(self->its[i]), leadCost);
+                        return sum;
+                }
+                break;
 
                 case Type::ConjuctionAllPLI:
-                        return cost(static_cast<const ConjuctionAllPLI *>(it)->its[0]);
+                {
+                        const auto self = static_cast<const ConjuctionAllPLI *>(it);
+                        if (!self->size)
+                        {
+                                // exhausted
+                                return 0;
+                        }
+
+                        const Codecs::Decoder *decoders[self->size];
+
+                        for (uint32_t i{0}; i != self->size; ++i)
+                                decoders[i] = self->its[i]->decoder();
+
+                        return Costs::conjunction(decoders, self->size, decoders[0]->rctx ? decoders[0]->rctx->docsCnt : 0);
+                }
+                break;
 
                 case Type::Phrase:
                 {
                         const auto self = static_cast<const Phrase *>(it);
+                        if (!self->size)
+                        {
+                                // exhausted
+                                return 0;
+                        }
+
+                        const Codecs::Decoder *decoders[self->size];
+
+                        // see phrase_cost()
+                        for (uint32_t i{0}; i != self->size; ++i)
+                                decoders[i] = self->its[i]->decoder();
 
-                        // XXX: see phrase_cost()
-                        return cost(self->its[0]) + UINT32_MAX + UINT16_MAX * self->size;
+                        return Costs::phrase(decoders, self->size, decoders[0]->rctx ? decoders[0]->rctx->docsCnt : 0);
                 }
                 break;
 
                 case Type::PostingsListIterator:
-                        return static_cast<const Codecs::PostingsListIterator *>(it)->decoder()->indexTermCtx.documents;
+                        return Costs::scan(static_cast<const Codecs::PostingsListIterator *>(it)->decoder());
 
                 case Type::Dummy:
                         return 0;
         }
 }
 
+// Positional intersection kernel for phrases; see Phrase::consider_phrase_match()
+//
+// The phrase matches at position s if every term k of the phrase has a hit at (s + k). We consider the hits of the term with
+// the fewest hits, and for every other term we maintain a cursor into its hits, which only moves forward because the candidate positions
+// are ascending. That is, this is a merge of the (shifted) hits arrays, which are short and accessed sequentially, instead of a DocWordsSpace test for
+// each position of the first term.
+//
+// Returns the number of matches(upto maxMatches), or -1 if the hits of a term are not in ascending position order, in which case
+// the caller should fall back to DocWordsSpace tests.
+static int32_t match_phrase_positions(const Trinity::term_hits *const *const hits, const uint16_t n, const uint16_t maxMatches)
+{
+        uint16_t rarest{0};
+        uint32_t cursors[n];
+        int32_t matches{0};
+        uint32_t prev{0};
+
+        for (uint16_t k{1}; k != n; ++k)
+        {
+                if (hits[k]->freq < hits[rarest]->freq)
+                        rarest = k;
+        }
+
+        memset(cursors, 0, sizeof(cursors));
+
+        const auto lead = hits[rarest];
+
+        for (uint32_t i{0}; i != lead->freq; ++i)
+        {
+                const uint32_t pos = lead->all[i].pos;
+
+                if (unlikely(pos < prev))
+                        return -1;
+
+                prev = pos;
+                if (pos <= rarest)
+                {
+                        // the phrase would need to start at position 0 (no position)
+                        continue;
+                }
+
+                const auto start = pos - rarest;
+                uint16_t k{0};
+
+                for (; k != n; ++k)
+                {
+                        if (k == rarest)
+                                continue;
+
+                        const auto h = hits[k];
+                        const auto target = start + k;
+                        auto c = cursors[k];
+
+                        while (c != h->freq && h->all[c].pos < target)
+                        {
+                                if (unlikely(c && h->all[c].pos < h->all[c - 1].pos))
+                                        return -1;
+                                ++c;
+                        }
+
+                        cursors[k] = c;
+                        if (c == h->freq)
+                        {
+                                // no more hits for this term past target
+                                return matches;
+                        }
+                        else if (h->all[c].pos != target)
+                                break;
+                }
+
+                if (k == n && ++matches == maxMatches)
+                        break;
+        }
+
+        return matches;
+}
+
 bool Trinity::DocsSetIterators::Phrase::consider_phrase_match()
 {
         [[maybe_unused]] static constexpr bool trace{false};
@@ -85,6 +200,7 @@ bool Trinity::DocsSetIterators::Phrase::consider_phrase_match()
         auto *const __restrict__ dws = doc->matchedDocument.dws;
         const auto firstTermFreq = th->freq;
         const auto firstTermHits = th->all;
+        const term_hits *hits[n];
 
 	require(curDocument.id == doc->id);
 
@@ -99,69 +215,76 @@ bool Trinity::DocsSetIterators::Phrase::consider_phrase_match()
         // another iterator advances to document 10 and needs to access the same terms, it means we 'll need to dematerialize them again.
         // Maybe this is not a big deal though?
         matchCnt = 0;
+        hits[0] = th;
         for (uint16_t i{1}; i != n; ++i)
         {
                 auto it = its[i];
 
-                doc->materialize_term_hits(&rctx, it, it->decoder()->exec_ctx_termid());
+                hits[i] = doc->materialize_term_hits(&rctx, it, it->decoder()->exec_ctx_termid());
         }
 
         if (trace)
                 SLog("firstTermFreq = ", firstTermFreq, "\n");
 
-        for (uint32_t i{0}; i != firstTermFreq; ++i)
+        if (const auto res = match_phrase_positions(hits, n, maxMatchCnt); res != -1)
+                matchCnt = res;
+        else
         {
-                if (const auto pos = firstTermHits[i].pos)
+                // hits are not in ascending position order; test positions against the DocWordsSpace instead
+                for (uint32_t i{0}; i != firstTermFreq; ++i)
                 {
-                        if (trace)
-                                SLog("For POS ", pos, "\n");
-
-                        for (uint8_t k{1};; ++k)
+                        if (const auto pos = firstTermHits[i].pos)
                         {
-                                if (k == n)
-                                {
-                                        // matched seq
-                                        if (trace)
-                                                SLog("MATCHED\n");
+                                if (trace)
+                                        SLog("For POS ", pos, "\n");
 
-                                        if (++matchCnt == maxMatchCnt)
+                                for (uint8_t k{1};; ++k)
+                                {
+                                        if (k == n)
                                         {
-                                                if (release_docrefs)
-						{
-                                                        rctx.cds_release(doc);
-						}
-						else
-						{
-							// If this matches a PHRASE, and we will need this
-							// for prepare_match()
-							// then this may be an issue -- we need to otherwise
-							// retain this document and GC it later
-							//
-							// UPDATE: if we have multiple phrases for this logical evaluation
-							// we don't want to retain a document again; once would do 
-							if (doc->rc == 1)
+                                                // matched seq
+                                                if (trace)
+                                                        SLog("MATCHED\n");
+
+                                                if (++matchCnt == maxMatchCnt)
+                                                {
+                                                        if (release_docrefs)
 							{
-								rctx.track_docref(doc);
+                                                                rctx.cds_release(doc);
 							}
 							else
 							{
-								rctx.cds_release(doc);
+								// If this matches a PHRASE, and we will need this
+								// for prepare_match()
+								// then this may be an issue -- we need to otherwise
+								// retain this document and GC it later
+								//
+								// UPDATE: if we have multiple phrases for this logical evaluation
+								// we don't want to retain a document again; once would do 
+								if (doc->rc == 1)
+								{
+									rctx.track_docref(doc);
+								}
+								else
+								{
+									rctx.cds_release(doc);
+								}
 							}
-						}
 
-                                                return true;
+                                                        return true;
+                                                }
+                                                else
+                                                        break;
                                         }
-                                        else
-                                                break;
-                                }
 
-                                const auto termID = static_cast<const Codecs::PostingsListIterator *>(its[k])->decoder()->exec_ctx_termid();
+                                        const auto termID = static_cast<const Codecs::PostingsListIterator *>(its[k])->decoder()->exec_ctx_termid();
 
-                                if (trace)
-                                        SLog("Check for ", termID, " at ", pos + k, ": ", dws->test(termID, pos + k), "\n");
+                                        if (trace)
+                                                SLog("Check for ", termID, " at ", pos + k, ": ", dws->test(termID, pos + k), "\n");
 
-                                if (!dws->test(termID, pos + k))
-                                        break;
+                                        if (!dws->test(termID, pos + k))
+                                                break;
+                                }
                         }
                 }
         }
@@ -966,3 +1089,75 @@ void Trinity::DocsSetIterators::DisjunctionSome::update_matched_cnt()
 
         tail.clear();
 }
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::DocIDsSet::seek(const isrc_docid_t target)
+{
+        const auto containers = set->containers.data();
+        const uint32_t cnt = set->containers.size();
+        const uint16_t key = target >> 16;
+
+        if (containerIdx != cnt && containers[containerIdx].key < key)
+        {
+                containerIdx = std::lower_bound(containers + containerIdx, containers + cnt, key, [](const auto &c, const uint16_t k) noexcept {
+                                       return c.key < k;
+                               }) -
+                               containers;
+                pos = 0;
+        }
+
+        for (; containerIdx != cnt; ++containerIdx, pos = 0)
+        {
+                const auto &c = containers[containerIdx];
+                const uint32_t low = c.key == key ? target & 0xffff : 0;
+                const isrc_docid_t base = isrc_docid_t(c.key) << 16;
+
+                switch (c.type)
+                {
+                        case DocIDsContainerType::Array:
+                        {
+                                const auto values = reinterpret_cast<const uint16_t *>(c.data);
+
+                                // fast-path: next()
+                                if (pos != c.n && values[pos] < low)
+                                        pos = std::lower_bound(values + pos, values + c.n, low) - values;
+
+                                if (pos != c.n)
+                                        return curDocument.id = base | values[pos];
+                        }
+                        break;
+
+                        case DocIDsContainerType::Run:
+                        {
+                                const auto runs = reinterpret_cast<const uint16_t *>(c.data);
+
+                                while (pos != c.n && uint32_t(runs[pos * 2]) + runs[pos * 2 + 1] < low)
+                                        ++pos;
+
+                                if (pos != c.n)
+                                        return curDocument.id = base | std::max<uint32_t>(runs[pos * 2], low);
+                        }
+                        break;
+
+                        case DocIDsContainerType::Bitmap:
+                        {
+                                const auto bm = reinterpret_cast<const uint64_t *>(c.data);
+                                uint32_t idx = low >> 6;
+
+                                if (idx != 1024)
+                                {
+                                        // mask off bits < low in the first word
+                                        uint64_t w = bm[idx] & (~uint64_t(0) << (low & 63));
+
+                                        while (!w && ++idx != 1024)
+                                                w = bm[idx];
+
+                                        if (w)
+                                                return curDocument.id = base | ((idx << 6) + SwitchBitOps::TrailingZeros(w));
+                                }
+                        }
+                        break;
+                }
+        }
+
+        return curDocument.id = DocIDsEND;
+}
@@ -3,6 +3,7 @@
 // in their constructors. Doing so would cause all kinds of issues with Docsets Spans.
 #pragma once
 #include "docset_iterators_base.h"
+#include "docidupdates.h"
 #include <prioqueue.h>
 
 #ifdef __clang__
@@ -501,6 +502,48 @@ namespace Trinity
                                 return id;
                         }
 
+#ifdef RDP_NEED_TOTAL_MATCHES
+			inline uint32_t total_matches() override final
+			{
+				return 1;
+			}
+#endif
+                };
+
+                // Iterates the documents of a docids_set, e.g a pre-materialized filter set(see IndexDocumentsFilter::filter_set())
+                // advance() skips whole containers, and seeks within a container via binary search(arrays, runs) or by scanning
+                // bitmap words, so that it is cheap to use it as a leader or a filter.
+                struct DocIDsSet final
+                    : public Iterator
+                {
+                        friend uint64_t cost(const Iterator *);
+
+                      private:
+                        const docids_set *const set;
+                        const uint64_t size;
+                        uint32_t containerIdx{0};
+                        // position in the current container; index of a value for arrays, of a run for runs
+                        uint32_t pos{0};
+
+                      private:
+                        isrc_docid_t seek(const isrc_docid_t target);
+
+                      public:
+                        DocIDsSet(const docids_set *const s)
+                            : Iterator{Type::DocIDsSet}, set{s}, size{s->cardinality()}
+                        {
+                        }
+
+                        inline isrc_docid_t next() override final
+                        {
+                                return unlikely(curDocument.id == DocIDsEND) ? DocIDsEND : seek(curDocument.id + 1);
+                        }
+
+                        isrc_docid_t advance(const isrc_docid_t target) override final
+                        {
+                                return seek(target);
+                        }
+
 #ifdef RDP_NEED_TOTAL_MATCHES
 			inline uint32_t total_matches() override final
 			{
@@ -22,6 +22,7 @@ namespace Trinity
                         ConjuctionAllPLI,
                         AppIterator,
                         VectorIDs,
+                        DocIDsSet,
                         Dummy,
                 };
 
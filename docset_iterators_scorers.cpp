@@ -270,6 +270,26 @@ static IteratorScorer *default_wrapper(queryexec_ctx *const rctx, DocsSetIterato
                         return new Wrapper(it, rctx);
                 }
 
+                case DocsSetIterators::Type::DocIDsSet:
+                {
+                        // filter sets do not contribute to the score
+                        struct Wrapper final
+                            : public IteratorScorer
+                        {
+                                Wrapper(Iterator *it)
+					: IteratorScorer{it}
+                                {
+                                }
+
+                                double iterator_score() override final
+                                {
+                                        return 0;
+                                }
+                        };
+
+                        return new Wrapper(it);
+                }
+
                 case DocsSetIterators::Type::VectorIDs:
                 case DocsSetIterators::Type::Dummy:
 		case DocsSetIterators::Type::AppIterator:
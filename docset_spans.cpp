@@ -63,6 +63,11 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForPartialMatch::process(MatchesProxy
                                 pq.push(it);
                         }
 
+                        const auto mask = mp->window_mask(windowBase);
+
+                        if (mask)
+                                exclude_masked(matching, mask, m, tracker);
+
                         for (uint32_t idx{0}; idx <= m; ++idx)
                         {
                                 const uint64_t _b = uint64_t(idx) << 6;
@@ -88,6 +93,8 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForPartialMatch::process(MatchesProxy
                         }
 
                         memset(matching, 0, (m + 1) * sizeof(matching[0])); // yes, we can
+                        if (mask)
+                                mp->window_processed();
                 }
         }
 
@@ -174,6 +181,11 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctions::process(MatchesProxy
                                 pq.push(it);
                         }
 
+                        const auto mask = mp->window_mask(windowBase);
+
+                        if (mask)
+                                exclude_masked(matching, mask, m);
+
                         // Process the bitmap
                         for (uint32_t idx{0}; idx <= m; ++idx)
                         {
@@ -195,6 +207,8 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctions::process(MatchesProxy
 
                         //memset(matching, 0, sizeof(uint64_t) * SET_SIZE); 
                         memset(matching, 0, (m + 1) * sizeof(matching[0])); // yes, we can
+                        if (mask)
+                                mp->window_processed();
                 }
         }
 
@@ -254,6 +268,10 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctionsWithSpans::process(Matc
                 }
 
                 const auto m = tracker.m;
+                const auto mask = mp->window_mask(windowBase);
+
+                if (mask)
+                        exclude_masked(matching, mask, m);
 
                 for (uint32_t idx{0}; idx <= m; ++idx)
                 {
@@ -274,6 +292,8 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctionsWithSpans::process(Matc
 
                 memset(matching, 0, (m + 1) * sizeof(matching[0]));
                 tracker.reset();
+                if (mask)
+                        mp->window_processed();
         }
 
         return id;
@@ -448,8 +468,12 @@ void Trinity::DocsSetSpanForDisjunctionsWithSpansAndCost::score_window_many(Matc
                 }
 
                 const auto m{tracker.m};
+                const auto mask = mp->window_mask(windowBase);
                 relevant_document relDoc;
 
+                if (mask)
+                        exclude_masked(matching, mask, m, matchesTracker);
+
                 for (uint32_t idx{0}; idx <= m; ++idx)
                 {
                         const uint64_t _b = uint64_t(idx) << 6;
@@ -476,6 +500,8 @@ void Trinity::DocsSetSpanForDisjunctionsWithSpansAndCost::score_window_many(Matc
 
                 memset(matching, 0, (m + 1) * sizeof(matching[0])); // yes, we can
                 tracker.reset();
+                if (mask)
+                        mp->window_processed();
         }
 
         for (uint32_t i{0}; i != leadsCnt; ++i)
@@ -690,6 +716,11 @@ void Trinity::DocsSetSpanForDisjunctionsWithThresholdAndCost::score_window_many(
                         }
                 }
 
+                const auto mask = mp->window_mask(windowBase);
+
+                if (mask)
+                        exclude_masked(matching, mask, m, matchesTracker);
+
 		for (uint32_t idx{0}; idx <= m; ++idx)
 		{
 			const uint64_t _b = uint64_t(idx) << 6;
@@ -717,6 +748,8 @@ void Trinity::DocsSetSpanForDisjunctionsWithThresholdAndCost::score_window_many(
 
 
                 memset(matching, 0, (m + 1) * sizeof(matching[0]));
+                if (mask)
+                        mp->window_processed();
         }
 
         for (uint32_t i{0}; i != leadsCnt; ++i)
@@ -875,6 +908,11 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctionsWithThreshold::process(
                                 }
                         }
 
+                        const auto mask = mp->window_mask(windowBase);
+
+                        if (mask)
+                                exclude_masked(matching, mask, m, tracker);
+
                         for (uint32_t idx{0}; idx <= m; ++idx)
                         {
                                 const uint64_t _b = uint64_t(idx) << 6;
@@ -901,6 +939,8 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctionsWithThreshold::process(
                         }
 
                         memset(matching, 0, (m + 1) * sizeof(matching[0]));
+                        if (mask)
+                                mp->window_processed();
                 }
         }
 
@@ -4,6 +4,7 @@
 // See comments here for why that makes sense.
 #pragma once
 #include "docset_iterators.h"
+#include <switch_bitops.h>
 
 
 namespace Trinity
@@ -14,11 +15,32 @@ namespace Trinity
         // can be used by MatchesProxy subclasses to accomplish whatever's necessary.
         class MatchesProxy
         {
+              public:
+                // See DocsSetSpan::SIZE
+                static constexpr std::size_t WINDOW_SIZE{1 << 13};
+
               public:
                 virtual void process(relevant_document_provider *)
 		{
 		}
 
+                // Spans that collect the matched documents of a window [windowBase, windowBase + WINDOW_SIZE) in a bitmap
+                // will invoke window_mask() before they process() them. If a bitmap of WINDOW_SIZE bits is returned, where
+                // each set bit represents a document of the window that should be disregarded(i.e masked or filtered), the span
+                // will exclude those from its matches with a few word-wide ANDs, process() the remaining documents of the window, and
+                // then invoke window_processed().
+                //
+                // This way, a MatchesProxy doesn't need to test every document it is provided with in process() one by one.
+                // See exec_query() handlers.
+                virtual const uint64_t *window_mask(const isrc_docid_t windowBase)
+                {
+                        return nullptr;
+                }
+
+                virtual void window_processed()
+                {
+                }
+
 		~MatchesProxy()
 		{
 		}
@@ -81,6 +103,30 @@ namespace Trinity
                 static constexpr std::size_t MASK{SIZE - 1};
                 static constexpr std::size_t SET_SIZE{SIZE / sizeof(uint64_t)};
 
+                static_assert(SIZE == MatchesProxy::WINDOW_SIZE);
+
+                // Clears the bits of documents set in `mask`(see MatchesProxy::window_mask()) from the matches bitmap of a window
+                // upto and including word m. Should vectorize nicely.
+                static inline void exclude_masked(uint64_t *__restrict__ const matching, const uint64_t *__restrict__ const mask, const uint32_t m) noexcept
+                {
+                        for (uint32_t i{0}; i <= m; ++i)
+                                matching[i] &= ~mask[i];
+                }
+
+                // Like exclude_masked(), except that it also resets the tracking state of excluded documents, so that
+                // tracker[] is left clean for the next window
+                template <typename T>
+                static inline void exclude_masked(uint64_t *__restrict__ const matching, const uint64_t *__restrict__ const mask, const uint32_t m, T *const tracker) noexcept
+                {
+                        for (uint32_t i{0}; i <= m; ++i)
+                        {
+                                for (auto b = matching[i] & mask[i]; b; b &= b - 1)
+                                        tracker[(i << 6) + SwitchBitOps::TrailingZeros(b)] = {};
+
+                                matching[i] &= ~mask[i];
+                        }
+                }
+
               public:
                 // process the span/range [min, max)
                 // i.e from min inclusive to max exclusive
@@ -0,0 +1,356 @@
+#include "docvalues.h"
+#include <switch_bitops.h>
+
+using namespace Trinity;
+
+// Serialized layout:
+// For each column: [document IDs(u32), unless dense][padding to 8 bytes][bit-packed values words + one padding word][dictionary]
+// where the dictionary(String columns) is (dictCnt + 1) u32 offsets followed by the strings
+// The columns directory follows, and then the (directory offset:u32, columns:u32) trailer
+DocValues::Writer::column *DocValues::Writer::column_for(const str8_t name, const FieldType type)
+{
+        auto res = map.insert({name, nullptr});
+
+        if (res.second)
+        {
+                auto c = new column();
+
+                c->name.Set(allocator.CopyOf(name.data(), name.size()), name.size());
+                c->type = type;
+                res.first->first = c->name;
+                res.first->second = c;
+                columns.push_back(c);
+        }
+        else if (res.first->second->type != type)
+                throw Switch::data_error("Unexpected value type for docvalues field ", name);
+
+        return res.first->second;
+}
+
+void DocValues::Writer::set(const isrc_docid_t documentID, const str8_t field, const uint64_t value)
+{
+        column_for(field, FieldType::Numeric)->values.push_back({documentID, value});
+}
+
+void DocValues::Writer::set(const isrc_docid_t documentID, const str8_t field, const str8_t value)
+{
+        auto c = column_for(field, FieldType::String);
+        auto res = c->dict.insert({value, c->strings.size()});
+
+        if (res.second)
+        {
+                res.first->first.Set(allocator.CopyOf(value.data(), value.size()), value.size());
+                c->strings.push_back(res.first->first);
+        }
+
+        c->values.push_back({documentID, res.first->second});
+}
+
+void DocValues::Writer::clear()
+{
+        while (columns.size())
+        {
+                delete columns.back();
+                columns.pop_back();
+        }
+
+        map.clear();
+        allocator.reuse();
+}
+
+void DocValues::Writer::serialize(IOBuffer *const out, const isrc_docid_t *const globalIDs, const std::size_t n, const isrc_docid_t *const localIDs)
+{
+        const auto base = out->size();
+        IOBuffer directory;
+        std::vector<uint64_t> words;
+        uint32_t columnsCnt{0};
+
+        for (auto c : columns)
+        {
+                auto &values = c->values;
+
+                if (globalIDs)
+                {
+                        // translate to local IDs
+                        for (auto &it : values)
+                        {
+                                const auto p = std::lower_bound(globalIDs, globalIDs + n, it.first);
+
+                                if (p != globalIDs + n && *p == it.first)
+                                        it.first = localIDs ? localIDs[p - globalIDs] : p - globalIDs;
+                                else
+                                        it.first = 0;
+                        }
+                }
+
+                // if a value is set for the same document more than once, the last one set wins
+                std::stable_sort(values.begin(), values.end(), [](const auto &a, const auto &b) noexcept {
+                        return a.first < b.first;
+                });
+
+                {
+                        uint32_t k{0};
+
+                        for (uint32_t i{0}; i != values.size(); ++i)
+                        {
+                                if (!values[i].first)
+                                {
+                                        // not indexed(can only happen with local docids)
+                                        continue;
+                                }
+
+                                if (k && values[k - 1].first == values[i].first)
+                                        values[k - 1] = values[i];
+                                else
+                                        values[k++] = values[i];
+                        }
+
+                        values.resize(k);
+                }
+
+                if (values.empty())
+                        continue;
+
+                if (c->type == FieldType::String)
+                {
+                        // ordinals follow the strings order
+                        std::vector<uint32_t> order, ordinals;
+
+                        order.reserve(c->strings.size());
+                        for (uint32_t i{0}; i != c->strings.size(); ++i)
+                                order.push_back(i);
+
+                        std::sort(order.begin(), order.end(), [&strings = c->strings](const auto a, const auto b) noexcept {
+                                const auto &sa = strings[a], &sb = strings[b];
+
+                                if (const auto r = memcmp(sa.data(), sb.data(), std::min(sa.size(), sb.size())))
+                                        return r < 0;
+                                else
+                                        return sa.size() < sb.size();
+                        });
+
+                        ordinals.resize(order.size());
+                        for (uint32_t i{0}; i != order.size(); ++i)
+                                ordinals[order[i]] = i;
+
+                        for (auto &it : values)
+                                it.second = ordinals[it.second];
+
+                        std::vector<str8_t> sorted;
+
+                        sorted.reserve(order.size());
+                        for (const auto i : order)
+                                sorted.push_back(c->strings[i]);
+                        c->strings = std::move(sorted);
+                }
+
+                const uint32_t cnt = values.size();
+                const auto firstID = values.front().first;
+                const bool dense = values.back().first - firstID + 1 == cnt;
+                uint64_t lo{values.front().second}, hi{lo};
+                uint32_t docIDsOffset{0};
+
+                for (const auto &it : values)
+                {
+                        lo = std::min(lo, it.second);
+                        hi = std::max(hi, it.second);
+                }
+
+                const uint8_t bits = hi == lo ? 0 : 64 - SwitchBitOps::LeadingZeros(hi - lo);
+
+                if (!dense)
+                {
+                        docIDsOffset = out->size() - base;
+                        for (const auto &it : values)
+                                out->pack(uint32_t(it.first));
+                }
+
+                while ((out->size() - base) & 7)
+                        out->pack(uint8_t(0));
+
+                const uint32_t valuesOffset = out->size() - base;
+
+                words.clear();
+                words.resize(((uint64_t(cnt) * bits + 63) >> 6) + 1, 0);
+                if (bits)
+                {
+                        for (uint32_t i{0}; i != cnt; ++i)
+                        {
+                                const uint64_t v = values[i].second - lo;
+                                const uint64_t bit = uint64_t(i) * bits;
+                                const uint32_t shift = bit & 63;
+
+                                words[bit >> 6] |= v << shift;
+                                if (shift + bits > 64)
+                                        words[(bit >> 6) + 1] |= v >> (64 - shift);
+                        }
+                }
+                out->serialize(words.data(), words.size() * sizeof(uint64_t));
+
+                uint32_t dictOffset{0}, dictCnt{0};
+
+                if (c->type == FieldType::String)
+                {
+                        uint32_t o{0};
+
+                        dictOffset = out->size() - base;
+                        dictCnt = c->strings.size();
+                        for (const auto &s : c->strings)
+                        {
+                                out->pack(o);
+                                o += s.size();
+                        }
+                        out->pack(o);
+
+                        for (const auto &s : c->strings)
+                                out->serialize(s.data(), s.size());
+                }
+
+                ++columnsCnt;
+                directory.pack(uint8_t(c->name.size()));
+                directory.serialize(c->name.data(), c->name.size());
+                directory.pack(uint8_t(c->type), uint8_t(dense), bits, cnt, uint32_t(firstID), lo, docIDsOffset, valuesOffset, dictCnt, dictOffset);
+        }
+
+        const uint32_t directoryOffset = out->size() - base;
+
+        out->serialize(directory.data(), directory.size());
+        out->pack(directoryOffset, columnsCnt);
+}
+
+DocValues::Reader::Reader(const range_base<const uint8_t *, std::size_t> content)
+{
+        if (content.size() < sizeof(uint32_t) * 2)
+                return;
+
+        const auto b = content.start();
+        const auto e = b + content.size();
+        const auto directoryOffset = *(uint32_t *)(e - sizeof(uint32_t) * 2);
+        const auto columnsCnt = *(uint32_t *)(e - sizeof(uint32_t));
+
+        if (directoryOffset > content.size() - sizeof(uint32_t) * 2)
+                throw Switch::data_error("Unexpected docvalues contents");
+
+        for (const auto *p = b + directoryOffset, *const end = e - sizeof(uint32_t) * 2; p < end;)
+        {
+                Column c;
+                const auto nameLen = *p++;
+
+                c.name.Set(reinterpret_cast<const char *>(p), nameLen);
+                p += nameLen;
+                c.type = FieldType(*p++);
+                c.dense = *p++;
+                c.bits = *p++;
+                c.cnt = *(uint32_t *)p;
+                p += sizeof(uint32_t);
+                c.base = *(uint32_t *)p;
+                p += sizeof(uint32_t);
+                c.minValue = *(uint64_t *)p;
+                p += sizeof(uint64_t);
+
+                const auto docIDsOffset = *(uint32_t *)p;
+                p += sizeof(uint32_t);
+                const auto valuesOffset = *(uint32_t *)p;
+                p += sizeof(uint32_t);
+                c.dictCnt = *(uint32_t *)p;
+                p += sizeof(uint32_t);
+                const auto dictOffset = *(uint32_t *)p;
+                p += sizeof(uint32_t);
+
+                c.docIDs = c.dense ? nullptr : reinterpret_cast<const isrc_docid_t *>(b + docIDsOffset);
+                c.values = reinterpret_cast<const uint64_t *>(b + valuesOffset);
+                if (c.type == FieldType::String)
+                {
+                        c.dictOffsets = reinterpret_cast<const uint32_t *>(b + dictOffset);
+                        c.dictData = reinterpret_cast<const char *>(c.dictOffsets + c.dictCnt + 1);
+                }
+                else
+                {
+                        c.dictOffsets = nullptr;
+                        c.dictData = nullptr;
+                }
+
+                columns.push_back(c);
+        }
+
+        if (columns.size() != columnsCnt)
+                throw Switch::data_error("Unexpected docvalues contents");
+}
+
+uint32_t DocValues::Column::index_of(const isrc_docid_t id) const noexcept
+{
+        if (dense)
+                return id >= base && id - base < cnt ? id - base : UINT32_MAX;
+
+        const auto end = docIDs + cnt;
+        const auto it = std::lower_bound(docIDs, end, id);
+
+        return it != end && *it == id ? it - docIDs : UINT32_MAX;
+}
+
+void DocValues::Column::decode(const uint32_t from, const uint32_t n, uint64_t *out) const noexcept
+{
+        if (!bits)
+        {
+                for (uint32_t i{0}; i != n; ++i)
+                        out[i] = minValue;
+                return;
+        }
+
+        const uint64_t mask = bits == 64 ? std::numeric_limits<uint64_t>::max() : (uint64_t(1) << bits) - 1;
+        uint64_t bit = uint64_t(from) * bits;
+
+        for (uint32_t i{0}; i != n; ++i, bit += bits)
+        {
+                const auto w = values + (bit >> 6);
+                const uint32_t shift = bit & 63;
+                uint64_t v = w[0] >> shift;
+
+                if (shift + bits > 64)
+                        v |= w[1] << (64 - shift);
+
+                out[i] = minValue + (v & mask);
+        }
+}
+
+void DocValues::Column::get_many(const isrc_docid_t *ids, const uint32_t n, uint64_t *out, const uint64_t missing) const noexcept
+{
+        if (dense)
+        {
+                // runs of consecutive documents are decoded in blocks
+                for (uint32_t i{0}; i != n;)
+                {
+                        const auto id = ids[i];
+
+                        if (id < base || id - base >= cnt)
+                        {
+                                out[i++] = missing;
+                                continue;
+                        }
+
+                        uint32_t k{i + 1};
+
+                        while (k != n && ids[k] == ids[k - 1] + 1 && ids[k] - base < cnt)
+                                ++k;
+
+                        decode(id - base, k - i, out + i);
+                        i = k;
+                }
+        }
+        else
+        {
+                const auto end = docIDs + cnt;
+                const isrc_docid_t *it = docIDs;
+
+                for (uint32_t i{0}; i != n; ++i)
+                {
+                        const auto id = ids[i];
+
+                        // ids are ascending, so we only need to search forward
+                        if (it != end && *it < id)
+                                it = std::lower_bound(it, end, id);
+
+                        out[i] = it != end && *it == id ? value_at(it - docIDs) : missing;
+                }
+        }
+}
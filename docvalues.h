@@ -0,0 +1,180 @@
+#pragma once
+#include "common.h"
+#include <buffer.h>
+#include <ext/flat_hash_map.h>
+#include <switch.h>
+#include <switch_mallocators.h>
+#include <vector>
+
+namespace Trinity
+{
+        // Per-document values(e.g price, popularity, timestamps, brands) stored in columns, one for each field.
+        // Those are set while indexing documents(see SegmentIndexSession::document_proxy::set_value()), persisted in
+        // the segment's docvalues file, and accessed via IndexSource::doc_values(), so that scoring and filtering
+        // (e.g in MatchedIndexDocumentsFilter::consider()) can access them directly, instead of looking them up
+        // in application datastructures.
+        //
+        // Values are keyed by the index source's document IDs(i.e isrc_docid_t). See IndexSource::translate_docid()
+        // MatchedIndexDocumentsFilter::consider() is passed translated IDs; use IndexSource::doc_value() to access the values of matched documents.
+        // MergeCandidatesCollection::merge() merges the docvalues of the merged segments.
+        //
+        // Numeric values are bit-packed, using just enough bits for (value - lowest value in column), so that accessing
+        // them is cheap and cache friendly. Strings are dictionary encoded; the dictionary is sorted, so that the ordinals
+        // can be compared and sorted in place of the strings they represent.
+        namespace DocValues
+        {
+                enum class FieldType : uint8_t
+                {
+                        Numeric = 0,
+                        String
+                };
+
+                // Collects values; see SegmentIndexSession
+                class Writer final
+                {
+                      private:
+                        struct column final
+                        {
+                                str8_t name;
+                                FieldType type;
+                                std::vector<std::pair<isrc_docid_t, uint64_t>> values;
+                                // For String columns, values are indices in strings[]
+                                ska::flat_hash_map<str8_t, uint32_t> dict;
+                                std::vector<str8_t> strings;
+                        };
+
+                        simple_allocator allocator{4096};
+                        ska::flat_hash_map<str8_t, column *> map;
+                        std::vector<column *> columns;
+
+                      private:
+                        column *column_for(const str8_t name, const FieldType type);
+
+                      public:
+                        void set(const isrc_docid_t documentID, const str8_t field, const uint64_t value);
+
+                        void set(const isrc_docid_t documentID, const str8_t field, const str8_t value);
+
+                        bool empty() const noexcept
+                        {
+                                return columns.empty();
+                        }
+
+                        void clear();
+
+                        // The (document ID, value) pairs collected for a Numeric column, in the order they were set, or nullptr
+                        // See SegmentIndexSession::set_index_sort()
+                        const std::vector<std::pair<isrc_docid_t, uint64_t>> *numeric_values(const str8_t field) const noexcept
+                        {
+                                const auto it = map.find(field);
+
+                                return it != map.end() && it->second->type == FieldType::Numeric ? &it->second->values : nullptr;
+                        }
+
+                        // If globalIDs is not nullptr, documents IDs are translated to their index in globalIDs[0, n), which
+                        // is expected to be sorted; see SegmentIndexSession::set_local_docids()
+                        // If localIDs is also provided, they are instead translated to localIDs[index]
+                        // This reorders the collected state; clear() the writer afterwards.
+                        void serialize(IOBuffer *out, const isrc_docid_t *globalIDs = nullptr, const std::size_t n = 0, const isrc_docid_t *localIDs = nullptr);
+
+                        ~Writer()
+                        {
+                                clear();
+                        }
+                };
+
+                // A column of a serialized docvalues file
+                struct Column final
+                {
+                        str8_t name;
+                        FieldType type;
+                        // If set, cnt documents starting from base have values, and docIDs is not used
+                        bool dense;
+                        uint8_t bits;
+                        uint32_t cnt;
+                        isrc_docid_t base;
+                        uint64_t minValue;
+                        // sorted
+                        const isrc_docid_t *docIDs;
+                        const uint64_t *values;
+                        // String columns dictionary
+                        uint32_t dictCnt;
+                        const uint32_t *dictOffsets;
+                        const char *dictData;
+
+                        // Returns the index of the document's value, or UINT32_MAX if there is no value for it
+                        uint32_t index_of(const isrc_docid_t id) const noexcept;
+
+                        inline uint64_t value_at(const uint32_t idx) const noexcept
+                        {
+                                if (!bits)
+                                        return minValue;
+
+                                const uint64_t bit = uint64_t(idx) * bits;
+                                const auto w = values + (bit >> 6);
+                                const uint32_t shift = bit & 63;
+                                uint64_t v = w[0] >> shift;
+
+                                // values are padded with an extra word, so this is safe
+                                if (shift + bits > 64)
+                                        v |= w[1] << (64 - shift);
+
+                                if (bits != 64)
+                                        v &= (uint64_t(1) << bits) - 1;
+
+                                return minValue + v;
+                        }
+
+                        bool get(const isrc_docid_t id, uint64_t *const out) const noexcept
+                        {
+                                if (const auto idx = index_of(id); idx != UINT32_MAX)
+                                {
+                                        *out = value_at(idx);
+                                        return true;
+                                }
+                                else
+                                        return false;
+                        }
+
+                        // Decodes the values [from, from + n) into out[]
+                        void decode(const uint32_t from, const uint32_t n, uint64_t *out) const noexcept;
+
+                        // Batch access; ids[] are expected in ascending order, which is the case for documents matched in
+                        // order, e.g if you buffer them in consider().
+                        // Documents with no values are assigned `missing`
+                        void get_many(const isrc_docid_t *ids, const uint32_t n, uint64_t *out, const uint64_t missing = 0) const noexcept;
+
+                        // The string of a String column ordinal
+                        str8_t string(const uint64_t ordinal) const noexcept
+                        {
+                                return ordinal < dictCnt ? str8_t(dictData + dictOffsets[ordinal], dictOffsets[ordinal + 1] - dictOffsets[ordinal]) : str8_t();
+                        }
+                };
+
+                // Provides access to the columns of a serialized docvalues file
+                class Reader final
+                {
+                      private:
+                        std::vector<Column> columns;
+
+                      public:
+                        Reader(const range_base<const uint8_t *, std::size_t> content);
+
+                        const Column *column(const str8_t name) const noexcept
+                        {
+                                for (const auto &it : columns)
+                                {
+                                        if (it.name == name)
+                                                return &it;
+                                }
+
+                                return nullptr;
+                        }
+
+                        const auto &all() const noexcept
+                        {
+                                return columns;
+                        }
+                };
+        }
+}
@@ -1,4 +1,5 @@
 #include "exec.h"
+#include "costs.h"
 #include "docset_spans.h"
 #include "docwordspace.h"
 #include "matches.h"
@@ -13,31 +14,84 @@ namespace // static/local this module
 {
         [[maybe_unused]] static constexpr bool traceExec{false};
         static constexpr bool traceCompile{false};
+
+        // Documents masked by a masked_documents_registry and/or filtered by an IndexDocumentsFilter, for a whole
+        // DocsSetSpan window; see MatchesProxy::window_mask().
+        // exec_query() handlers use it so that they won't need to check matched documents of windows spans have already
+        // excluded those from.
+        struct window_exclusions final
+        {
+                masked_documents_registry *const maskedDocumentsRegistry;
+                IndexDocumentsFilter *const documentsFilter;
+                // masks are in the global documents space, so they can't be used if we need to translate document IDs
+                bool enabled;
+                // the window spans applied the current mask to; not a window base unless set in mask()
+                isrc_docid_t windowBase{DocIDsEND};
+                uint64_t bm[MatchesProxy::WINDOW_SIZE / 64];
+
+                window_exclusions(IndexSource *const src, masked_documents_registry *const mr, IndexDocumentsFilter *const df)
+                    : maskedDocumentsRegistry{mr}, documentsFilter{df}, enabled{!src->require_docid_translation() && (!mr || mr->supports_window_masks())}
+                {
+                }
+
+                const uint64_t *mask(const isrc_docid_t base)
+                {
+                        if (!enabled)
+                                return nullptr;
+
+                        if (maskedDocumentsRegistry)
+                                maskedDocumentsRegistry->mask_window(base, MatchesProxy::WINDOW_SIZE, bm);
+                        else
+                                memset(bm, 0, sizeof(bm));
+
+                        if (documentsFilter && !documentsFilter->filter_window(base, MatchesProxy::WINDOW_SIZE, bm))
+                        {
+                                // not supported by the filter; don't bother again
+                                enabled = false;
+                                return nullptr;
+                        }
+
+                        windowBase = base;
+                        return bm;
+                }
+
+                inline void reset() noexcept
+                {
+                        windowBase = DocIDsEND;
+                }
+
+                // true if the document belongs to the window the current mask was applied to, i.e
+                // it has been checked already
+                inline bool checked(const isrc_docid_t id) const noexcept
+                {
+                        return (id & ~isrc_docid_t(MatchesProxy::WINDOW_SIZE - 1)) == windowBase;
+                }
+        };
 }
 
 #pragma mark execution specific optimizations
 static uint64_t reorder_execnode(exec_node &n, bool &updates, queryexec_ctx &);
 
-//WAS: return rctx.term_ctx(p->termIDs[0]).documents;
-//Now it's proprortional to the number of terms of the phrase
-//because we 'd like to avoid avoid materializing hits for un-necessary documents if possible, and we
-//need to materialize for processing phrases
+// We used to only consider the lead(boosted so that phrases would always be more expensive than tokens), but
+// a phrase "a b c" is more expensive than "a b", and "a b" should be more expensive than "a c" if b is more popular than c.
+// See Costs::phrase(); it accounts for all terms, the phrase size and the hits we need to materialize.
+//
+// Decoders are expected to have been prepared already(see prepare_tree())
 static uint64_t phrase_cost(queryexec_ctx &rctx, const compilation_ctx::phrase *const p)
 {
-        // boost it because its's a phrase so we will need to deserialize hits
-        //
-        // XXX: we only consider the lead here but that's perhaps not a great idea
-        // We should take the phrase size into account, so that a phrase "a b c" should be more expensive than "a b"
-        // where they have the same lead, but size is shorter. Conversely "a b" should be more expensive than "a c" if
-        // b is more popular than rc
-        return rctx.term_ctx(p->termIDs[0]).documents + UINT32_MAX + UINT16_MAX * p->size;
+        const Codecs::Decoder *decoders[p->size];
+
+        for (uint32_t i{0}; i != p->size; ++i)
+                decoders[i] = rctx.decode_ctx.decoders[p->termIDs[i]];
+
+        return Costs::phrase(decoders, p->size, rctx.docsCnt);
 }
 
 
 static uint64_t reorder_execnode_impl(exec_node &n, bool &updates, queryexec_ctx &rctx)
 {
         if (n.fp == ENT::matchterm)
-                return rctx.term_ctx(n.u16).documents;
+                return Costs::scan(rctx.decode_ctx.decoders[n.u16]);
         else if (n.fp == ENT::matchphrase)
         {
                 const auto p = static_cast<const compilation_ctx::phrase *>(n.ptr);
@@ -108,24 +162,40 @@ static uint64_t reorder_execnode_impl(exec_node &n, bool &updates, queryexec_ctx
         }
         else if (n.fp == ENT::matchallterms)
         {
+                // terms are sorted by documents(see prepare_tree()), so the first leads
                 const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+                const Codecs::Decoder *decoders[run->size];
 
-                return rctx.term_ctx(run->terms[0]).documents;
+                for (uint32_t i{0}; i != run->size; ++i)
+                        decoders[i] = rctx.decode_ctx.decoders[run->terms[i]];
+
+                return Costs::conjunction(decoders, run->size, rctx.docsCnt);
         }
-        else if (n.fp == ENT::matchanyterms)
+        else if (n.fp == ENT::matchanyterms || n.fp == ENT::matchrange)
         {
                 const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
                 uint64_t sum{0};
 
                 for (uint32_t i{0}; i != run->size; ++i)
-                        sum += rctx.term_ctx(run->terms[i]).documents;
+                        sum += Costs::scan(rctx.decode_ctx.decoders[run->terms[i]]);
                 return sum;
         }
         else if (n.fp == ENT::matchallphrases)
         {
+                // The least expensive phrase leads(see build_iterator()), and the others are only
+                // considered for the documents it matches
                 const auto *const __restrict__ run = (const compilation_ctx::phrasesrun *)n.ptr;
+                uint64_t costs[run->size], lead{UINT64_MAX}, sum{0};
+
+                for (uint32_t i{0}; i != run->size; ++i)
+                {
+                        costs[i] = phrase_cost(rctx, run->phrases[i]);
+                        lead = std::min(lead, costs[i]);
+                }
 
-                return phrase_cost(rctx, run->phrases[0]) * run->size; // This may or may not make sense
+                for (uint32_t i{0}; i != run->size; ++i)
+                        sum += std::min(costs[i], lead);
+                return sum;
         }
         else if (n.fp == ENT::matchanyphrases)
         {
@@ -242,9 +312,23 @@ static exec_node prepare_tree(exec_node root, queryexec_ctx &rctx)
         if (traceMetrics)
                 SLog(duration_repr(Timings::Microseconds::Since(before)), " to sort runs, ", dotnotation_repr(totalNodes), " exec_nodes\n");
 
+        // NOW, prepare decoders
+        // We need to do this before we reorder the exec nodes, because the cost model considers codec specific
+        // properties of the postings lists(see costs.h)
+        // This could take some time - for 52 distinct terms it takes 0.002s (>1ms)
+        before = Timings::Microseconds::Tick();
+        for (const auto &kv : rctx.tctxMap)
+        {
+                const auto termID = kv.first;
+
+                rctx.prepare_decoder(termID);
+        }
+
+        if (traceMetrics)
+                SLog(duration_repr(Timings::Microseconds::Since(before)), " ", Timings::Microseconds::ToMillis(Timings::Microseconds::Since(before)), " ms  to initialize all decoders ", rctx.tctxMap.size(), "\n");
+
         // Fourth Pass
         // Reorder ENT::logicaland nodes (lhs, rhs) so that the least expensive to evaluate is always found in the lhs branch
-        // This also helps with moving tokens before phrases
         before = Timings::Microseconds::Tick();
 
         root = reorder_execnodes(root, rctx);
@@ -257,20 +341,6 @@ static exec_node prepare_tree(exec_node root, queryexec_ctx &rctx)
         // perform JIT and compile it down to x86-64 code.
         // Please see: https://github.com/phaistos-networks/Trinity/wiki/JIT-compilation
 
-        // NOW, prepare decoders
-        // No need to have done so if we could have determined that the query would have failed anyway
-        // This could take some time - for 52 distinct terms it takes 0.002s (>1ms)
-        before = Timings::Microseconds::Tick();
-        for (const auto &kv : rctx.tctxMap)
-        {
-                const auto termID = kv.first;
-
-                rctx.prepare_decoder(termID);
-        }
-
-        if (traceMetrics)
-                SLog(duration_repr(Timings::Microseconds::Since(before)), " ", Timings::Microseconds::ToMillis(Timings::Microseconds::Since(before)), " ms  to initialize all decoders ", rctx.tctxMap.size(), "\n");
-
         return root;
 }
 
@@ -285,7 +355,37 @@ static bool all_pli(const std::vector<DocsSetIterators::Iterator *> &its) noexce
         return true;
 }
 
-DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, const uint32_t execFlags)
+// Conjunctions are led by their first iterator, and the other iterators are only advanced to the documents the lead(and the iterators
+// that precede them) match, so we want the least expensive iterators first. See DocsSetIterators::cost()
+static void sort_by_cost(DocsSetIterators::Iterator **const its, const uint32_t size)
+{
+        std::pair<DocsSetIterators::Iterator *, uint64_t> v[size];
+
+        for (uint32_t i{0}; i != size; ++i)
+                v[i] = {its[i], DocsSetIterators::cost(its[i])};
+
+        std::stable_sort(v, v + size, [](const auto &a, const auto &b) noexcept { return a.second < b.second; });
+
+        for (uint32_t i{0}; i != size; ++i)
+                its[i] = v[i].first;
+}
+
+// true if it's cheaper to materialize the union of the run's terms postings lists than to merge them, given that
+// the union will be advanced to `targets` documents; see queryexec_ctx::build_iterator()
+//
+// e.g for [16 common terms] AND [rare term], the union is only advanced to the few documents of the rare term, and
+// materializing it would decode all of the common terms postings.
+static bool materialize_union(queryexec_ctx *const rctx, const compilation_ctx::termsrun *const run, const uint64_t targets)
+{
+        const Codecs::Decoder *decoders[run->size];
+
+        for (uint32_t i{0}; i != run->size; ++i)
+                decoders[i] = rctx->decode_ctx.decoders[run->terms[i]];
+
+        return Costs::union_materialization(decoders, run->size) < Costs::disjunction(decoders, run->size, targets);
+}
+
+DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, const uint32_t execFlags, const uint64_t targets)
 {
         if (n.fp == ENT::matchallterms)
         {
@@ -299,9 +399,9 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                         decoders[i] = pli;
                 }
 
-                return reg_docset_it(new DocsSetIterators::Conjuction(decoders, run->size));
+                return reg_docset_it(new_docset_it<DocsSetIterators::Conjuction>(decoders, run->size));
         }
-        else if (n.fp == ENT::matchanyterms)
+        else if (n.fp == ENT::matchanyterms && !((execFlags & unsigned(ExecFlags::DocumentsOnly)) && materialize_union(this, static_cast<const compilation_ctx::termsrun *>(n.ptr), targets)))
         {
                 const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
                 DocsSetIterators::Iterator *decoders[run->size];
@@ -313,8 +413,44 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                         decoders[i] = pli;
                 }
 
-                return reg_docset_it(new DocsSetIterators::DisjunctionAllPLI(decoders, run->size));
-                //SLog("foo\n"); return reg_docset_it(new DocsSetIterators::DisjunctionSome(decoders, run->size, 16));
+                return reg_docset_it(new_docset_it<DocsSetIterators::DisjunctionAllPLI>(decoders, run->size));
+                //SLog("foo\n"); return reg_docset_it(new_docset_it<DocsSetIterators::DisjunctionSome>(decoders, run->size, 16));
+        }
+        else if (n.fp == ENT::matchrange || n.fp == ENT::matchanyterms)
+        {
+                // Materialize the union of the range terms postings lists, instead of merging that many iterators
+                // for every matched document; see ast_node::Type::NumericRange
+                //
+                // We do the same for ENT::matchanyterms runs when that's cheaper(see materialize_union()), but only in documents only mode, because
+                // a DocIDsSet won't capture the matched terms.
+                const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+                std::vector<isrc_docid_t> ids;
+                std::size_t sum{0};
+
+                if (const auto it = materializedRuns.find(run); it != materializedRuns.end())
+                        return reg_docset_it(new_docset_it<DocsSetIterators::DocIDsSet>(it->second));
+
+                for (uint32_t i{0}; i != run->size; ++i)
+                        sum += term_ctx(run->terms[i]).documents;
+
+                ids.reserve(sum);
+                for (uint32_t i{0}; i != run->size; ++i)
+                {
+                        auto pli = reg_pli(decode_ctx.decoders[run->terms[i]]->new_iterator());
+
+                        for (auto id = pli->next(); id != DocIDsEND; id = pli->next())
+                        {
+                                // this can take a while for very large unions
+                                if (deadline && !(ids.size() & ((1u << 16) - 1)) && Timings::Microseconds::Tick() >= deadline)
+                                        throw deadline_reached{};
+
+                                ids.push_back(id);
+                        }
+                }
+
+                docIDsSets.emplace_back(new docids_set(docids_set::make(ids, &docIDsSetsStorage)));
+                materializedRuns.insert({run, docIDsSets.back().get()});
+                return reg_docset_it(new_docset_it<DocsSetIterators::DocIDsSet>(docIDsSets.back().get()));
         }
 	else if (n.fp == ENT::matchsome)
 	{
@@ -322,9 +458,9 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
 		DocsSetIterators::Iterator *its[g->size];
 
 		for (uint32_t i{0}; i != g->size; ++i)
-			its[i] = build_iterator(g->nodes[i], execFlags);
+			its[i] = build_iterator(g->nodes[i], execFlags, targets);
 
-		return reg_docset_it(new DocsSetIterators::DisjunctionSome(its, g->size, g->min));
+		return reg_docset_it(new_docset_it<DocsSetIterators::DisjunctionSome>(its, g->size, g->min));
 	}
         else if (n.fp == ENT::matchphrase)
         {
@@ -341,7 +477,7 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                         its[i] = reg_pli(decode_ctx.decoders[p->termIDs[i]]->new_iterator());
                 }
 
-                return reg_docset_it(new DocsSetIterators::Phrase(this, its, p->size, execFlags & unsigned(ExecFlags::AccumulatedScoreScheme),  execFlags & unsigned(ExecFlags::DocumentsOnly)));
+                return reg_docset_it(new_docset_it<DocsSetIterators::Phrase>(this, its, p->size, execFlags & unsigned(ExecFlags::AccumulatedScoreScheme),  execFlags & unsigned(ExecFlags::DocumentsOnly)));
         }
         else if (n.fp == ENT::matchanyphrases)
         {
@@ -356,10 +492,10 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                         for (uint32_t i{0}; i != p->size; ++i)
                                 tits[i] = reg_pli(decode_ctx.decoders[p->termIDs[i]]->new_iterator());
 
-                        its[pit] = reg_docset_it(new DocsSetIterators::Phrase(this, tits, p->size, execFlags & unsigned(ExecFlags::AccumulatedScoreScheme), execFlags & unsigned(ExecFlags::DocumentsOnly)));
+                        its[pit] = reg_docset_it(new_docset_it<DocsSetIterators::Phrase>(this, tits, p->size, execFlags & unsigned(ExecFlags::AccumulatedScoreScheme), execFlags & unsigned(ExecFlags::DocumentsOnly)));
                 }
 
-                return reg_docset_it(new DocsSetIterators::Disjunction(its, run->size));
+                return reg_docset_it(new_docset_it<DocsSetIterators::Disjunction>(its, run->size));
         }
         else if (n.fp == ENT::matchallphrases)
         {
@@ -374,17 +510,18 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                         for (uint32_t i{0}; i != p->size; ++i)
                                 tits[i] = reg_pli(decode_ctx.decoders[p->termIDs[i]]->new_iterator());
 
-                        its[pit] = reg_docset_it(new DocsSetIterators::Phrase(this, tits, p->size, execFlags & unsigned(ExecFlags::AccumulatedScoreScheme), execFlags & unsigned(ExecFlags::DocumentsOnly)));
+                        its[pit] = reg_docset_it(new_docset_it<DocsSetIterators::Phrase>(this, tits, p->size, execFlags & unsigned(ExecFlags::AccumulatedScoreScheme), execFlags & unsigned(ExecFlags::DocumentsOnly)));
                 }
 
-                return reg_docset_it(new DocsSetIterators::Conjuction(its, run->size));
+                sort_by_cost(its, run->size);
+                return reg_docset_it(new_docset_it<DocsSetIterators::Conjuction>(its, run->size));
         }
         else if (n.fp == ENT::logicalor)
         {
                 // <foo> | bar => (foo | bar)
                 const auto e = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
                 std::vector<DocsSetIterators::Iterator *> its;
-                DocsSetIterators::Iterator *v[2] = {build_iterator(e->lhs, execFlags), build_iterator(e->rhs, execFlags)};
+                DocsSetIterators::Iterator *v[2] = {build_iterator(e->lhs, execFlags, targets), build_iterator(e->rhs, execFlags, targets)};
 
                 // Pulling Iterators from (lhs, rhs) to this disjunction when possible is extremely important
                 // Over 50% perf.improvement
@@ -420,8 +557,8 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                         SLog("Final ", its.size(), " ", execFlags & unsigned(ExecFlags::DocumentsOnly), ": ", all_pli(its), "\n");
 
                 return reg_docset_it(all_pli(its)
-                                         ? static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::DisjunctionAllPLI(its.data(), its.size()))
-                                         : static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::Disjunction(its.data(), its.size())));
+                                         ? static_cast<DocsSetIterators::Iterator *>(new_docset_it<DocsSetIterators::DisjunctionAllPLI>(its.data(), its.size()))
+                                         : static_cast<DocsSetIterators::Iterator *>(new_docset_it<DocsSetIterators::Disjunction>(its.data(), its.size())));
         }
         else if (n.fp == ENT::logicaland)
         {
@@ -430,19 +567,24 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                 if (e->lhs.fp == ENT::consttrueexpr)
                 {
                         const auto op = static_cast<const compilation_ctx::unaryop_ctx *>(e->lhs.ptr);
+                        const auto main = build_iterator(e->rhs, execFlags, targets);
 
-                        return reg_docset_it(new DocsSetIterators::Optional(build_iterator(e->rhs, execFlags), build_iterator(op->expr, execFlags)));
+                        return reg_docset_it(new_docset_it<DocsSetIterators::Optional>(main, build_iterator(op->expr, execFlags, std::min(targets, main->cost()))));
                 }
                 else if (e->rhs.fp == ENT::consttrueexpr)
                 {
                         const auto op = static_cast<const compilation_ctx::unaryop_ctx *>(e->rhs.ptr);
+                        const auto main = build_iterator(e->lhs, execFlags, targets);
 
-                        return reg_docset_it(new DocsSetIterators::Optional(build_iterator(e->lhs, execFlags), build_iterator(op->expr, execFlags)));
+                        return reg_docset_it(new_docset_it<DocsSetIterators::Optional>(main, build_iterator(op->expr, execFlags, std::min(targets, main->cost()))));
                 }
                 else
                 {
                         std::vector<DocsSetIterators::Iterator *> its;
-                        Trinity::DocsSetIterators::Iterator *v[2] = {build_iterator(e->lhs, execFlags), build_iterator(e->rhs, execFlags)};
+                        // lhs is the least expensive(see reorder_execnode_impl()), so it leads, and rhs is only advanced to the documents it matches
+                        // Costs are approximately postings decoded, so the lead's cost is an upper bound of the documents it matches
+                        const auto lead = build_iterator(e->lhs, execFlags, targets);
+                        Trinity::DocsSetIterators::Iterator *v[2] = {lead, build_iterator(e->rhs, execFlags, std::min(targets, lead->cost()))};
 
                         for (uint32_t i{0}; i != 2; ++i)
                         {
@@ -459,12 +601,14 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                                         its.push_back(it);
                         }
 
+                        sort_by_cost(its.data(), its.size());
+
                         if (traceCompile)
                                 SLog("final ", its.size(), "\n");
 
                         return reg_docset_it(all_pli(its)
-                                                 ? static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::ConjuctionAllPLI(its.data(), its.size()))
-                                                 : static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::Conjuction(its.data(), its.size())));
+                                                 ? static_cast<DocsSetIterators::Iterator *>(new_docset_it<DocsSetIterators::ConjuctionAllPLI>(its.data(), its.size()))
+                                                 : static_cast<DocsSetIterators::Iterator *>(new_docset_it<DocsSetIterators::Conjuction>(its.data(), its.size())));
                 }
         }
         else if (n.fp == ENT::matchallnodes)
@@ -472,13 +616,30 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                 std::vector<DocsSetIterators::Iterator *> its;
                 const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
 
+                uint32_t leadIdx{0};
+
+                // The least expensive node leads(see reorder_execnode_impl()), and the others are only advanced to the documents it matches
+                for (uint32_t i{1}; i < g->size; ++i)
+                {
+                        if (g->nodes[i].cost < g->nodes[leadIdx].cost)
+                                leadIdx = i;
+                }
+
                 its.reserve(g->size);
+                its.push_back(build_iterator(g->nodes[leadIdx], execFlags, targets));
+
+                const auto leadCandidates = std::min(targets, its.front()->cost());
+
                 for (uint32_t i{0}; i != g->size; ++i)
-                        its.push_back(build_iterator(g->nodes[i], execFlags));
+                {
+                        if (i != leadIdx)
+                                its.push_back(build_iterator(g->nodes[i], execFlags, leadCandidates));
+                }
 
+                sort_by_cost(its.data(), its.size());
                 return reg_docset_it(all_pli(its)
-                                         ? static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::ConjuctionAllPLI(its.data(), its.size()))
-                                         : static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::Conjuction(its.data(), its.size())));
+                                         ? static_cast<DocsSetIterators::Iterator *>(new_docset_it<DocsSetIterators::ConjuctionAllPLI>(its.data(), its.size()))
+                                         : static_cast<DocsSetIterators::Iterator *>(new_docset_it<DocsSetIterators::Conjuction>(its.data(), its.size())));
         }
         else if (n.fp == ENT::matchanynodes)
         {
@@ -487,17 +648,19 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
 
                 its.reserve(g->size);
                 for (uint32_t i{0}; i != g->size; ++i)
-                        its.push_back(build_iterator(g->nodes[i], execFlags));
+                        its.push_back(build_iterator(g->nodes[i], execFlags, targets));
 
                 return reg_docset_it(all_pli(its)
-                                         ? static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::DisjunctionAllPLI(its.data(), its.size()))
-                                         : static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::Disjunction(its.data(), its.size())));
+                                         ? static_cast<DocsSetIterators::Iterator *>(new_docset_it<DocsSetIterators::DisjunctionAllPLI>(its.data(), its.size()))
+                                         : static_cast<DocsSetIterators::Iterator *>(new_docset_it<DocsSetIterators::Disjunction>(its.data(), its.size())));
         }
         else if (n.fp == ENT::logicalnot)
         {
                 const auto e = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                const auto req = build_iterator(e->lhs, execFlags, targets);
 
-                return reg_docset_it(new DocsSetIterators::Filter(build_iterator(e->lhs, execFlags), build_iterator(e->rhs, execFlags)));
+                // the excluded documents are only checked for the documents req matches
+                return reg_docset_it(new_docset_it<DocsSetIterators::Filter>(req, build_iterator(e->rhs, execFlags, std::min(targets, req->cost()))));
         }
         else if (n.fp == ENT::matchterm)
         {
@@ -507,14 +670,14 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
         {
                 auto *const ctx = static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr);
 
-                return build_iterator(ctx->expr, execFlags);
+                return build_iterator(ctx->expr, execFlags, targets);
         }
         else if (n.fp == ENT::consttrueexpr)
         {
                 // not part of a binary op.
                 const auto op = static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr);
 
-                return build_iterator(op->expr, execFlags);
+                return build_iterator(op->expr, execFlags, targets);
         }
         else
         {
@@ -595,143 +758,314 @@ static std::unique_ptr<DocsSetSpan> build_span(DocsSetIterators::Iterator *root,
         }
 }
 
+// Processes the documents of the span one window(MatchesProxy::WINDOW_SIZE document IDs) at a time, and checks the deadline after each
+// Returns true if the deadline was reached before all documents were processed. See exec_query()
+static bool process_span(DocsSetSpan *const span, MatchesProxy *const mp, const uint64_t deadline)
+{
+        // aligned to the spans windows
+        static constexpr isrc_docid_t CheckpointRange{MatchesProxy::WINDOW_SIZE};
+
+        if (!deadline)
+        {
+                span->process(mp, 1, DocIDsEND);
+                return false;
+        }
+
+        for (isrc_docid_t min{1};;)
+        {
+                const auto rangeBase = min & ~(CheckpointRange - 1);
+                const isrc_docid_t max = DocIDsEND - rangeBase <= CheckpointRange ? DocIDsEND : rangeBase + CheckpointRange;
+
+                min = std::max(span->process(mp, min, max), max);
+                if (min == DocIDsEND)
+                        return false;
+                else if (Timings::Microseconds::Tick() >= deadline)
+                        return true;
+        }
+}
+
 #pragma mark Trinity Queries Execution Engine
 
-void Trinity::exec_query(const query &in,
-                         IndexSource *const __restrict__ idxsrc,
-                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
-                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
-                         IndexDocumentsFilter *__restrict__ const documentsFilter,
-                         const uint32_t execFlags,
-                         Similarity::IndexSourceTermsScorer *scorer)
+namespace
 {
-        struct query_term_instance final
-            : public query_term_ctx::instance_struct
+        using query_term_instance = query_plan::term_instance;
+
+        // Forwards matches to the caller's filter, and aborts the search once MatchedIndexDocumentsFilter::limit documents
+        // have been considered. See MatchedIndexDocumentsFilter::limit
+        struct limited_matches_filter final
+            : public MatchedIndexDocumentsFilter
         {
-                str8_t token;
+                MatchedIndexDocumentsFilter *const f;
+                std::size_t remaining;
+
+                limited_matches_filter(MatchedIndexDocumentsFilter *const filter)
+                    : f{filter}, remaining{filter->limit}
+                {
+                }
+
+                void consider(const matched_document &match) override final
+                {
+                        f->consider(match);
+                        if (--remaining == 0)
+                                throw aborted_search_exception();
+                }
+
+                void consider(const docid_t id) override final
+                {
+                        f->consider(id);
+                        if (--remaining == 0)
+                                throw aborted_search_exception();
+                }
+
+                void consider(const docid_t id, const double score) override final
+                {
+                        f->consider(id, score);
+                        if (--remaining == 0)
+                                throw aborted_search_exception();
+                }
+
+                void prepare(const query_index_terms **queryIndicesTerms_) override final
+                {
+                        MatchedIndexDocumentsFilter::prepare(queryIndicesTerms_);
+                        f->prepare(queryIndicesTerms_);
+                }
         };
+}
 
-        if (!in)
+// We need to collect all term instances in the query
+// so that we the score function will be able to take that into account (See matched_document::queryTermInstances)
+// We only need to do this for specific AST branches and node types(i.e we ignore all RHS expressions of logical NOT nodes)
+//
+// This must be performed before any query optimizations, for otherwise because the optimiser will most definitely rearrange the query, doing it after
+// the optimization passes will not capture the original, input query tokens instances information.
+//
+// This is required if the default execution mode is selected
+static void collect_query_term_instances(const query &q, std::vector<query_term_instance> *const out)
+{
+        std::vector<ast_node *> stack{q.root}; // use a stack because we don't care about the evaluation order
+        std::vector<phrase *> collected;
+
+        // collect phrases from the AST
+        do
         {
-                if (traceCompile)
-                        SLog("No root node\n");
+                auto n = stack.back();
 
-                return;
+                stack.pop_back();
+                switch (n->type)
+                {
+                        case ast_node::Type::Token:
+                        case ast_node::Type::Phrase:
+                                collected.push_back(n->p);
+                                break;
+
+                        case ast_node::Type::MatchSome:
+                                stack.insert(stack.end(), n->match_some.nodes, n->match_some.nodes + n->match_some.size);
+                                break;
+
+                        case ast_node::Type::UnaryOp:
+                                if (n->unaryop.op != Operator::NOT)
+                                        stack.push_back(n->unaryop.expr);
+                                break;
+
+                        case ast_node::Type::ConstTrueExpr:
+                                stack.push_back(n->expr);
+                                break;
+
+                        case ast_node::Type::BinOp:
+                                if (n->binop.op == Operator::AND || n->binop.op == Operator::STRICT_AND || n->binop.op == Operator::OR)
+                                {
+                                        stack.push_back(n->binop.lhs);
+                                        stack.push_back(n->binop.rhs);
+                                }
+                                else if (n->binop.op == Operator::NOT)
+                                        stack.push_back(n->binop.lhs);
+                                break;
+
+                        default:
+                                break;
+                }
+        } while (stack.size());
+
+        for (const auto it : collected) // collected phrases
+        {
+                const uint8_t rep = it->size == 1 ? it->rep : 1;
+                const auto toNextSpan{it->toNextSpan};
+                const auto flags{it->flags};
+                const auto rewriteRange{it->rewrite_ctx.range};
+                const auto translationCoefficient{it->rewrite_ctx.translationCoefficient};
+                const auto srcSeqSize{it->rewrite_ctx.srcSeqSize};
+
+                // for each phrase token
+                for (uint16_t pos{it->index}, i{0}; i != it->size; ++i, ++pos)
+                {
+                        if (traceCompile)
+                                SLog("Collected instance: [", it->terms[i].token, "] index:", pos, " rep:", rep, " toNextSpan:", i == (it->size - 1) ? toNextSpan : 1, "\n");
+
+                        out->push_back({{pos, flags, rep, uint8_t(i == (it->size - 1) ? toNextSpan : 1), {rewriteRange, translationCoefficient, srcSeqSize}}, it->terms[i].token}); // need to be careful to get this right for phrases
+                }
         }
+}
 
-        // We need a copy of that query here
-        // for we we will need to modify it
-        const auto _start = Timings::Microseconds::Tick();
-        query q(in, true); // shallow copy, no need for a deep copy here
+uint16_t query_plan::plan_compilation_ctx::resolve_query_term(const str8_t term)
+{
+        const auto res = map.insert({term, 0});
 
-        // Normalize just in case
-        if (!q.normalize())
+        if (res.second)
         {
-                if (traceCompile)
-                        SLog("No root node after normalization\n");
+                terms.push_back(term);
+                res.first->second = terms.size();
+        }
 
+        return res.first->second;
+}
+
+query_plan::query_plan(const query &in)
+    : q(in)
+{
+        if (!q || !q.normalize())
                 return;
+
+        collect_query_term_instances(q, &originalQueryTokenInstances);
+
+        for (const auto n : q.nodes())
+        {
+                if (n->type == ast_node::Type::Phrase && n->p->size == 2)
+                        bigramCandidates.push_back({n->p->terms[0].token, n->p->terms[1].token});
         }
 
-        const bool documentsOnly = execFlags & uint32_t(ExecFlags::DocumentsOnly);
-        const bool accumScoreMode = execFlags & uint32_t(ExecFlags::AccumulatedScoreScheme);
-        const bool defaultMode = !documentsOnly && !accumScoreMode;
+        // compile_query() reorders the AST, and we need to retain the normalized query in case we need to re-compile it for an index source
+        query c(q, true);
 
-        // We need to collect all term instances in the query
-        // so that we the score function will be able to take that into account (See matched_document::queryTermInstances)
-        // We only need to do this for specific AST branches and node types(i.e we ignore all RHS expressions of logical NOT nodes)
-        //
-        // This must be performed before any query optimizations, for otherwise because the optimiser will most definitely rearrange the query, doing it after
-        // the optimization passes will not capture the original, input query tokens instances information.
-        //
-        // This is required if the default execution mode is selected
-        std::vector<query_term_instance> originalQueryTokenInstances;
+        root = compile_query(c.root, cctx);
+}
 
-        if (accumScoreMode)
+std::shared_ptr<const query_plan> query_plans_cache::plan_for(const query &in)
+{
+        query q(in, true);
+
+        if (!q || !q.normalize())
+                return std::make_shared<const query_plan>(in);
+
+        // The query representation doesn't include the term instances properties, which matter for scoring
+        std::vector<query_term_instance> instances;
+        Buffer b;
+
+        collect_query_term_instances(q, &instances);
+        b.append(q, '|');
+        for (const auto &it : instances)
         {
-                // Just in case
-                expect(scorer);
+                b.append(it.token, ':', it.index, ':', uint32_t(it.flags), ':', uint32_t(it.rep), ':', uint32_t(it.toNextSpan), ':',
+                         uint32_t(it.rewrite_ctx.range.offset), ':', uint32_t(it.rewrite_ctx.range.size()), ':', it.rewrite_ctx.translationCoefficient, ':', uint32_t(it.rewrite_ctx.srcSeqSize), ';');
         }
 
-        if (defaultMode)
+        std::string key(b.data(), b.size());
+
         {
-                std::vector<ast_node *> stack{q.root}; // use a stack because we don't care about the evaluation order
-                std::vector<phrase *> collected;
+                std::lock_guard<std::mutex> g(lock);
 
-                // collect phrases from the AST
-                do
+                if (const auto it = map.find(key); it != map.end())
                 {
-                        auto n = stack.back();
+                        lru.splice(lru.begin(), lru, it->second);
+                        return it->second->second;
+                }
+        }
 
-                        stack.pop_back();
-                        switch (n->type)
-                        {
-                                case ast_node::Type::Token:
-                                case ast_node::Type::Phrase:
-                                        collected.push_back(n->p);
-                                        break;
-
-                                case ast_node::Type::MatchSome:
-                                        stack.insert(stack.end(), n->match_some.nodes, n->match_some.nodes + n->match_some.size);
-                                        break;
-
-                                case ast_node::Type::UnaryOp:
-                                        if (n->unaryop.op != Operator::NOT)
-                                                stack.push_back(n->unaryop.expr);
-                                        break;
-
-                                case ast_node::Type::ConstTrueExpr:
-                                        stack.push_back(n->expr);
-                                        break;
-
-                                case ast_node::Type::BinOp:
-                                        if (n->binop.op == Operator::AND || n->binop.op == Operator::STRICT_AND || n->binop.op == Operator::OR)
-                                        {
-                                                stack.push_back(n->binop.lhs);
-                                                stack.push_back(n->binop.rhs);
-                                        }
-                                        else if (n->binop.op == Operator::NOT)
-                                                stack.push_back(n->binop.lhs);
-                                        break;
+        // compile outside the lock
+        auto plan = std::make_shared<const query_plan>(in);
+        std::lock_guard<std::mutex> g(lock);
 
-                                default:
-                                        break;
-                        }
-                } while (stack.size());
+        if (const auto it = map.find(key); it != map.end())
+        {
+                // another thread got here first
+                lru.splice(lru.begin(), lru, it->second);
+                return it->second->second;
+        }
 
-                for (const auto it : collected) // collected phrases
-                {
-                        const uint8_t rep = it->size == 1 ? it->rep : 1;
-                        const auto toNextSpan{it->toNextSpan};
-                        const auto flags{it->flags};
-                        const auto rewriteRange{it->rewrite_ctx.range};
-                        const auto translationCoefficient{it->rewrite_ctx.translationCoefficient};
-                        const auto srcSeqSize{it->rewrite_ctx.srcSeqSize};
-
-                        // for each phrase token
-                        for (uint16_t pos{it->index}, i{0}; i != it->size; ++i, ++pos)
-                        {
-                                if (traceCompile)
-                                        SLog("Collected instance: [", it->terms[i].token, "] index:", pos, " rep:", rep, " toNextSpan:", i == (it->size - 1) ? toNextSpan : 1, "\n");
+        lru.emplace_front(key, plan);
+        map.emplace(std::move(key), lru.begin());
 
-                                originalQueryTokenInstances.push_back({{pos, flags, rep, uint8_t(i == (it->size - 1) ? toNextSpan : 1), {rewriteRange, translationCoefficient, srcSeqSize}}, it->terms[i].token}); // need to be careful to get this right for phrases
-                        }
+        if (lru.size() > capacity)
+        {
+                map.erase(lru.back().first);
+                lru.pop_back();
+        }
+
+        return plan;
+}
+
+// queryexec_ctx assigns IDs to the terms known to the index source in the order they are resolved, and the plan
+// resolved all its terms in order, so if all of them are known to the source, they are assigned the same IDs they
+// were assigned in the plan, and the compiled tree would be identical to the plan's.
+//
+// The plan was compiled without considering bigram terms, so if the source indexed the bigram of any of its phrases, we need to compile it again.
+static bool bind_plan(const query_plan &plan, queryexec_ctx &rctx)
+{
+        const auto &terms = plan.cctx.terms;
+
+        // bigram terms are not considered in accumulated score mode; see comp_ctx::indexed_bigrams()
+        if (const auto bigrams = rctx.accumScoreMode ? nullptr : rctx.idxsrc->indexed_bigrams())
+        {
+                for (const auto &it : plan.bigramCandidates)
+                {
+                        if (bigrams->covers(it.first, it.second))
+                                return false;
                 }
         }
 
-        if (traceCompile)
-                SLog("Compiling:", q, "\n");
+        for (uint32_t i{0}; i != terms.size(); ++i)
+        {
+                if (rctx.resolve_term(terms[i]) != i + 1)
+                        return false;
+        }
+
+        return true;
+}
+
+// Either q or plan is set. If q is set, it is the normalized input query, which we are free to modify.
+static void exec_query_impl(query *q,
+                            const query_plan *const plan,
+                            std::vector<query_term_instance> originalQueryTokenInstances,
+                            IndexSource *const __restrict__ idxsrc,
+                            masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
+                            MatchedIndexDocumentsFilter *__restrict__ const inputMatchesFilter,
+                            IndexDocumentsFilter *__restrict__ const indexDocumentsFilter,
+                            const uint32_t execFlags,
+                            Similarity::IndexSourceTermsScorer *scorer,
+                            const uint64_t deadline,
+                            const uint64_t _start)
+{
+        // If the documents are ordered by a field, the first matches in document ID order are also the top matches by that field, so
+        // we can stop once we have collected as many as the caller asked for
+        const bool limited = inputMatchesFilter->limit && idxsrc->documents_order();
+        std::unique_ptr<limited_matches_filter> limitedFilter(limited ? new limited_matches_filter(inputMatchesFilter) : nullptr);
+        MatchedIndexDocumentsFilter *__restrict__ const matchesFilter = limited ? limitedFilter.get() : inputMatchesFilter;
+        const bool documentsOnly = execFlags & uint32_t(ExecFlags::DocumentsOnly);
+        const bool accumScoreMode = execFlags & uint32_t(ExecFlags::AccumulatedScoreScheme);
+        const bool defaultMode = !documentsOnly && !accumScoreMode;
+        // If the filter provides a materialized set for this source, we push it down to the iterators tree(see IndexDocumentsFilter::filter_set())
+        // and we won't need to filter() matched documents
+        const auto filterSet = indexDocumentsFilter ? indexDocumentsFilter->filter_set(idxsrc) : nullptr;
+        IndexDocumentsFilter *__restrict__ const documentsFilter = filterSet ? nullptr : indexDocumentsFilter;
+
+        if (accumScoreMode)
+        {
+                // Just in case
+                expect(scorer);
+        }
 
         queryexec_ctx rctx(idxsrc, documentsOnly, accumScoreMode);
 
+        rctx.deadline = deadline;
+
         struct comp_ctx final
             : public compilation_ctx
         {
                 queryexec_ctx *const rctx;
 
-                comp_ctx(queryexec_ctx *const r)
+                comp_ctx(queryexec_ctx *const r, const bool documentsOnly)
                     : rctx{r}
                 {
+                        verifyBigramPhrases = !documentsOnly;
                 }
 
                 inline uint16_t resolve_query_term(const str8_t term) override final
@@ -739,10 +1073,34 @@ void Trinity::exec_query(const query &in,
                         return rctx->resolve_term(term);
                 }
 
-        } compilationCtx(&rctx);
+                // In accumulated score mode, the Conjuction of (bigram AND phrase) would sum the scores of both, so we
+                // wouldn't score the phrase the same way we would if it wasn't covered by the bigrams set
+                const Bigrams::terms_set *indexed_bigrams() override final
+                {
+                        return rctx->accumScoreMode ? nullptr : rctx->idxsrc->indexed_bigrams();
+                }
+
+        } compilationCtx(&rctx, documentsOnly);
 
         const auto before = Timings::Microseconds::Tick();
-        auto rootExecNode = compile_query(q.root, compilationCtx);
+        exec_node rootExecNode;
+        std::unique_ptr<query> planQuery;
+
+        if (plan && bind_plan(*plan, rctx))
+                rootExecNode = clone_execnodes(plan->root, compilationCtx);
+        else
+        {
+                if (!q)
+                {
+                        planQuery.reset(new query(plan->q, true));
+                        q = planQuery.get();
+                }
+
+                if (traceCompile)
+                        SLog("Compiling:", *q, "\n");
+
+                rootExecNode = compile_query(q->root, compilationCtx);
+        }
 
         if (traceCompile)
                 SLog(duration_repr(Timings::Microseconds::Since(before)), " to compile, ", duration_repr(Timings::Microseconds::Since(_start)), " since start\n");
@@ -763,8 +1121,7 @@ void Trinity::exec_query(const query &in,
         // There is really no need to do it now, but for a Percolator like scheme, where
         // you want to attempt to matchd documents against queries, it would be very handy.
         //
-        // TODO: we need to move some state out of queryexec_ctx, to e.g a compilation_ctx
-        // which can exist independently of a queryexec_ctx, so that we can use it for a perconalation impl.
+        // Compilation doesn't depend on a queryexec_ctx other than for resolving terms; see query_plan and percolator_query.
         // group_execnodes(rootExecNode, rctx.allocator);
 
         // see query_index_terms and MatchedIndexDocumentsFilter::prepare() comments
@@ -955,6 +1312,7 @@ void Trinity::exec_query(const query &in,
         }
 
         isrc_docid_t matchedDocuments{0}; // isrc_docid_t so that we can support whatever number of distinct documents are allowed by sizeof(isrc_docid_t)
+        bool truncated{false};
         [[maybe_unused]] const auto start = Timings::Microseconds::Tick();
         const auto requireDocIDTranslation = idxsrc->require_docid_translation();
 
@@ -970,8 +1328,14 @@ void Trinity::exec_query(const query &in,
 #pragma mark Execution
         try
         {
-                if (rootExecNode.fp == ENT::matchterm && !accumScoreMode)
+                if (deadline && Timings::Microseconds::Tick() >= deadline)
                 {
+                        // compilation took too long
+                        truncated = true;
+                }
+                else if (rootExecNode.fp == ENT::matchterm && !accumScoreMode && !filterSet && !deadline)
+                {
+                        // If a deadline is set, we 'll use a GenericDocsSetSpan instead, which is processed in ranges(see process_span())
                         isrc_docid_t docID;
 
                         // SPECIALIZATION: single term
@@ -1108,7 +1472,29 @@ void Trinity::exec_query(const query &in,
                 }
                 else
                 {
-                        auto *const sit = rctx.build_iterator(rootExecNode, execFlags);
+                        auto *sit = rctx.build_iterator(rootExecNode, execFlags);
+
+                        if (filterSet)
+                        {
+                                auto *const fit = rctx.reg_docset_it(rctx.new_docset_it<DocsSetIterators::DocIDsSet>(&filterSet->set));
+
+                                if (filterSet->mode == documents_filter_set::Mode::Exclude)
+                                {
+                                        // build_span() will consider the costs, and may use a FilteredDocsSetSpan
+                                        sit = rctx.reg_docset_it(rctx.new_docset_it<DocsSetIterators::Filter>(sit, fit));
+                                }
+                                else
+                                {
+                                        // The cheapest iterator leads
+                                        DocsSetIterators::Iterator *its[2] = {sit, fit};
+
+                                        if (DocsSetIterators::cost(fit) < DocsSetIterators::cost(sit))
+                                                std::swap(its[0], its[1]);
+
+                                        sit = rctx.reg_docset_it(rctx.new_docset_it<DocsSetIterators::Conjuction>(its, 2));
+                                }
+                        }
+
                         // Over-estimate capacity, make sure we won't overrun any buffers
                         const std::size_t capacity = rctx.tctxMap.size() + rctx.allIterators.size() + rctx.docsetsIterators.size() + 64;
                         auto span = build_span(sit, &rctx);
@@ -1135,6 +1521,7 @@ void Trinity::exec_query(const query &in,
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
+                                                        window_exclusions exclusions;
                                                         std::size_t n{0};
 
                                                         void process(relevant_document_provider *const rdp) override final
@@ -1142,21 +1529,31 @@ void Trinity::exec_query(const query &in,
                                                                 const auto id = rdp->document();
                                                                 const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                                if (!documentsFilter->filter(globalDocID) && !maskedDocumentsRegistry->test(globalDocID))
+                                                                if (exclusions.checked(globalDocID) || (!documentsFilter->filter(globalDocID) && !maskedDocumentsRegistry->test(globalDocID)))
                                                                 {
                                                                         matchesFilter->consider(globalDocID);
                                                                         ++n;
                                                                 }
                                                         }
 
+                                                        const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                        {
+                                                                return exclusions.mask(windowBase);
+                                                        }
+
+                                                        void window_processed() override final
+                                                        {
+                                                                exclusions.reset();
+                                                        }
+
                                                         Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, masked_documents_registry *mr, IndexDocumentsFilter *df)
-                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df}
+                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df}, exclusions{src, mr, df}
                                                         {
                                                         }
 
                                                 } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                truncated = process_span(span.get(), &handler, deadline);
                                                 matchedDocuments = handler.n;
                                         }
                                         else
@@ -1169,6 +1566,7 @@ void Trinity::exec_query(const query &in,
                                                         const bool requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
+                                                        window_exclusions exclusions;
                                                         std::size_t n{0};
 
                                                         void process(relevant_document_provider *const rdp) override final
@@ -1176,21 +1574,31 @@ void Trinity::exec_query(const query &in,
                                                                 const auto id = rdp->document();
                                                                 const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                                if (!documentsFilter->filter(globalDocID))
+                                                                if (exclusions.checked(globalDocID) || !documentsFilter->filter(globalDocID))
                                                                 {
                                                                         matchesFilter->consider(globalDocID);
                                                                         ++n;
                                                                 }
                                                         }
 
+                                                        const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                        {
+                                                                return exclusions.mask(windowBase);
+                                                        }
+
+                                                        void window_processed() override final
+                                                        {
+                                                                exclusions.reset();
+                                                        }
+
                                                         Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, IndexDocumentsFilter *df)
-                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df}
+                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df}, exclusions{src, nullptr, df}
                                                         {
                                                         }
 
                                                 } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                truncated = process_span(span.get(), &handler, deadline);
                                                 matchedDocuments = handler.n;
                                         }
                                 }
@@ -1204,6 +1612,7 @@ void Trinity::exec_query(const query &in,
                                                 const bool requireDocIDTranslation;
                                                 MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                 masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
+                                                window_exclusions exclusions;
                                                 std::size_t n{0};
 
                                                 void process(relevant_document_provider *const rdp) override final
@@ -1211,21 +1620,31 @@ void Trinity::exec_query(const query &in,
                                                         const auto id = rdp->document();
                                                         const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                        if (!maskedDocumentsRegistry->test(globalDocID))
+                                                        if (exclusions.checked(globalDocID) || !maskedDocumentsRegistry->test(globalDocID))
                                                         {
                                                                 matchesFilter->consider(globalDocID);
                                                                 ++n;
                                                         }
                                                 }
 
+                                                const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                {
+                                                        return exclusions.mask(windowBase);
+                                                }
+
+                                                void window_processed() override final
+                                                {
+                                                        exclusions.reset();
+                                                }
+
                                                 Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, masked_documents_registry *mr)
-                                                    : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}
+                                                    : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, exclusions{src, mr, nullptr}
                                                 {
                                                 }
 
                                         } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        truncated = process_span(span.get(), &handler, deadline);
                                         matchedDocuments = handler.n;
                                 }
                                 else
@@ -1255,7 +1674,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                truncated = process_span(span.get(), &handler, deadline);
                                                 matchedDocuments = handler.n;
                                         }
                                         else
@@ -1283,7 +1702,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                truncated = process_span(span.get(), &handler, deadline);
                                                 matchedDocuments = handler.n;
                                         }
                                 }
@@ -1303,6 +1722,7 @@ void Trinity::exec_query(const query &in,
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
+                                                        window_exclusions exclusions;
                                                         std::size_t n{0};
 
                                                         void process(relevant_document_provider *relDoc) override final
@@ -1310,21 +1730,31 @@ void Trinity::exec_query(const query &in,
                                                                 const auto id = relDoc->document();
                                                                 const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                                if (!documentsFilter->filter(globalDocID) && !maskedDocumentsRegistry->test(globalDocID))
+                                                                if (exclusions.checked(globalDocID) || (!documentsFilter->filter(globalDocID) && !maskedDocumentsRegistry->test(globalDocID)))
                                                                 {
                                                                         matchesFilter->consider(globalDocID, relDoc->score());
                                                                         ++n;
                                                                 }
                                                         }
 
+                                                        const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                        {
+                                                                return exclusions.mask(windowBase);
+                                                        }
+
+                                                        void window_processed() override final
+                                                        {
+                                                                exclusions.reset();
+                                                        }
+
                                                         Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, masked_documents_registry *mr, IndexDocumentsFilter *df)
-                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df}
+                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df}, exclusions{src, mr, df}
                                                         {
                                                         }
 
                                                 } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                truncated = process_span(span.get(), &handler, deadline);
                                                 matchedDocuments = handler.n;
                                         }
                                         else
@@ -1337,6 +1767,7 @@ void Trinity::exec_query(const query &in,
                                                         const bool requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
+                                                        window_exclusions exclusions;
                                                         std::size_t n{0};
 
                                                         void process(relevant_document_provider *relDoc) override final
@@ -1344,21 +1775,31 @@ void Trinity::exec_query(const query &in,
                                                                 const auto id = relDoc->document();
                                                                 const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                                if (!documentsFilter->filter(globalDocID))
+                                                                if (exclusions.checked(globalDocID) || !documentsFilter->filter(globalDocID))
                                                                 {
                                                                         matchesFilter->consider(globalDocID, relDoc->score());
                                                                         ++n;
                                                                 }
                                                         }
 
+                                                        const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                        {
+                                                                return exclusions.mask(windowBase);
+                                                        }
+
+                                                        void window_processed() override final
+                                                        {
+                                                                exclusions.reset();
+                                                        }
+
                                                         Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, IndexDocumentsFilter *df)
-                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df}
+                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df}, exclusions{src, nullptr, df}
                                                         {
                                                         }
 
                                                 } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                truncated = process_span(span.get(), &handler, deadline);
                                                 matchedDocuments = handler.n;
                                         }
                                 }
@@ -1372,6 +1813,7 @@ void Trinity::exec_query(const query &in,
                                                 const bool requireDocIDTranslation;
                                                 MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                 masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
+                                                window_exclusions exclusions;
                                                 std::size_t n{0};
 
                                                 void process(relevant_document_provider *relDoc) override final
@@ -1379,21 +1821,31 @@ void Trinity::exec_query(const query &in,
                                                         const auto id = relDoc->document();
                                                         const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                        if (!maskedDocumentsRegistry->test(globalDocID))
+                                                        if (exclusions.checked(globalDocID) || !maskedDocumentsRegistry->test(globalDocID))
                                                         {
                                                                 matchesFilter->consider(globalDocID, relDoc->score());
                                                                 ++n;
                                                         }
                                                 }
 
+                                                const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                {
+                                                        return exclusions.mask(windowBase);
+                                                }
+
+                                                void window_processed() override final
+                                                {
+                                                        exclusions.reset();
+                                                }
+
                                                 Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, masked_documents_registry *mr)
-                                                    : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}
+                                                    : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, exclusions{src, mr, nullptr}
                                                 {
                                                 }
 
                                         } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        truncated = process_span(span.get(), &handler, deadline);
                                         matchedDocuments = handler.n;
                                 }
                                 else
@@ -1423,7 +1875,7 @@ void Trinity::exec_query(const query &in,
 
                                         } handler(&rctx, idxsrc, matchesFilter);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        truncated = process_span(span.get(), &handler, deadline);
                                         matchedDocuments = handler.n;
                                 }
                         }
@@ -1442,6 +1894,7 @@ void Trinity::exec_query(const query &in,
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
+                                                        window_exclusions exclusions;
                                                         std::size_t n{0};
 
                                                         void process(relevant_document_provider *relDoc) override final
@@ -1449,7 +1902,7 @@ void Trinity::exec_query(const query &in,
                                                                 const auto id = relDoc->document();
                                                                 const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                                if (!documentsFilter->filter(globalDocID) && !maskedDocumentsRegistry->test(globalDocID))
+                                                                if (exclusions.checked(globalDocID) || (!documentsFilter->filter(globalDocID) && !maskedDocumentsRegistry->test(globalDocID)))
                                                                 {
                                                                         auto doc = ctx->document_by_id(id);
 
@@ -1466,14 +1919,24 @@ void Trinity::exec_query(const query &in,
                                                                 }
                                                         }
 
+                                                        const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                        {
+                                                                return exclusions.mask(windowBase);
+                                                        }
+
+                                                        void window_processed() override final
+                                                        {
+                                                                exclusions.reset();
+                                                        }
+
                                                         Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, masked_documents_registry *mr, IndexDocumentsFilter *df)
-                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df}
+                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df}, exclusions{src, mr, df}
                                                         {
                                                         }
 
                                                 } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                truncated = process_span(span.get(), &handler, deadline);
                                                 matchedDocuments = handler.n;
                                         }
                                         else
@@ -1486,6 +1949,7 @@ void Trinity::exec_query(const query &in,
                                                         const bool requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
+                                                        window_exclusions exclusions;
                                                         std::size_t n{0};
 
                                                         void process(relevant_document_provider *relDoc) override final
@@ -1493,7 +1957,7 @@ void Trinity::exec_query(const query &in,
                                                                 const auto id = relDoc->document();
                                                                 const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                                if (!documentsFilter->filter(globalDocID))
+                                                                if (exclusions.checked(globalDocID) || !documentsFilter->filter(globalDocID))
                                                                 {
                                                                         auto doc = ctx->document_by_id(id);
 
@@ -1510,14 +1974,24 @@ void Trinity::exec_query(const query &in,
                                                                 }
                                                         }
 
+                                                        const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                        {
+                                                                return exclusions.mask(windowBase);
+                                                        }
+
+                                                        void window_processed() override final
+                                                        {
+                                                                exclusions.reset();
+                                                        }
+
                                                         Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, IndexDocumentsFilter *df)
-                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df}
+                                                            : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df}, exclusions{src, nullptr, df}
                                                         {
                                                         }
 
                                                 } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                truncated = process_span(span.get(), &handler, deadline);
                                                 matchedDocuments = handler.n;
                                         }
                                 }
@@ -1531,6 +2005,7 @@ void Trinity::exec_query(const query &in,
                                                 const bool requireDocIDTranslation;
                                                 MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                 masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
+                                                window_exclusions exclusions;
                                                 std::size_t n{0};
 
                                                 void process(relevant_document_provider *relDoc) override final
@@ -1538,7 +2013,7 @@ void Trinity::exec_query(const query &in,
                                                         const auto id = relDoc->document();
                                                         const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
 
-                                                        if (!maskedDocumentsRegistry->test(globalDocID))
+                                                        if (exclusions.checked(globalDocID) || !maskedDocumentsRegistry->test(globalDocID))
                                                         {
                                                                 auto doc = ctx->document_by_id(id);
 
@@ -1555,14 +2030,24 @@ void Trinity::exec_query(const query &in,
                                                         }
                                                 }
 
+                                                const uint64_t *window_mask(const isrc_docid_t windowBase) override final
+                                                {
+                                                        return exclusions.mask(windowBase);
+                                                }
+
+                                                void window_processed() override final
+                                                {
+                                                        exclusions.reset();
+                                                }
+
                                                 Handler(queryexec_ctx *const c, IndexSource *const src, MatchedIndexDocumentsFilter *mf, masked_documents_registry *mr)
-                                                    : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}
+                                                    : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, exclusions{src, mr, nullptr}
                                                 {
                                                 }
 
                                         } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        truncated = process_span(span.get(), &handler, deadline);
                                         matchedDocuments = handler.n;
                                 }
                                 else
@@ -1601,7 +2086,7 @@ void Trinity::exec_query(const query &in,
 
                                         } handler(&rctx, idxsrc, matchesFilter);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        truncated = process_span(span.get(), &handler, deadline);
                                         matchedDocuments = handler.n;
                                 }
                         }
@@ -1611,15 +2096,85 @@ void Trinity::exec_query(const query &in,
         {
                 // search was aborted
         }
+        catch (const queryexec_ctx::deadline_reached &)
+        {
+                // while materializing(see queryexec_ctx::build_iterator())
+                truncated = true;
+        }
         catch (...)
         {
                 // something else, throw it and let someone else handle it
                 throw;
         }
 
+        inputMatchesFilter->truncated = truncated;
+
         const auto duration = Timings::Microseconds::Since(start);
         const auto durationAll = Timings::Microseconds::Since(_start);
 
         if (traceCompile || traceExec)
                 SLog(ansifmt::bold, ansifmt::color_red, dotnotation_repr(matchedDocuments), " matched in ", duration_repr(duration), ansifmt::reset, " (", Timings::Microseconds::ToMillis(duration), " ms) ", duration_repr(durationAll), " all\n");
 }
+
+void Trinity::exec_query(const query &in,
+                         IndexSource *const __restrict__ idxsrc,
+                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
+                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
+                         IndexDocumentsFilter *__restrict__ const indexDocumentsFilter,
+                         const uint32_t execFlags,
+                         Similarity::IndexSourceTermsScorer *scorer,
+                         const uint64_t deadline)
+{
+        if (!in)
+        {
+                if (traceCompile)
+                        SLog("No root node\n");
+
+                return;
+        }
+
+        // We need a copy of that query here
+        // for we we will need to modify it
+        const auto _start = Timings::Microseconds::Tick();
+        query q(in, true); // shallow copy, no need for a deep copy here
+
+        // Normalize just in case
+        if (!q.normalize())
+        {
+                if (traceCompile)
+                        SLog("No root node after normalization\n");
+
+                return;
+        }
+
+        std::vector<query_term_instance> originalQueryTokenInstances;
+
+        if (!(execFlags & (uint32_t(ExecFlags::DocumentsOnly) | uint32_t(ExecFlags::AccumulatedScoreScheme))))
+                collect_query_term_instances(q, &originalQueryTokenInstances);
+
+        exec_query_impl(&q, nullptr, std::move(originalQueryTokenInstances), idxsrc, maskedDocumentsRegistry, matchesFilter, indexDocumentsFilter, execFlags, scorer, deadline, _start);
+}
+
+void Trinity::exec_query(const query_plan &plan,
+                         IndexSource *const __restrict__ idxsrc,
+                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
+                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
+                         IndexDocumentsFilter *__restrict__ const indexDocumentsFilter,
+                         const uint32_t execFlags,
+                         Similarity::IndexSourceTermsScorer *scorer,
+                         const uint64_t deadline)
+{
+        if (!plan)
+        {
+                if (traceCompile)
+                        SLog("Nothing to do\n");
+
+                return;
+        }
+
+        const auto _start = Timings::Microseconds::Tick();
+
+        exec_query_impl(nullptr, &plan,
+                        execFlags & (uint32_t(ExecFlags::DocumentsOnly) | uint32_t(ExecFlags::AccumulatedScoreScheme)) ? std::vector<query_term_instance>{} : plan.originalQueryTokenInstances,
+                        idxsrc, maskedDocumentsRegistry, matchesFilter, indexDocumentsFilter, execFlags, scorer, deadline, _start);
+}
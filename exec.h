@@ -1,11 +1,16 @@
 // Please refer to https://github.com/phaistos-networks/Trinity/wiki/Query-Execution-Engine-Internals
 #pragma once
+#include "compilation_ctx.h"
 #include "docidupdates.h"
 #include "index_source.h"
 #include "matches.h"
 #include "queries.h"
 #include "similarity.h"
 #include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace Trinity
 {
@@ -50,9 +55,93 @@ namespace Trinity
                         throw Switch::invalid_argument("DocumentsOnly and AccumulatedScoreScheme are mutually exclusive modes");
         }
 
+        // The source-independent part of exec_query()'s work: the normalized query, the original query term instances
+        // and the query compiled with all its terms considered known.
+        //
+        // exec_query() otherwise normalizes and compiles the query for each index source. If the same plan is used for many sources
+        // (e.g all segments of a collection; see exec_query_par()), it is only bound to each source: if all the plan's terms are known to the
+        // source, the compiled tree is just cloned, because compilation only depends on which terms can be resolved. Otherwise, only the
+        // normalized query is re-compiled for that source.
+        //
+        // Plans are immutable once constructed, and can be shared by multiple threads.
+        struct query_plan final
+        {
+                struct term_instance final
+                    : public query_term_ctx::instance_struct
+                {
+                        str8_t token;
+                };
+
+                struct plan_compilation_ctx final
+                    : public compilation_ctx
+                {
+                        ska::flat_hash_map<str8_t, uint16_t> map;
+                        // The term resolved to exec_term_id_t (i + 1) is terms[i]
+                        std::vector<str8_t> terms;
+
+                        uint16_t resolve_query_term(const str8_t term) override final;
+                };
+
+                // normalized copy of the input query; it owns the tokens referenced here
+                query q;
+                std::vector<term_instance> originalQueryTokenInstances;
+                // The terms of the phrases of two terms; see IndexSource::indexed_bigrams()
+                std::vector<std::pair<str8_t, str8_t>> bigramCandidates;
+                // root's contexts are allocated from there
+                plan_compilation_ctx cctx;
+                exec_node root{ENT::constfalse, {}};
+
+                query_plan(const query &in);
+
+                query_plan(const query_plan &) = delete;
+
+                operator bool() const noexcept
+                {
+                        return root.fp != ENT::constfalse && root.fp != ENT::dummyop;
+                }
+        };
+
+        // A cache of query_plans, keyed by the normalized query representation and term instances, with LRU eviction.
+        // Thread-safe.
+        class query_plans_cache final
+        {
+              private:
+                using lru_list = std::list<std::pair<std::string, std::shared_ptr<const query_plan>>>;
+
+                const std::size_t capacity;
+                std::mutex lock;
+                lru_list lru;
+                std::unordered_map<std::string, lru_list::iterator> map;
+
+              public:
+                query_plans_cache(const std::size_t c = 4096)
+                    : capacity{c}
+                {
+                }
+
+                std::shared_ptr<const query_plan> plan_for(const query &q);
+        };
+
+        // If deadline is not 0, execution will stop once Timings::Microseconds::Tick() >= deadline, and MatchedIndexDocumentsFilter::truncated will be set.
+        // The engine checks the deadline after every window of MatchesProxy::WINDOW_SIZE document IDs(and while materializing large unions), so you get
+        // partial results instead of having to throw aborted_search_exception from consider(), and tail latency is bounded under load.
         void exec_query(const query &in, IndexSource *, masked_documents_registry *const maskedDocumentsRegistry, MatchedIndexDocumentsFilter *, IndexDocumentsFilter *const f = nullptr,
                         const uint32_t flags = 0,
-                        Similarity::IndexSourceTermsScorer *scorer = nullptr);
+                        Similarity::IndexSourceTermsScorer *scorer = nullptr,
+                        const uint64_t deadline = 0);
+
+        // Same as above, except that the query is not normalized and compiled again; see query_plan
+        void exec_query(const query_plan &plan, IndexSource *, masked_documents_registry *const maskedDocumentsRegistry, MatchedIndexDocumentsFilter *, IndexDocumentsFilter *const f = nullptr,
+                        const uint32_t flags = 0,
+                        Similarity::IndexSourceTermsScorer *scorer = nullptr,
+                        const uint64_t deadline = 0);
+
+        // A deadline for the exec_query() and exec_query_par() collection variants(see exec_query()), in Timings::Microseconds::Tick() units; 0 for no deadline.
+        // It's a distinct type, so that it can't be mistaken for, or confused with, the arguments passed to the filters constructors.
+        struct exec_deadline final
+        {
+                uint64_t us{0};
+        };
 
         // Handy utility function; executes query on all index sources in the provided collection in sequence and returns
         // a vector with the match filters/results of each execution.
@@ -63,8 +152,10 @@ namespace Trinity
         //
         // Note that execution of sources does not depend on state of other sources - they are isolated so parallel processing them requires
         // no coordination.
+        //
+        // If a deadline is set, it is shared by all index sources' executions; check the truncated flag of each returned filter.
         template <typename T, typename... Arg>
-        std::vector<std::unique_ptr<T>> exec_query(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Arg &&... args)
+        std::vector<std::unique_ptr<T>> exec_query(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, const exec_deadline deadline, Arg &&... args)
         {
                 static_assert(std::is_base_of<MatchedIndexDocumentsFilter, T>::value, "Expected a MatchedIndexDocumentsFilter subclass");
                 const auto n = collection->sources.size();
@@ -72,24 +163,35 @@ namespace Trinity
 
                 validate_flags(flags);
 
+                const query_plan plan(in);
+
                 for (uint32_t i{0}; i != n; ++i)
                 {
                         auto source = collection->sources[i];
                         auto scanner = collection->scanner_registry_for(i);
                         auto filter = std::make_unique<T>(std::forward<Arg>(args)...);
 
-                        exec_query(in, source, scanner.get(), filter.get(), f, flags);
+                        exec_query(plan, source, scanner.get(), filter.get(), f, flags, nullptr, deadline.us);
                         out.push_back(std::move(filter));
                 }
 
                 return out;
         }
 
+        template <typename T, typename... Arg>
+        std::vector<std::unique_ptr<T>> exec_query(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Arg &&... args)
+        {
+                return exec_query<T>(in, collection, f, flags, exec_deadline{}, std::forward<Arg>(args)...);
+        }
+
         // Parallel queries execution, using std::async()
         // This variant also supports ExecFlags::AccumulatedScoreScheme
         // You will need to provide a cs for this to work
+        //
+        // If a deadline is set, it is shared by all index sources' executions(see exec_query()).
+        // Check the truncated flag of each returned filter; some sources may have been fully processed while others were not.
         template <typename T, typename... Arg>
-        std::vector<std::unique_ptr<T>> exec_query_par(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Trinity::Similarity::IndexSourcesCollectionTermsScorer *cs, Arg &&... args)
+        std::vector<std::unique_ptr<T>> exec_query_par(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Trinity::Similarity::IndexSourcesCollectionTermsScorer *cs, const exec_deadline deadline, Arg &&... args)
         {
                 static_assert(std::is_base_of<MatchedIndexDocumentsFilter, T>::value, "Expected a MatchedIndexDocumentsFilter subclass");
                 const auto n = collection->sources.size();
@@ -124,13 +226,15 @@ namespace Trinity
                                 if (accumScoreScheme)
                                         scorer.reset(cs->new_source_scorer(source));
 
-                                exec_query(in, source, scanner.get(), filter.get(), f, flags, scorer.get());
+                                exec_query(in, source, scanner.get(), filter.get(), f, flags, scorer.get(), deadline.us);
                                 out.push_back(std::move(filter));
                         }
                         return out;
                 }
 
                 std::vector<std::future<std::unique_ptr<T>>> futures;
+                // compiled once, for all sources
+                const query_plan plan(in);
 
                 // Schedule all but the first via std::async()
                 // we 'll handle the first here.
@@ -148,7 +252,7 @@ namespace Trinity
                                             if (accumScoreScheme)
                                                     scorer.reset(cs->new_source_scorer(source));
 
-                                            exec_query(in, source, scanner.get(), filter.get(), f, flags, scorer.get());
+                                            exec_query(plan, source, scanner.get(), filter.get(), f, flags, scorer.get(), deadline.us);
                                             return filter;
                                     },
                                                i));
@@ -164,7 +268,7 @@ namespace Trinity
                         if (accumScoreScheme)
                                 scorer.reset(cs->new_source_scorer(source));
 
-                        exec_query(in, source, scanner.get(), filter.get(), f, flags, scorer.get());
+                        exec_query(plan, source, scanner.get(), filter.get(), f, flags, scorer.get(), deadline.us);
                         out.push_back(std::move(filter));
                 }
 
@@ -178,4 +282,10 @@ namespace Trinity
 
                 return out;
         }
+
+        template <typename T, typename... Arg>
+        std::vector<std::unique_ptr<T>> exec_query_par(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Trinity::Similarity::IndexSourcesCollectionTermsScorer *cs, Arg &&... args)
+        {
+                return exec_query_par<T>(in, collection, f, flags, cs, exec_deadline{}, std::forward<Arg>(args)...);
+        }
 };
@@ -1121,3 +1121,22 @@ Trinity::Codecs::Encoder *Trinity::Codecs::Google::IndexSession::new_encoder()
 {
         return new Trinity::Codecs::Google::Encoder(this);
 }
+
+Trinity::Codecs::IndexSession *Trinity::Codecs::Google::IndexSession::new_worker_session()
+{
+        return new Trinity::Codecs::Google::IndexSession(basePath);
+}
+
+void Trinity::Codecs::Google::IndexSession::append_worker_session(Trinity::Codecs::IndexSession *ws, term_index_ctx *tctxs, const std::size_t n)
+{
+        // All offsets in an index chunk(including skiplist entries) are relative to the chunk, so
+        // we only need to rebase the chunks
+        const uint32_t base = indexOut.size() + indexOutFlushed;
+
+        require(ws->indexOutFlushed == 0);
+        indexOut.serialize(ws->indexOut.data(), ws->indexOut.size());
+        ws->indexOut.clear();
+
+        for (uint32_t i{0}; i != n; ++i)
+                tctxs[i].indexChunk.offset += base;
+}
@@ -29,7 +29,7 @@ namespace Trinity
                                 Trinity::Codecs::Encoder *new_encoder() override final;
 
                                 IndexSession(const char *bp)
-                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge)}
+                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge) | unsigned(Capabilities::ParallelEncode)}
                                 {
                                 }
 
@@ -41,6 +41,10 @@ namespace Trinity
                                 range32_t append_index_chunk(const Trinity::Codecs::AccessProxy *, const term_index_ctx srcTCTX) override final;
 
                                 void merge(merge_participant *, const uint16_t, Trinity::Codecs::Encoder *) override final;
+
+                                Trinity::Codecs::IndexSession *new_worker_session() override final;
+
+                                void append_worker_session(Trinity::Codecs::IndexSession *, term_index_ctx *, const std::size_t) override final;
                         };
 
                         class Encoder final
@@ -111,9 +115,9 @@ namespace Trinity
 
 				private:
                                 uint8_t blockDocIdx;
-                                isrc_docid_t documents[N];
+                                alignas(64) isrc_docid_t documents[N];
                                 isrc_docid_t blockLastDocID{0};
-                                uint32_t freqs[N];
+                                alignas(64) uint32_t freqs[N];
                                 uint32_t skipListIdx;
 				const uint8_t *p;
 
@@ -185,6 +189,17 @@ namespace Trinity
                                 void init(const term_index_ctx &tctx, Trinity::Codecs::AccessProxy *access) override final;
 
 				Trinity::Codecs::PostingsListIterator *new_iterator() override final;
+
+                                uint32_t skiplist_granularity() const noexcept override final
+                                {
+                                        return skiplist.size() ? SKIPLIST_STEP * N : 0;
+                                }
+
+                                // varbyte encoded deltas
+                                uint8_t decode_cost() const noexcept override final
+                                {
+                                        return 2;
+                                }
                         };
 
                         isrc_docid_t PostingsListIterator::next()
@@ -0,0 +1,325 @@
+#include "impacts.h"
+#include "docvalues.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+using namespace Trinity;
+
+void Trinity::ImpactOrdered::build(IndexSource *const src, IndexSourceTermsView *const terms, const impact_func &impact, IOBuffer *const out)
+{
+        const auto base = out->size();
+        IOBuffer directory;
+        std::vector<std::pair<uint8_t, isrc_docid_t>> postings;
+        uint32_t termsCnt{0};
+        isrc_docid_t maxDocID{0};
+
+        for (; !terms->done(); terms->next())
+        {
+                const auto[term, tctx] = terms->cur();
+
+                if (!tctx.documents)
+                        continue;
+
+                std::unique_ptr<Codecs::Decoder> dec(src->new_postings_decoder(term, tctx));
+                std::unique_ptr<Codecs::PostingsListIterator> it(dec->new_iterator());
+
+                postings.clear();
+                for (auto id = it->next(); id != DocIDsEND; id = it->next())
+                {
+                        if (const auto v = impact(id, it->freq))
+                                postings.push_back({v, id});
+                }
+
+                if (postings.empty())
+                        continue;
+
+                maxDocID = std::max(maxDocID, postings.back().second);
+
+                // document IDs remain in ascending order within each tier
+                std::stable_sort(postings.begin(), postings.end(), [](const auto &a, const auto &b) noexcept {
+                        return a.first > b.first;
+                });
+
+                const auto tiersCntOffset = directory.size() + 1 + term.size();
+                uint16_t tiersCnt{0};
+
+                directory.pack(uint8_t(term.size()));
+                directory.serialize(term.data(), term.size());
+                directory.pack(uint16_t(0));
+
+                for (const auto *p = postings.data(), *const e = p + postings.size(); p != e;)
+                {
+                        const auto v = p->first;
+                        const uint32_t offset = out->size() - base;
+                        isrc_docid_t prev{0};
+                        uint32_t n{0};
+
+                        do
+                        {
+                                out->encode_varbyte32(p->second - prev);
+                                prev = p->second;
+                                ++n;
+                        } while (++p != e && p->first == v);
+
+                        directory.pack(v, n, offset);
+                        ++tiersCnt;
+                }
+
+                *reinterpret_cast<uint16_t *>(directory.data() + tiersCntOffset) = tiersCnt;
+                ++termsCnt;
+        }
+
+        const uint32_t directoryOffset = out->size() - base;
+
+        out->serialize(directory.data(), directory.size());
+        out->pack(directoryOffset, termsCnt, uint32_t(maxDocID));
+}
+
+ImpactOrdered::impact_func Trinity::ImpactOrdered::static_score_impacts(const DocValues::Column *const c)
+{
+        if (!c)
+                return [](const isrc_docid_t, const tokenpos_t) noexcept { return uint8_t(1); };
+
+        const double span = c->bits == 64 ? double(std::numeric_limits<uint64_t>::max()) : double((uint64_t(1) << c->bits) - 1);
+
+        return [c, span](const isrc_docid_t id, const tokenpos_t) noexcept {
+                uint64_t v;
+
+                if (!span || !c->get(id, &v))
+                        return uint8_t(1);
+
+                return uint8_t(1 + uint32_t((v - c->minValue) / span * 254));
+        };
+}
+
+void ImpactOrdered::Index::init(const range_base<const uint8_t *, std::size_t> content)
+{
+        static constexpr std::size_t trailerSize{sizeof(uint32_t) * 3};
+
+        if (content.size() < trailerSize)
+                throw Switch::data_error("Unexpected impacts contents");
+
+        const auto b = content.start();
+        const auto e = b + content.size() - trailerSize;
+        const auto directoryOffset = *(uint32_t *)e;
+        const auto termsCnt = *(uint32_t *)(e + sizeof(uint32_t));
+
+        if (directoryOffset > content.size() - trailerSize)
+                throw Switch::data_error("Unexpected impacts contents");
+
+        maxDocID = *(uint32_t *)(e + sizeof(uint32_t) * 2);
+        map.reserve(termsCnt);
+
+        for (const auto *p = b + directoryOffset; p < e;)
+        {
+                const uint8_t len = *p++;
+                const str8_t term(reinterpret_cast<const char *>(p), len);
+
+                p += len;
+
+                const auto tiersCnt = *(uint16_t *)p;
+
+                p += sizeof(uint16_t);
+                map.insert({term, {uint32_t(tiers.size()), tiersCnt}});
+
+                for (uint16_t i{0}; i != tiersCnt; ++i)
+                {
+                        const auto impact = *p++;
+                        const auto documents = *(uint32_t *)p;
+                        p += sizeof(uint32_t);
+                        const auto offset = *(uint32_t *)p;
+                        p += sizeof(uint32_t);
+
+                        tiers.push_back({impact, documents, b + offset});
+                }
+        }
+
+        if (map.size() != termsCnt)
+                throw Switch::data_error("Unexpected impacts contents");
+}
+
+ImpactOrdered::Index::Index(const char *const path)
+{
+        int fd = open(path, O_RDONLY | O_LARGEFILE);
+
+        if (fd == -1)
+                throw Switch::system_error("Failed to access ", path);
+
+        const auto fileSize = lseek64(fd, 0, SEEK_END);
+
+        if (fileSize == off64_t(-1) || !fileSize)
+        {
+                close(fd);
+                throw Switch::data_error("Failed to access ", path);
+        }
+
+        auto data = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+        close(fd);
+        if (data == MAP_FAILED)
+                throw Switch::data_error("Failed to access ", path);
+
+        fileData.Set(reinterpret_cast<const uint8_t *>(data), fileSize);
+
+        try
+        {
+                init(fileData);
+        }
+        catch (...)
+        {
+                munmap(data, fileSize);
+                throw;
+        }
+}
+
+ImpactOrdered::Index::~Index()
+{
+        if (auto ptr = (void *)(fileData.offset))
+                munmap(ptr, fileData.size());
+}
+
+void Trinity::ImpactOrdered::evaluate(const Index &index, const str8_t *const terms, const uint16_t termsCnt, const uint32_t k, const budget b,
+                                      IndexSource *const src, masked_documents_registry *const maskedDocumentsRegistry, evaluation *const out)
+{
+        // Accumulators are initialized lazily in pages, so that we won't need to reset all of them for every query.
+        // This is JASS's approach.
+        static constexpr uint32_t PageBits{12};
+        static constexpr uint32_t PageSize{1u << PageBits};
+        struct segment final
+        {
+                const Index::tier *tier;
+                uint16_t termIdx;
+        };
+        const uint32_t accumulatorsCnt = index.max_document_id() + 1;
+        const uint32_t pagesCnt = (accumulatorsCnt + PageSize - 1) >> PageBits;
+        std::vector<segment> segments;
+        std::vector<uint16_t> nextTier(termsCnt, 0);
+        std::vector<range_base<const Index::tier *, uint16_t>> termTiers;
+
+        out->top.clear();
+        out->postingsProcessed = 0;
+        out->remainingBound = 0;
+
+        for (uint16_t i{0}; i != termsCnt; ++i)
+        {
+                const auto tiers = index.term_tiers(terms[i]);
+
+                termTiers.push_back(tiers);
+                for (uint16_t t{0}; t != tiers.size(); ++t)
+                        segments.push_back({tiers.offset + t, i});
+        }
+
+        if (segments.empty() || !k)
+                return;
+
+        // Highest impact first
+        std::stable_sort(segments.begin(), segments.end(), [](const auto &a, const auto &b) noexcept {
+                return a.tier->impact > b.tier->impact;
+        });
+
+        std::unique_ptr<uint32_t[]> acc(new uint32_t[accumulatorsCnt]);
+        std::unique_ptr<uint64_t[]> initialized(new uint64_t[(pagesCnt + 63) / 64]());
+        const auto initializedPages = initialized.get();
+        const auto accumulators = acc.get();
+        // The budget is checked for every posting, not just between segments, because a single tier may hold most of a term's postings.
+        // We only check the deadline every DeadlineCheckInterval postings though, for Tick() is not free
+        static constexpr uint64_t DeadlineCheckInterval{4096};
+        const uint64_t maxPostings = b.maxPostings ?: std::numeric_limits<uint64_t>::max();
+        uint64_t processed{0};
+        uint32_t i{0};
+
+        for (const auto n = segments.size(); i != n; ++i)
+        {
+                const auto &s = segments[i];
+                const auto impact = s.tier->impact;
+                const auto *p = s.tier->data;
+                isrc_docid_t id{0};
+                uint32_t cnt = s.tier->documents;
+
+                for (; cnt; --cnt, ++processed)
+                {
+                        uint32_t delta;
+
+                        if (unlikely(processed == maxPostings))
+                                break;
+                        else if (b.deadline && !(processed & (DeadlineCheckInterval - 1)) && Timings::Microseconds::Tick() >= b.deadline)
+                                break;
+
+                        varbyte_get32(p, delta);
+                        id += delta;
+
+                        if (const auto page = id >> PageBits; !(initializedPages[page >> 6] & (uint64_t(1) << (page & 63))))
+                        {
+                                const auto from = page << PageBits;
+
+                                memset(accumulators + from, 0, std::min<uint32_t>(PageSize, accumulatorsCnt - from) * sizeof(uint32_t));
+                                initializedPages[page >> 6] |= uint64_t(1) << (page & 63);
+                        }
+
+                        accumulators[id] += impact;
+                }
+
+                if (cnt)
+                {
+                        // Stopped in the middle of the tier; nextTier[s.termIdx] still refers to it, so that
+                        // its impact is accounted for in remainingBound
+                        break;
+                }
+
+                ++nextTier[s.termIdx];
+        }
+
+        out->postingsProcessed = processed;
+
+        if (i != segments.size())
+        {
+                // Each term can contribute at most the impact of its highest impact tier we didn't process
+                for (uint16_t t{0}; t != termsCnt; ++t)
+                {
+                        if (nextTier[t] < termTiers[t].size())
+                                out->remainingBound += termTiers[t].offset[nextTier[t]].impact;
+                }
+        }
+
+        // Collect the top-k among all documents with a score
+        // We scan the initialized pages in order, so that documents are tested against the masked documents registry in ascending order
+        const auto requireDocIDTranslation = src->require_docid_translation();
+        auto &top = out->top;
+        const auto cmp = [](const auto &a, const auto &b) noexcept {
+                return a.second > b.second;
+        };
+
+        for (uint32_t page{0}; page != pagesCnt; ++page)
+        {
+                if (!(initializedPages[page >> 6] & (uint64_t(1) << (page & 63))))
+                        continue;
+
+                const auto from = page << PageBits;
+                const auto upto = std::min<uint32_t>(from + PageSize, accumulatorsCnt);
+
+                for (auto id = from; id != upto; ++id)
+                {
+                        const auto score = accumulators[id];
+
+                        if (!score || (top.size() == k && score <= top.front().second))
+                                continue;
+
+                        const docid_t globalDocID = requireDocIDTranslation ? src->translate_docid(id) : id;
+
+                        if (maskedDocumentsRegistry && maskedDocumentsRegistry->test(globalDocID))
+                                continue;
+
+                        if (top.size() == k)
+                        {
+                                std::pop_heap(top.begin(), top.end(), cmp);
+                                top.back() = {globalDocID, score};
+                        }
+                        else
+                                top.push_back({globalDocID, score});
+
+                        std::push_heap(top.begin(), top.end(), cmp);
+                }
+        }
+
+        std::sort_heap(top.begin(), top.end(), cmp);
+}
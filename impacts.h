@@ -0,0 +1,110 @@
+#pragma once
+#include "docidupdates.h"
+#include "index_source.h"
+#include "terms.h"
+#include <functional>
+
+namespace Trinity
+{
+        // Impact-ordered postings lists, for score-at-a-time evaluation.
+        //
+        // Document-at-a-time execution(exec_query() and the DocsSetSpan family) needs to consider all postings of the query terms.
+        // If instead each term's postings are grouped into tiers by their impact(i.e how much each contributes to the score of the document;
+        // for example, a quantized precomputed static score of the document like popularity), and tiers are processed in order of decreasing impact across
+        // all query terms, the highest scoring documents are found first, and evaluation can be stopped at any time, e.g once
+        // a postings or latency budget has been exhausted, with a bound on how far off the top-k can be.
+        //
+        // This is an optional, secondary, layout; it is built from an index source(see build()), persisted alongside it(e.g in the segment directory) and
+        // accessed via an Index, and evaluate() executes disjunctive queries against it.
+        namespace ImpactOrdered
+        {
+                // Returns the impact of a posting(document, term frequency in document), in [0, 255]
+                // Postings with impact 0 are not included in the impact-ordered postings lists.
+                using impact_func = std::function<uint8_t(const isrc_docid_t, const tokenpos_t)>;
+
+                // Builds impact-ordered postings for all terms provided by `terms`, using `src` to access their postings lists, and serializes them in out
+                //
+                // Serialized layout:
+                // [tiers docIDs, varbyte encoded deltas][directory][directory offset:u32, terms:u32, max document ID:u32]
+                // where for each term, the directory holds [term length:u8][term][tiers:u16] followed by (impact:u8, documents:u32, offset:u32) for each tier, in
+                // descending impact order
+                void build(IndexSource *src, IndexSourceTermsView *terms, const impact_func &impact, IOBuffer *out);
+
+                // Impacts based on the documents values for a DocValues numeric field(e.g popularity), linearly mapped to [1, 255] over the range of values the column can represent(see DocValues::Column::bits).
+                // Documents without a value are assigned impact 1
+                impact_func static_score_impacts(const DocValues::Column *c);
+
+                class Index final
+                {
+                      public:
+                        struct tier final
+                        {
+                                uint8_t impact;
+                                uint32_t documents;
+                                // varbyte encoded deltas
+                                const uint8_t *data;
+                        };
+
+                      private:
+                        range_base<const uint8_t *, std::size_t> fileData;
+                        isrc_docid_t maxDocID{0};
+                        std::vector<tier> tiers;
+                        // term => (index of its first tier in tiers[], tiers)
+                        ska::flat_hash_map<str8_t, std::pair<uint32_t, uint16_t>> map;
+
+                      private:
+                        void init(const range_base<const uint8_t *, std::size_t> content);
+
+                      public:
+                        // mmap()s the file at path
+                        Index(const char *path);
+
+                        ~Index();
+
+                        // Tiers of the term, in descending impact order
+                        range_base<const tier *, uint16_t> term_tiers(const str8_t term) const noexcept
+                        {
+                                if (const auto it = map.find(term); it != map.end())
+                                        return {tiers.data() + it->second.first, it->second.second};
+                                else
+                                        return {};
+                        }
+
+                        auto max_document_id() const noexcept
+                        {
+                                return maxDocID;
+                        }
+                };
+
+                struct budget final
+                {
+                        // Stop once that many postings have been processed(0 for no limit)
+                        uint64_t maxPostings{0};
+                        // Stop once Timings::Microseconds::Tick() >= deadline(0 for no deadline); checked every few thousand postings
+                        uint64_t deadline{0};
+                };
+
+                struct evaluation final
+                {
+                        // The top-k documents (translated if IndexSource::require_docid_translation()) and their scores, highest score first
+                        std::vector<std::pair<docid_t, uint32_t>> top;
+                        uint64_t postingsProcessed{0};
+                        // Evaluation was stopped before all postings were processed; the score of any document
+                        // may be underestimated by at most that much, and documents not in `top` can't have scored higher than
+                        // their reported score(or 0) + remainingBound. 0 if all postings were processed, in which case the results are exact.
+                        uint32_t remainingBound{0};
+
+                        inline bool exact() const noexcept
+                        {
+                                return remainingBound == 0;
+                        }
+                };
+
+                // Score-at-a-time evaluation of the disjunction of terms[0, termsCnt); the score of a document is the sum of its impacts
+                // for the terms. Tiers are processed in descending impact order until either all have been processed or the budget has been exhausted, which may happen in the middle of a tier.
+                //
+                // src is the index source the impact index was built for; masked documents(see maskedDocumentsRegistry) are excluded from the results.
+                void evaluate(const Index &index, const str8_t *terms, const uint16_t termsCnt, const uint32_t k, const budget b,
+                              IndexSource *src, masked_documents_registry *maskedDocumentsRegistry, evaluation *out);
+        }
+}
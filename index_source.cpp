@@ -16,6 +16,14 @@ void Trinity::IndexSourcesCollection::commit()
                 if (ud)
                         all.push_back(ud);
         }
+
+        // Build the union of the masked documents of all sources more recent than each source, so that
+        // the registry of a source will only need to probe a single set, instead of one scanner for each of them
+        unions.clear();
+        unionsStorage.clear();
+        unions.resize(all.size() + 1);
+        for (uint32_t i{1}; i <= all.size(); ++i)
+                unions[i] = docids_set::make_union(unions[i - 1], all[i - 1], &unionsStorage);
 }
 
 Trinity::IndexSourcesCollection::~IndexSourcesCollection()
@@ -31,5 +39,5 @@ std::unique_ptr<Trinity::masked_documents_registry> Trinity::IndexSourcesCollect
 {
 	const auto n = map[idx].second;
 
-	return masked_documents_registry::make(all.data(), n);
+	return masked_documents_registry::make(&unions[n]);
 }
@@ -1,5 +1,7 @@
 #pragma once
+#include "bigrams.h"
 #include "codecs.h"
+#include "docvalues.h"
 #include <ext/flat_hash_map.h>
 #include <mutex>
 #include <switch.h>
@@ -122,6 +124,13 @@ namespace Trinity
                         return docid_t(localId);
                 }
 
+                // The inverse of translate_docid(); returns the index source document ID of the document with the global `id`, or 0 if
+                // the document is not in this index source. Override it if you override translate_docid().
+                virtual isrc_docid_t index_source_docid(const docid_t id)
+                {
+                        return isrc_docid_t(id);
+                }
+
                 // factory method
                 // see RECIPES.md for when you should perhaps make use of the passed `term`
                 // See Codecs::Decoder::init() for execCtxTermID
@@ -133,6 +142,61 @@ namespace Trinity
                         return {};
                 }
 
+                // Override if you have per-document values; see DocValues
+                virtual const DocValues::Reader *doc_values()
+                {
+                        return nullptr;
+                }
+
+                // Value of the document for the docvalues `field`(the ordinal for String columns), where id is the document ID
+                // passed to MatchedIndexDocumentsFilter::consider(), i.e translated if require_docid_translation().
+                // Columns are keyed by index source document IDs, so use this instead of DocValues::Column::get() unless you know that no translation is involved.
+                bool doc_value(const str8_t field, const docid_t id, uint64_t *const out)
+                {
+                        if (const auto dv = doc_values())
+                        {
+                                if (const auto c = dv->column(field))
+                                {
+                                        if (const auto local = require_docid_translation() ? index_source_docid(id) : isrc_docid_t(id))
+                                                return c->get(local, out);
+                                }
+                        }
+
+                        return false;
+                }
+
+                // Documents of an index source may have been assigned IDs in the order of a DocValues numeric field, instead of
+                // in the order of the indexed document IDs(see SegmentIndexSession::set_index_sort()), so that documents are
+                // matched in that order.
+                //
+                // If you are only interested in the top-K documents by that same field, set MatchedIndexDocumentsFilter::limit to K
+                // and exec_query() will stop once it has collected K matches from such a source, because none of the remaining matches can rank higher.
+                struct index_sort final
+                {
+                        // empty if the documents are not ordered by any field
+                        str8_t field;
+                        bool descending{false};
+
+                        operator bool() const noexcept
+                        {
+                                return field.size();
+                        }
+                };
+
+                // Override if your documents are ordered by a field
+                virtual index_sort documents_order() const
+                {
+                        return {};
+                }
+
+                // Override if the index source indexed adjacent terms pairs as bigram terms(see SegmentIndexSession::set_bigrams())
+                // Returns the set of common terms that determines which pairs were indexed, so that
+                // phrases of two terms covered by the set are compiled to a lookup of their bigram term.
+                virtual const Bigrams::terms_set *indexed_bigrams() const
+                {
+                        return nullptr;
+                }
+
                 // Returns the maximum position expected
                 // you may want to override to provide a more accurate value
                 // This is used by the execution engine when creating a new DocWordsSpace
@@ -241,6 +305,9 @@ namespace Trinity
                 // for each source, we track how many of the first update_documents in all[]
                 // we should consider for masking documents
                 std::vector<std::pair<IndexSource *, uint16_t>> map;
+                // unions[i] is the union of all[0, i); see docids_set
+                std::vector<docids_set> unions;
+                std::vector<std::unique_ptr<uint64_t[]>> unionsStorage;
 
               public:
                 std::vector<IndexSource *> sources;
@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <text.h>
+#include <thread>
 
 using namespace Trinity;
 
@@ -22,16 +23,83 @@ void SegmentIndexSession::document_proxy::insert(const uint32_t termID, const to
 	positionOverlapsCnt += (position && position == lastPos);
 	lastPos = position;
 
+        hits.terms.push_back(termID);
+        hits.positions.push_back(position);
+
         if (const auto size = payload.size())
         {
                 const auto l = hitsBuf.size();
 
                 Drequire(size <= sizeof(uint64_t));
                 hitsBuf.serialize(payload.start(), size);
-                hits[termID & 15].push_back({termID, {position, {l, size}}});
+                hits.payloads.push_back({l, size});
         }
         else
-                hits[termID & 15].push_back({termID, {position, {0, 0}}});
+                hits.payloads.push_back({0, 0});
+}
+
+void SegmentIndexSession::set_bigrams(const Bigrams::terms_set &common)
+{
+        // Documents already committed were indexed without bigram terms, yet the persisted set would claim their pairs are covered,
+        // so phrases compiled to bigram lookups would no longer match them
+        if (b.size() || backingFileFD != -1)
+                throw Switch::data_error("Bigrams must be set before any documents are committed to the session");
+
+        bigrams.clear();
+        bigramsTermIDs.clear();
+        common.for_each([this](const str8_t term) {
+                bigrams.insert(term);
+                bigramsTermIDs.insert(term_id(term));
+        });
+}
+
+// Appends a hit(with no position) of the bigram term of every pair of adjacent terms covered by the bigrams set
+// There may be more than one term at the same position(e.g synonyms), in which case we pair all of them.
+void SegmentIndexSession::index_bigrams()
+{
+        const auto n = hits.size();
+        const auto hitTerms = hits.terms.data();
+        const auto hitPositions = hits.positions.data();
+        auto &v = bigramsHits;
+        char_t buf[Limits::MaxTermLength];
+
+        v.clear();
+        for (uint32_t i{0}; i != n; ++i)
+        {
+                if (hitPositions[i])
+                        v.push_back({hitPositions[i], hitTerms[i]});
+        }
+
+        // Terms are usually indexed in order
+        if (!std::is_sorted(v.begin(), v.end()))
+                std::sort(v.begin(), v.end());
+
+        for (uint32_t i{0}, next{0}, cnt = v.size(); i != cnt; ++i)
+        {
+                const auto pos = v[i].first;
+                const auto a = v[i].second;
+
+                // skip past the hits at this position; positions are ascending, so next only moves forward
+                if (next <= i)
+                        next = i + 1;
+                while (next != cnt && v[next].first == pos)
+                        ++next;
+
+                for (auto k = next; k != cnt && v[k].first == pos + 1; ++k)
+                {
+                        const auto b = v[k].second;
+
+                        if (!bigramsTermIDs.count(a) && !bigramsTermIDs.count(b))
+                                continue;
+
+                        if (const auto len = Bigrams::encode(term(a), term(b), buf))
+                        {
+                                hits.terms.push_back(term_id(str8_t(buf, len)));
+                                hits.positions.push_back(0);
+                                hits.payloads.push_back({0, 0});
+                        }
+                }
+        }
 }
 
 void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, const bool replace)
@@ -59,15 +127,38 @@ void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, cons
 	fs.reset();
 	fs.overlapsCnt = proxy.positionOverlapsCnt;	 // computed earlier
 
-	for (auto &v : hits)
+        if (bigramsTermIDs.size() && hits.size())
+                index_bigrams();
+
+        if (const auto n = hits.size())
         {
-                std::sort(v.begin(), v.end(), [](const auto &a, const auto &b) noexcept {
-                        return a.first < b.first || (a.first == b.first && a.second.first < b.second.first);
-                });
+                static_assert(sizeof(tokenpos_t) <= sizeof(uint16_t));
+                const auto hitTerms = hits.terms.data();
+                const auto hitPositions = hits.positions.data();
+                const auto hitPayloads = hits.payloads.data();
+                auto &order = hits.order;
+
+                order.resize(n);
+                for (uint32_t i{0}; i != n; ++i)
+                        order[i] = {(uint64_t(hitTerms[i]) << 16) | hitPositions[i], i};
 
-                for (const auto *p = v.data(), *const e = p + v.size(); p != e;)
+                if (n < 64)
                 {
-                        const auto term = p->first;
+                        std::sort(order.begin(), order.end(), [](const auto &a, const auto &b) noexcept {
+                                return a.first < b.first;
+                        });
+                }
+                else
+                {
+                        hits.orderTmp.resize(n);
+                        Trinity::Utilities::radix_sort(order.data(), hits.orderTmp.data(), n, [](const auto &it) noexcept {
+                                return it.first;
+                        });
+                }
+
+                for (const auto *p = order.data(), *const e = p + n; p != e;)
+                {
+                        const auto term = hitTerms[p->second];
                         uint32_t termHits{0};
                         uint32_t prev{0};
                         uint8_t prevPayloadSize{0xff};
@@ -82,14 +173,15 @@ void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, cons
 
                         do
                         {
-                                const auto &it = p->second;
-                                const auto delta = it.first - prev;
-                                const auto payloadSize = it.second.size();
+                                const auto position = hitPositions[p->second];
+                                const auto payload = hitPayloads[p->second];
+                                const auto delta = position - prev;
+                                const auto payloadSize = payload.size();
 
-				posHits += (it.first != 0);
+				posHits += (position != 0);
 
 
-                                prev = it.first;
+                                prev = position;
                                 if (payloadSize != prevPayloadSize)
                                 {
                                         b.encode_varbyte32((delta << 1) | 0);
@@ -103,10 +195,10 @@ void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, cons
                                 }
 
                                 if (payloadSize)
-                                        b.serialize(all_hits + it.second.start(), payloadSize);
+                                        b.serialize(all_hits + payload.start(), payloadSize);
 
                                 ++termHits;
-                        } while (++p != e && p->first == term);
+                        } while (++p != e && hitTerms[p->second] == term);
 
 			if (posHits)
                         {
@@ -121,8 +213,13 @@ void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, cons
                         ++terms;
                 }
 
-                v.clear();
+                if (rtState)
+                        track_realtime(proxy.did, replace);
+
+                hits.clear();
         }
+        else if (rtState)
+                track_realtime(proxy.did, replace);
 
         *(uint16_t *)(b.data() + offset) = terms; // total distinct terms for (document) XXX: see earlier comments
 
@@ -214,6 +311,9 @@ bool SegmentIndexSession::track(const isrc_docid_t documentID)
 	// that you have already committed(will throw an exception), enable this code block.
 	// The cost is neglible anwyay
 #if 1
+        if (sharedTracker)
+                return sharedTracker->try_track(documentID);
+
         static_assert(0 == (bank::SPAN & 1));
         const auto base = documentID & (~(bank::SPAN - 1));
         const auto normalized = documentID - base;
@@ -242,17 +342,174 @@ bool SegmentIndexSession::track(const isrc_docid_t documentID)
 #endif
 }
 
+bool docids_tracker::try_track(const isrc_docid_t documentID)
+{
+        // Consecutive IDs are assigned to different stripes; each stripe tracks the IDs with the same low bits, by (documentID / stripes)
+        const auto local = documentID / sizeof_array(stripes);
+        const auto base = local & (~(bank::SPAN - 1));
+        const auto normalized = local - base;
+        auto &s = stripes[documentID & (sizeof_array(stripes) - 1)];
+        std::lock_guard<std::mutex> g(s.lock);
+
+        for (auto it : s.banks)
+        {
+                if (it->base == base)
+                        return it->bs.try_set(normalized);
+        }
+
+        auto b = new bank();
+
+        s.banks.push_back(b);
+        b->base = base;
+        b->bs.set(normalized);
+        return true;
+}
+
+void docids_tracker::clear()
+{
+        for (auto &s : stripes)
+        {
+                std::lock_guard<std::mutex> g(s.lock);
+
+                while (s.banks.size())
+                {
+                        delete s.banks.back();
+                        s.banks.pop_back();
+                }
+        }
+}
+
 void SegmentIndexSession::erase(const isrc_docid_t documentID)
 {
         if (!track(documentID))
                 throw Switch::data_error("Already committed document ", documentID);
 
         updatedDocumentIDs.push_back(documentID);
+
+        if (rtState)
+                track_realtime(documentID, true);
+}
+
+SegmentIndexSession::realtime_state::term_postings *SegmentIndexSession::realtime_state::postings_for_update(const uint32_t termID)
+{
+        const auto idx = termID >> BlockBits;
+
+        if (idx >= MaxBlocks)
+                throw Switch::data_error("Too many distinct terms for realtime state");
+
+        auto b = blocks[idx].load(std::memory_order_relaxed);
+
+        if (!b)
+        {
+                b = new term_postings[1u << BlockBits];
+                blocks[idx].store(b, std::memory_order_release);
+        }
+
+        return b + (termID & ((1u << BlockBits) - 1));
+}
+
+term_hit *SegmentIndexSession::realtime_state::alloc_hits(const uint32_t n)
+{
+        static constexpr uint32_t BlockSize{16384};
+
+        if (hitsEnd - hitsCur < n)
+        {
+                const auto size = std::max(BlockSize, n);
+
+                hitsBlocks.emplace_back(new term_hit[size]);
+                hitsCur = hitsBlocks.back().get();
+                hitsEnd = hitsCur + size;
+        }
+
+        auto res = hitsCur;
+
+        hitsCur += n;
+        return res;
+}
+
+// Registers the document's hits(in the order sorted by commit_document_impl()) with
+// the realtime state, and publishes it
+//
+// Only this session's thread updates the state, so only the updates to the terms dictionary and updatedDocuments
+// need to hold the lock; readers only access postings up to the published term size and watermark.
+void SegmentIndexSession::track_realtime(const isrc_docid_t documentID, const bool replace)
+{
+        auto &rt = *rtState;
+        const auto hitTerms = hits.terms.data();
+        const auto hitPositions = hits.positions.data();
+        const auto hitPayloads = hits.payloads.data();
+        const auto all_hits = reinterpret_cast<const uint8_t *>(hitsBuf.data());
+        const auto seq = rt.watermark.load(std::memory_order_relaxed);
+
+        if (replace)
+        {
+                std::lock_guard<std::mutex> g(rt.lock);
+
+                rt.updatedDocuments.push_back({seq, documentID});
+        }
+
+        for (const auto *p = hits.order.data(), *const e = p + hits.order.size(); p != e;)
+        {
+                const auto term = hitTerms[p->second];
+                const auto *const first = p;
+
+                do
+                {
+                        ++p;
+                } while (p != e && hitTerms[p->second] == term);
+
+                const uint16_t hitsCnt = p - first;
+                auto th = rt.alloc_hits(hitsCnt);
+                auto *const pl = rt.postings_for_update(term);
+
+                for (uint32_t i{0}; i != hitsCnt; ++i)
+                {
+                        const auto idx = first[i].second;
+                        const auto payload = hitPayloads[idx];
+
+                        th[i].payload = 0;
+                        th[i].pos = hitPositions[idx];
+                        th[i].payloadLen = payload.size();
+                        if (th[i].payloadLen)
+                                memcpy(th[i].bytes(), all_hits + payload.start(), th[i].payloadLen);
+                }
+
+                const auto size = pl->size.load(std::memory_order_relaxed);
+
+                if (size % realtime_state::chunk::Capacity == 0)
+                {
+                        auto c = new realtime_state::chunk();
+
+                        rt.chunks.emplace_back(c);
+                        if (pl->tail)
+                                pl->tail->next = c;
+                        else
+                                pl->head = c;
+                        pl->tail = c;
+                }
+
+                pl->tail->postings[size % realtime_state::chunk::Capacity] = {documentID, seq, th, hitsCnt};
+
+                if (size && documentID <= pl->lastDocumentID && pl->firstUnorderedSeq.load(std::memory_order_relaxed) == UINT32_MAX)
+                        pl->firstUnorderedSeq.store(seq, std::memory_order_relaxed);
+                pl->lastDocumentID = documentID;
+
+                if (!size)
+                {
+                        std::lock_guard<std::mutex> g(rt.lock);
+
+                        rt.terms.insert({invDict[term], term});
+                }
+
+                pl->size.store(size + 1, std::memory_order_release);
+        }
+
+        rt.watermark.store(seq + 1, std::memory_order_release);
 }
 
 Trinity::SegmentIndexSession::document_proxy SegmentIndexSession::begin(const isrc_docid_t documentID)
 {
-	// XXX: hits[] is clear()ed in commit_document_impl()
+	// XXX: hits is clear()ed in commit_document_impl()
 	// so if you don't commit, you may end up with garbage.
         hitsBuf.clear();
         return {*this, documentID, hits, hitsBuf};
@@ -263,7 +520,7 @@ Trinity::SegmentIndexSession::document_proxy SegmentIndexSession::begin(const is
 // Callee is responsible for clos()ing indexFd
 //
 // Please note that it will invoke sess->end() for you
-void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs, Trinity::Codecs::IndexSession *const sess, std::vector<isrc_docid_t> &updatedDocumentIDs, int indexFd)
+void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs, Trinity::Codecs::IndexSession *const sess, std::vector<isrc_docid_t> &updatedDocumentIDs, int indexFd, const IndexSource::index_sort order)
 {
         if (sess->indexOut.size())
         {
@@ -299,6 +556,13 @@ void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs,
         b.serialize(codecID.data(), codecID.size());
 	b.pack(fs.sumTermHits, fs.totalTerms, fs.sumTermsDocs, fs.docsCnt);
 
+        if (order)
+        {
+                // optional; see IndexSource::documents_order()
+                b.pack(uint8_t(order.descending), order.field.size());
+                b.serialize(order.field.data(), order.field.size());
+        }
+
         if (write(fd, b.data(), b.size()) != b.size())
         {
                 close(fd);
@@ -310,7 +574,7 @@ void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs,
         sess->end();
 }
 
-void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs, Trinity::Codecs::IndexSession *const sess, std::vector<isrc_docid_t> &updatedDocumentIDs)
+void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs, Trinity::Codecs::IndexSession *const sess, std::vector<isrc_docid_t> &updatedDocumentIDs, const IndexSource::index_sort order)
 {
         auto path = Buffer{}.append(sess->basePath, "/index.t");
         int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_LARGEFILE | O_TRUNC, 0775);
@@ -322,7 +586,7 @@ void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs,
                 close(fd);
         });
 
-        persist_segment(fs, sess, updatedDocumentIDs, fd);
+        persist_segment(fs, sess, updatedDocumentIDs, fd, order);
 
         if (rename(path.c_str(), Buffer{}.append(strwlen32_t(path.data(), path.size() - 2)).c_str()) == -1)
                 throw Switch::system_error("Failed to persist index");
@@ -363,11 +627,17 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
                         close(indexFd);
         });
 
-        const auto scan = [ &defaultFieldStats = this->defaultFieldStats, flushFreq = this->flushFreq, indexFd, enc = enc_.get(), &map, sess ](const auto &ranges)
+        const uint32_t concurrency = commitConcurrency ? commitConcurrency : std::max<uint32_t>(1, std::thread::hardware_concurrency());
+        // If localDocIDs is set, globalIDs[localID] is the document ID indexed
+        // See set_local_docids()
+        std::vector<isrc_docid_t> globalIDs;
+        // If indexSort is set, toLocal[i] is the local ID assigned to globalIDs[i]
+        // See set_index_sort()
+        std::vector<isrc_docid_t> toLocal;
+        const auto scan = [ &defaultFieldStats = this->defaultFieldStats, flushFreq = this->flushFreq, indexFd, enc = enc_.get(), &map, sess, concurrency, localDocIDs = this->localDocIDs || this->indexSort, &globalIDs, &toLocal, indexSort = this->indexSort, &docValues = this->docValues ](const auto &ranges)
         {
                 uint8_t payloadSize;
                 std::vector<segment_data> all[32];
-                term_index_ctx tctx;
                 const auto R = ranges.data();
                 uint64_t before;
 
@@ -397,6 +667,8 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
                                 }
 
 				++defaultFieldStats.docsCnt;
+                                if (localDocIDs)
+                                        globalIDs.push_back(documentID);
 
                                 do
                                 {
@@ -428,21 +700,89 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
                 if (trace)
                         SLog(duration_repr(Timings::Microseconds::Since(before)), " to collect them\n");
 
+                if (localDocIDs)
+                {
+                        // 0 is not a valid document ID, so that local IDs will begin from 1
+                        globalIDs.push_back(0);
+                        std::sort(globalIDs.begin(), globalIDs.end());
+                }
+
+                if (indexSort)
+                {
+                        // Local IDs are assigned in the order of the documents values instead
+                        const uint32_t n = globalIDs.size();
+                        const auto ids = globalIDs.data();
+                        std::unique_ptr<uint64_t[]> keys(new uint64_t[n]);
+                        std::unique_ptr<bool[]> hasKey(new bool[n]());
+                        std::vector<uint32_t> order;
+
+                        if (const auto values = docValues.numeric_values(indexSort.field))
+                        {
+                                for (const auto &it : *values)
+                                {
+                                        const auto p = std::lower_bound(ids, ids + n, it.first);
+
+                                        if (p != ids + n && *p == it.first)
+                                        {
+                                                // if a value is set for the same document more than once, the last one set wins
+                                                keys[p - ids] = it.second;
+                                                hasKey[p - ids] = true;
+                                        }
+                                }
+                        }
+
+                        order.reserve(n);
+                        for (uint32_t i{1}; i < n; ++i)
+                                order.push_back(i);
+
+                        std::sort(order.begin(), order.end(), [k = keys.get(), h = hasKey.get(), descending = indexSort.descending](const auto a, const auto b) noexcept {
+                                if (h[a] != h[b])
+                                        return h[a];
+                                else if (h[a] && k[a] != k[b])
+                                        return descending ? k[a] > k[b] : k[a] < k[b];
+                                else
+                                        return a < b;
+                        });
+
+                        toLocal.resize(n);
+                        toLocal[0] = 0;
+                        for (uint32_t i{0}; i != order.size(); ++i)
+                                toLocal[order[i]] = i + 1;
+                }
+
                 {
                         // can sort those in parallel
                         // can't rely on std::execution::par, not available yet
                         // down to 2s from 10s, just by partitioning them and sorting them in parallel
+                        // and we now radix sort them instead of using std::sort()
                         std::vector<std::future<void>> futures;
 
                         before = Timings::Microseconds::Tick();
                         for (auto &v : all)
                         {
                                 futures.push_back(
-                                    std::async(std::launch::async, [](auto v) {
-                                            std::sort(v->begin(), v->end(), [](const auto &a, const auto &b) noexcept {
-                                                    return a.termID < b.termID || (a.termID == b.termID && a.documentID < b.documentID);
+                                    std::async(std::launch::async, [&globalIDs, &toLocal](auto v) {
+                                            if (const auto n = globalIDs.size())
+                                            {
+                                                    // translate to local IDs
+                                                    const auto ids = globalIDs.data();
+
+                                                    for (auto &it : *v)
+                                                            it.documentID = std::lower_bound(ids, ids + n, it.documentID) - ids;
+
+                                                    if (toLocal.size())
+                                                    {
+                                                            for (auto &it : *v)
+                                                                    it.documentID = toLocal[it.documentID];
+                                                    }
+                                            }
+
+                                            // radix sort by (termID, documentID)
+                                            std::unique_ptr<segment_data[]> tmp(new segment_data[v->size()]);
+
+                                            Trinity::Utilities::radix_sort(v->data(), tmp.get(), v->size(), [](const auto &it) noexcept {
+                                                    return (uint64_t(it.termID) << 32) | it.documentID;
                                             });
-
                                     },
                                                &v));
                         }
@@ -457,22 +797,18 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
                                 SLog(duration_repr(Timings::Microseconds::Since(before)), " to sort them\n");
                 }
 
-                before = Timings::Microseconds::Tick();
-                for (auto &v : all)
-                {
+                // Encodes the postings lists of all terms in partition `v` using `enc`, and
+                // invokes on_term() for every term encoded
+                const auto encode_partition = [R](const std::vector<segment_data> &v, Trinity::Codecs::Encoder *const enc, IndexSource::field_statistics &fs, auto &&on_term) {
+                        term_index_ctx tctx;
+                        uint8_t payloadSize;
+
                         for (const auto *it = v.data(), *const e = it + v.size(); likely(it != e);)
                         {
                                 const auto term = it->termID;
                                 isrc_docid_t prevDID{0};
                                 uint32_t _t;
 
-				// TODO:
-				// Maybe we need a new API which would allow us to encode terms individually, i.e use begin_term() to get
-				// hold of some identifier and buffer, and then begin_document() and new_hit() on that buffer, end then use end_term() with that buffer
-				// on the encoder to flush that term into the encoder. By doing so, and by serializing access to the encoding on end_term(), we would have been able
-				// to process/encode terms indepedently and take advantage of multiple cores.
-				// This is important because most the time's spent in encoding PFOR arrays
-
                                 enc->begin_term();
 
                                 do
@@ -484,7 +820,7 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
 
                                         require(documentID > prevDID);
 
-					defaultFieldStats.sumTermHits +=  hitsCnt;
+					fs.sumTermHits +=  hitsCnt;
 
                                         enc->begin_document(documentID);
                                         for (uint32_t i{0}; i != hitsCnt; ++i)
@@ -506,18 +842,95 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
                                         }
                                         enc->end_document();
 
-					++defaultFieldStats.sumTermsDocs;
+					++fs.sumTermsDocs;
 
                                         prevDID = documentID;
                                 } while (likely(++it != e) && it->termID == term);
 
                                 enc->end_term(&tctx);
-                                map.insert({term, tctx});
+				++fs.totalTerms;
 
-				++defaultFieldStats.totalTerms;
+                                on_term(term, tctx);
+                        }
+                };
 
-                                if (flushFreq && unlikely(sess->indexOut.size() > flushFreq))
-                                        sess->flush_index(indexFd);
+                before = Timings::Microseconds::Tick();
+                if (concurrency > 1 && (sess->caps & unsigned(Trinity::Codecs::IndexSession::Capabilities::ParallelEncode)))
+                {
+                        // Terms are independent, so we can encode each partition on its own thread, using a worker session
+                        // and an encoder of its own, and then append the worker sessions state to sess, and rebase the terms index chunks.
+                        // This used to be the bottleneck; most of the time is spent encoding (e.g PFOR) blocks.
+                        //
+                        // We process (concurrency) partitions at a time, so that we won't need to hold
+                        // every encoded postings list in memory, and so that we can still respect flushFreq.
+                        struct encoded_partition final
+                        {
+                                std::unique_ptr<Trinity::Codecs::IndexSession> ws;
+                                std::vector<uint32_t> terms;
+                                std::vector<term_index_ctx> tctxs;
+                                IndexSource::field_statistics fs;
+                        };
+                        encoded_partition partitions[sizeof_array(all)];
+                        std::vector<std::future<void>> futures;
+
+                        for (uint32_t base{0}; base < sizeof_array(all); base += concurrency)
+                        {
+                                const auto upto = std::min<uint32_t>(base + concurrency, sizeof_array(all));
+
+                                for (auto i{base}; i != upto; ++i)
+                                {
+                                        futures.push_back(
+                                            std::async(std::launch::async, [&encode_partition, sess](const auto *v, auto *out) {
+                                                    out->ws.reset(sess->new_worker_session());
+
+                                                    std::unique_ptr<Trinity::Codecs::Encoder> enc(out->ws->new_encoder());
+
+                                                    encode_partition(*v, enc.get(), out->fs, [out](const auto term, const auto &tctx) {
+                                                            out->terms.push_back(term);
+                                                            out->tctxs.push_back(tctx);
+                                                    });
+                                            },
+                                                       &all[i], partitions + i));
+                                }
+
+                                while (futures.size())
+                                {
+                                        futures.back().get();
+                                        futures.pop_back();
+                                }
+
+                                for (auto i{base}; i != upto; ++i)
+                                {
+                                        auto &it = partitions[i];
+                                        const auto n = it.terms.size();
+
+                                        sess->append_worker_session(it.ws.get(), it.tctxs.data(), n);
+                                        for (uint32_t k{0}; k != n; ++k)
+                                                map.insert({it.terms[k], it.tctxs[k]});
+
+                                        defaultFieldStats.sumTermHits += it.fs.sumTermHits;
+                                        defaultFieldStats.sumTermsDocs += it.fs.sumTermsDocs;
+                                        defaultFieldStats.totalTerms += it.fs.totalTerms;
+
+                                        it.ws.reset();
+                                        std::vector<uint32_t>().swap(it.terms);
+                                        std::vector<term_index_ctx>().swap(it.tctxs);
+
+                                        if (flushFreq && unlikely(sess->indexOut.size() > flushFreq))
+                                                sess->flush_index(indexFd);
+                                }
+                        }
+                }
+                else
+                {
+                        for (const auto &v : all)
+                        {
+                                encode_partition(v, enc, defaultFieldStats, [&map, sess, flushFreq, indexFd](const auto term, const auto &tctx) {
+                                        map.insert({term, tctx});
+
+                                        if (flushFreq && unlikely(sess->indexOut.size() > flushFreq))
+                                                sess->flush_index(indexFd);
+                                });
                         }
                 }
                 if (trace)
@@ -561,6 +974,46 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
                 scan(ranges);
 
 
+        if (toLocal.size())
+        {
+                // local => global, in the order of the local IDs
+                std::vector<isrc_docid_t> ids(globalIDs.size());
+
+                for (uint32_t i{0}; i != globalIDs.size(); ++i)
+                        ids[toLocal[i]] = globalIDs[i];
+
+                if (Trinity::Utilities::to_file(reinterpret_cast<const char *>(ids.data()), ids.size() * sizeof(isrc_docid_t), Buffer{}.append(sess->basePath, "/docids").c_str()) == -1)
+                        throw Switch::system_error("Failed to persist document IDs");
+        }
+        else if (globalIDs.size() > 1)
+        {
+                if (Trinity::Utilities::to_file(reinterpret_cast<const char *>(globalIDs.data()), globalIDs.size() * sizeof(isrc_docid_t), Buffer{}.append(sess->basePath, "/docids").c_str()) == -1)
+                        throw Switch::system_error("Failed to persist document IDs");
+        }
+
+        if (!docValues.empty())
+        {
+                IOBuffer docValuesBuf;
+
+                if (globalIDs.size() > 1)
+                        docValues.serialize(&docValuesBuf, globalIDs.data(), globalIDs.size(), toLocal.size() ? toLocal.data() : nullptr);
+                else
+                        docValues.serialize(&docValuesBuf);
+
+                docValues.clear();
+                if (Trinity::Utilities::to_file(docValuesBuf.data(), docValuesBuf.size(), Buffer{}.append(sess->basePath, "/docvalues").c_str()) == -1)
+                        throw Switch::system_error("Failed to persist docvalues");
+        }
+
+        if (!bigrams.empty())
+        {
+                IOBuffer bigramsBuf;
+
+                bigrams.serialize(&bigramsBuf);
+                if (Trinity::Utilities::to_file(bigramsBuf.data(), bigramsBuf.size(), Buffer{}.append(sess->basePath, "/bigrams").c_str()) == -1)
+                        throw Switch::system_error("Failed to persist bigrams");
+        }
+
         // Persist terms dictionary
         std::vector<std::pair<str8_t, term_index_ctx>> v;
         size_t sum{0};
@@ -584,7 +1037,7 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
         before = Timings::Microseconds::Tick();
 
         sess->persist_terms(v);
-        persist_segment(defaultFieldStats, sess, updatedDocumentIDs, indexFd);
+        persist_segment(defaultFieldStats, sess, updatedDocumentIDs, indexFd, toLocal.size() ? indexSort : IndexSource::index_sort{});
 
         if (trace)
                 SLog(duration_repr(Timings::Microseconds::Since(before)), " to persist segment\n");
@@ -605,3 +1058,67 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
         if (rename(path.c_str(), Buffer{}.append(strwlen32_t(path.data(), path.size() - 2)).c_str()) == -1)
                 throw Switch::system_error("Failed to persist index");
 }
+
+ConcurrentSegmentIndexSession::ConcurrentSegmentIndexSession(const uint16_t writersCnt)
+{
+        require(writersCnt);
+
+        writers.reserve(writersCnt);
+        for (uint32_t i{0}; i != writersCnt; ++i)
+                writers.push_back(nullptr);
+
+        reset();
+}
+
+ConcurrentSegmentIndexSession::~ConcurrentSegmentIndexSession()
+{
+        for (auto it : writers)
+                delete it;
+}
+
+void ConcurrentSegmentIndexSession::reset()
+{
+        for (auto &it : writers)
+        {
+                delete it;
+                it = new SegmentIndexSession();
+                it->set_docids_tracker(&tracker);
+        }
+
+        tracker.clear();
+}
+
+void ConcurrentSegmentIndexSession::commit(std::function<Trinity::Codecs::IndexSession *(const uint16_t)> new_session)
+{
+        std::vector<std::future<void>> futures;
+        std::vector<std::pair<uint16_t, Trinity::Codecs::IndexSession *>> sessions;
+
+        for (uint32_t i{0}; i != writers.size(); ++i)
+        {
+                if (writers[i]->any_indexed())
+                        sessions.push_back({i, new_session(i)});
+        }
+
+        // Each writer's commit() may itself encode in parallel, so we need to
+        // account for that to avoid oversubscription
+        const uint32_t concurrency = std::max<uint32_t>(1, std::thread::hardware_concurrency() / std::max<uint32_t>(1, sessions.size()));
+
+        for (const auto &it : sessions)
+        {
+                auto w = writers[it.first];
+
+                w->set_commit_concurrency(concurrency);
+                futures.push_back(std::async(std::launch::async, [w](auto sess) {
+                        w->commit(sess);
+                },
+                                             it.second));
+        }
+
+        while (futures.size())
+        {
+                futures.back().get();
+                futures.pop_back();
+        }
+
+        reset();
+}
@@ -1,22 +1,67 @@
 #pragma once
+#include "bigrams.h"
 #include "codecs.h"
+#include "docvalues.h"
 #include "index_source.h"
+#include "numeric_terms.h"
 #include <buffer.h>
 #include <switch_dictionary.h>
 #include <switch_mallocators.h>
 #include <switch_bitops.h>
 #include <sparsefixedbitset.h>
 #include <ext/flat_hash_map.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 namespace Trinity
 {
         // Persists an index sesion as a segment
         // The application is responsible for persisting the terms (see SegmentIndexSession::commit() 
 	// for example, and IndexSession::persist_terms())
-        void persist_segment(const IndexSource::field_statistics &, Trinity::Codecs::IndexSession *const sess, std::vector<uint32_t> &updatedDocumentIDs, int fd);
+        // If the segment's documents were assigned IDs in the order of a field, pass it in `order`; see IndexSource::documents_order()
+        void persist_segment(const IndexSource::field_statistics &, Trinity::Codecs::IndexSession *const sess, std::vector<uint32_t> &updatedDocumentIDs, int fd, const IndexSource::index_sort order = {});
 
 	// Wrapper for persist_segment(); opens the index file and passes it to persist_segment()
-        void persist_segment(const IndexSource::field_statistics &, Trinity::Codecs::IndexSession *const sess, std::vector<uint32_t> &updatedDocumentIDs);
+        void persist_segment(const IndexSource::field_statistics &, Trinity::Codecs::IndexSession *const sess, std::vector<uint32_t> &updatedDocumentIDs, const IndexSource::index_sort order = {});
+
+        // Tracks document IDs indexed or erased by multiple SegmentIndexSession, which may be
+        // accessed by different threads concurrently. See ConcurrentSegmentIndexSession
+        //
+        // IDs are partitioned into stripes by their low bits, each stripe with its own lock and banks, so that
+        // threads won't contend for the same lock even when they are indexing documents with consecutive IDs(dense ingest).
+        class docids_tracker final
+        {
+              private:
+                struct bank
+                {
+                        static constexpr std::size_t SPAN{1 << 20};
+
+                        SparseFixedBitSet bs{SPAN};
+                        isrc_docid_t base;
+                };
+
+                // Each on its own cache line, so that the locks won't be falsely shared
+                struct alignas(64) stripe final
+                {
+                        std::mutex lock;
+                        std::vector<bank *> banks;
+                };
+
+                stripe stripes[64];
+
+              public:
+                // Returns false if documentID has already been tracked
+                bool try_track(const isrc_docid_t documentID);
+
+                void clear();
+
+                ~docids_tracker()
+                {
+                        clear();
+                }
+        };
 
         // A utility class suitable for indexing document terms and persisting the index and other codec specifc data into a directory
         // It offers a simple API for adding, replacing and erasing documents.
@@ -78,9 +123,33 @@ namespace Trinity
                 IOBuffer b;
                 IOBuffer hitsBuf;
                 int backingFileFD{-1};
-                // by partitioning in hits based on term we save about 2s in a previous runtime of 39s down to 37s
-                // maybe we can use radix sort there?
-                std::vector<std::pair<uint32_t, std::pair<uint32_t, range_base<uint32_t, uint8_t>>>> hits[16];
+                // Hits of the document being indexed, tracked in columns.
+                // We used to track them in 16 vectors of (termID, (position, payload)), partitioned by term, and std::sort() those
+                // but radix sorting (termID, position) keys is faster and we don't need to partition them. See commit_document_impl()
+                struct hits_columns final
+                {
+                        std::vector<uint32_t> terms;
+                        std::vector<tokenpos_t> positions;
+                        std::vector<range_base<uint32_t, uint8_t>> payloads;
+
+                        // ((termID << 16) | position, hit index)
+                        // sorted by commit_document_impl()
+                        std::vector<std::pair<uint64_t, uint32_t>> order, orderTmp;
+
+                        auto size() const noexcept
+                        {
+                                return terms.size();
+                        }
+
+                        void clear()
+                        {
+                                terms.clear();
+                                positions.clear();
+                                payloads.clear();
+                                order.clear();
+                        }
+                } hits;
+
                 std::vector<isrc_docid_t> updatedDocumentIDs;
                 simple_allocator dictionaryAllocator;
                 // flat_hash_map<> is about 11% faster than alternative dictionaries
@@ -89,6 +158,112 @@ namespace Trinity
                 ska::flat_hash_map<uint32_t, str8_t> invDict;
                 //See IndexSession::indexOutFlushed comments
                 uint32_t flushFreq{0}, intermediateStateFlushFreq{0};
+                // See set_commit_concurrency()
+                uint32_t commitConcurrency{0};
+                // See set_local_docids()
+                bool localDocIDs{false};
+                // See set_index_sort()
+                IndexSource::index_sort indexSort;
+                // See set_docids_tracker()
+                docids_tracker *sharedTracker{nullptr};
+                // See document_proxy::set_value()
+                DocValues::Writer docValues;
+                // See set_bigrams()
+                Bigrams::terms_set bigrams;
+                ska::flat_hash_set<uint32_t> bigramsTermIDs;
+                // (position, termID) of the hits of the document being indexed; see index_bigrams()
+                std::vector<std::pair<tokenpos_t, uint32_t>> bigramsHits;
+
+              public:
+                // Near real-time search support; see enable_realtime() and RealtimeIndexSource
+                //
+                // If enabled, in addition to serializing documents for commit(), we also track
+                // in-memory postings lists for every term, so that queries can be executed against the
+                // documents that have not been committed yet.
+                //
+                // Every committed(insert(), replace() or erase()) document is assigned a sequence number, and RealtimeIndexSource
+                // only considers documents with sequence number lower than the `watermark` at the time it was created, so that it
+                // sees a consistent snapshot of the session's state, regardless of documents indexed afterwards.
+                //
+                // Postings and hits are only ever appended, into chunks and blocks that are never moved or modified once written, and
+                // each term's size is published(release) after its postings have been written, so readers access them without holding the lock.
+                // The lock only guards the terms dictionary and updatedDocuments.
+                struct realtime_state final
+                {
+                        struct posting final
+                        {
+                                isrc_docid_t documentID;
+                                uint32_t seq;
+                                const term_hit *hits;
+                                uint16_t hitsCnt;
+                        };
+
+                        struct chunk final
+                        {
+                                static constexpr uint32_t Capacity{128};
+
+                                posting postings[Capacity];
+                                chunk *next{nullptr};
+                        };
+
+                        // A term's postings list, in the order documents were committed(i.e by seq)
+                        struct term_postings final
+                        {
+                                chunk *head{nullptr}, *tail{nullptr};
+                                std::atomic<uint32_t> size{0};
+                                // seq of the first posting with a document ID not higher than that of its previous posting
+                                std::atomic<uint32_t> firstUnorderedSeq{UINT32_MAX};
+                                isrc_docid_t lastDocumentID{0};
+                        };
+
+                        // Up to (MaxBlocks << BlockBits) terms
+                        static constexpr uint32_t BlockBits{12};
+                        static constexpr uint32_t MaxBlocks{4096};
+
+                        // Held by the session while updating terms or updatedDocuments, and
+                        // by RealtimeIndexSource when accessing them
+                        std::mutex lock;
+                        // term => termID
+                        ska::flat_hash_map<str8_t, uint32_t> terms;
+                        // (seq, documentID) of every document replaced or erased
+                        std::vector<std::pair<uint32_t, isrc_docid_t>> updatedDocuments;
+                        std::atomic<uint32_t> watermark{0};
+
+                        // The postings list of termID is blocks[termID >> BlockBits][termID & ((1 << BlockBits) - 1)]
+                        std::atomic<term_postings *> blocks[MaxBlocks]{};
+                        // owned by the session
+                        std::vector<std::unique_ptr<chunk>> chunks;
+                        std::vector<std::unique_ptr<term_hit[]>> hitsBlocks;
+                        term_hit *hitsCur{nullptr}, *hitsEnd{nullptr};
+
+                        const term_postings *postings(const uint32_t termID) const noexcept
+                        {
+                                const auto idx = termID >> BlockBits;
+
+                                if (idx >= sizeof_array(blocks))
+                                        return nullptr;
+                                else if (const auto b = blocks[idx].load(std::memory_order_acquire))
+                                        return b + (termID & ((1u << BlockBits) - 1));
+                                else
+                                        return nullptr;
+                        }
+
+                        term_postings *postings_for_update(const uint32_t termID);
+
+                        term_hit *alloc_hits(const uint32_t n);
+
+                        ~realtime_state()
+                        {
+                                for (auto &b : blocks)
+                                        delete[] b.load();
+                        }
+                };
+
+              private:
+                std::unique_ptr<realtime_state> rtState;
+
+              private:
+                void track_realtime(const isrc_docid_t documentID, const bool replace);
 
               public:
 	      	// Check https://www.ebayinc.com/stories/blogs/tech/making-e-commerce-search-faster/
@@ -97,7 +272,7 @@ namespace Trinity
                 {
                         SegmentIndexSession &sess;
                         const isrc_docid_t did;
-                        std::vector<std::pair<uint32_t, std::pair<uint32_t, range_base<uint32_t, uint8_t>>>> *hits;
+                        hits_columns &hits;
                         IOBuffer &hitsBuf;
                         tokenpos_t lastPos;
                         uint16_t positionOverlapsCnt;
@@ -107,7 +282,7 @@ namespace Trinity
                                 return sess.term_id(term);
                         }
 
-                        document_proxy(SegmentIndexSession &s, isrc_docid_t documentID, std::vector<std::pair<uint32_t, std::pair<uint32_t, range_base<uint32_t, uint8_t>>>> *h, IOBuffer &hb)
+                        document_proxy(SegmentIndexSession &s, isrc_docid_t documentID, hits_columns &h, IOBuffer &hb)
                             : sess{s}, did{documentID}, hits{h}, hitsBuf{hb}, lastPos{0}, positionOverlapsCnt{0}
                         {
                         }
@@ -152,11 +327,34 @@ namespace Trinity
 
                                 insert(termID, pos, {reinterpret_cast<const uint8_t *>(&payload), requiredBytes});
                         }
+
+                        // Indexes `value` for the numeric `field` as trie-encoded terms, so that it can be matched by
+                        // ast_node::Type::NumericRange nodes. See NumericTerms::from_signed() for signed values
+                        void insert_numeric(const str8_t field, const uint64_t value)
+                        {
+                                NumericTerms::for_value(field, value, [this](const str8_t term) {
+                                        insert(term, 0);
+                                });
+                        }
+
+                        // Sets the document's value for `field`; see DocValues
+                        // All values of a field must be of the same type
+                        void set_value(const str8_t field, const uint64_t value)
+                        {
+                                sess.docValues.set(did, field, value);
+                        }
+
+                        void set_value(const str8_t field, const str8_t value)
+                        {
+                                sess.docValues.set(did, field, value);
+                        }
                 };
 
               private:
                 void commit_document_impl(const document_proxy &proxy, const bool replace);
 
+                void index_bigrams();
+
                 bool track(const isrc_docid_t);
 
               public:
@@ -186,6 +384,86 @@ namespace Trinity
                         intermediateStateFlushFreq = n;
                 }
 
+                // If the codec supports Capabilities::ParallelEncode, commit() will encode the
+                // terms postings lists using up to that many threads.
+                // 0(default) means std::thread::hardware_concurrency(), 1 disables parallel encoding
+                void set_commit_concurrency(const uint32_t n)
+                {
+                        commitConcurrency = n;
+                }
+
+                // If set, commit() will not encode the document IDs you indexed in the postings lists, but instead
+                // will assign dense, segment-local, IDs (1 ... total documents), in the same order as the indexed document IDs, and
+                // will persist the map from local to indexed IDs in the segment's docids file, which SegmentIndexSource will use
+                // to translate_docid() during execution.
+                //
+                // This is useful if the document IDs are sparse; smaller deltas mean smaller postings lists, and
+                // e.g LUCENE_ENCODE_FREQ1_DOCDELTA can be used because local IDs will never be higher than (DocIDsEND >> 1).
+                // Masked documents(i.e updated or erased documents) are not affected; they are always in the global space.
+                //
+                // MergeCandidatesCollection::merge() translates local IDs to global IDs(it reads the segment's docids file via the candidate's AccessProxy::basePath), so
+                // merged segments are always in the global space, and merging such segments is slower, because the codec's fast paths can't be used for them.
+                void set_local_docids(const bool v)
+                {
+                        localDocIDs = v;
+                }
+
+                // If set, commit() will assign segment-local document IDs(see set_local_docids()) in the order of the documents
+                // values for the DocValues numeric `field`(see document_proxy::set_value()), instead of in the order of the indexed
+                // document IDs. Documents with no value for the field are assigned the highest local IDs, and documents with the same
+                // value are ordered by their indexed IDs.
+                //
+                // The order is persisted in the segment(see IndexSource::documents_order()), so that queries that
+                // only need the top-K documents by the same field can stop after they have matched K documents in the segment.
+                //
+                // Translated(global) document IDs will no longer be ascending in the order documents are matched. A masked_documents_registry
+                // that tests against scanners rewinds them whenever a lower ID is tested, so you should prefer a registry that tests against a merged
+                // set(see IndexSourcesCollection::scanner_registry_for()).
+                //
+                // MergeCandidatesCollection::merge() translates local IDs to global IDs(see set_local_docids()), so the order is not preserved in merged segments
+                void set_index_sort(const str8_t field, const bool descending = false)
+                {
+                        if (field.empty())
+                                indexSort = {};
+                        else
+                        {
+                                indexSort.field.Set(dictionaryAllocator.CopyOf(field.data(), field.size()), field.size());
+                                indexSort.descending = descending;
+                        }
+                }
+
+                // Enables the next-word index(see Bigrams); for every two adjacent terms of a document(hits at positions p and p + 1) where
+                // either of them is in `common`, the pair is also indexed as a single term, so that phrases of those two terms can be
+                // compiled to a lookup of that term instead(see compile_query()). Phrases are not compiled to bigram lookups if
+                // ExecFlags::AccumulatedScoreScheme is set, because the bigram term would contribute to the score.
+                //
+                // The set is persisted in the segment(see IndexSource::indexed_bigrams()); you must invoke this before you commit any documents,
+                // otherwise Switch::data_error is thrown.
+                // Bigram terms are indexed with no position, so they don't affect the documents field statistics.
+                //
+                // XXX: MergeCandidatesCollection::merge() does not preserve the set, so merged segments will not use their bigram terms
+                void set_bigrams(const Bigrams::terms_set &common);
+
+                // If set, documents IDs will be tracked by `t`, which can be shared among
+                // many sessions, instead of by this session. See ConcurrentSegmentIndexSession
+                void set_docids_tracker(docids_tracker *const t)
+                {
+                        sharedTracker = t;
+                }
+
+                // Enables near real-time search support. See realtime_state
+                // You should invoke this before you index any documents.
+                void enable_realtime()
+                {
+                        if (!rtState)
+                                rtState.reset(new realtime_state());
+                }
+
+                auto realtime() noexcept
+                {
+                        return rtState.get();
+                }
+
                 void erase(const isrc_docid_t documentID);
 
                 // After you have obtained a document_proxy, you can use its insert methods to register term hits
@@ -221,7 +499,7 @@ namespace Trinity
 
                 auto any_indexed() const noexcept
                 {
-                        return backingFileFD != -1 || hitsBuf.size() || b.size() || updatedDocumentIDs.size();
+                        return backingFileFD != -1 || hitsBuf.size() || b.size() || updatedDocumentIDs.size() || !docValues.empty();
                 }
 
                 ~SegmentIndexSession()
@@ -235,4 +513,44 @@ namespace Trinity
                         }
                 }
         };
+
+        // Many threads can index documents concurrently; each thread should use its own writer(), i.e its own SegmentIndexSession
+        // with its own terms dictionary and state, and the writers will share a docids_tracker so that a document
+        // can only be inserted, replaced or erased once, by any writer, which is required in order to retain
+        // the semantics of replace() and erase() across the segments the writers are committed to.
+        //
+        // commit() will commit each writer's state into a different segment, in parallel.
+        // You can then merge those segments(see MergeCandidatesCollection) if you need to.
+        class ConcurrentSegmentIndexSession final
+        {
+              private:
+                docids_tracker tracker;
+                std::vector<SegmentIndexSession *> writers;
+
+              private:
+                void reset();
+
+              public:
+                ConcurrentSegmentIndexSession(const uint16_t writersCnt);
+
+                ~ConcurrentSegmentIndexSession();
+
+                auto writers_count() const noexcept
+                {
+                        return writers.size();
+                }
+
+                // Must only be accessed by one thread at a time
+                SegmentIndexSession *writer(const uint16_t idx)
+                {
+                        return writers[idx];
+                }
+
+                // For each writer that has any indexed state, new_session() is invoked with the writer's index and
+                // is expected to return the codec session to commit it to. Each must have a different basePath (i.e generation).
+                // You own the returned sessions; they are not needed after commit() returns.
+                //
+                // All writers are reset(and can be used for indexing new documents) once this method returns
+                void commit(std::function<Trinity::Codecs::IndexSession *(const uint16_t)> new_session);
+        };
 }
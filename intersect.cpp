@@ -1,12 +1,19 @@
 #include "intersect.h"
+#include <atomic>
 #include <ext/flat_hash_map.h>
+#include <future>
 
 using namespace Trinity;
 
 void Trinity::intersect_impl(const uint64_t stopwordsMask,
                              const std::vector<std::unordered_set<str8_t>> &tokens,
-                             IndexSource *__restrict__ const src, masked_documents_registry *const __restrict__ maskedDocumentsRegistry, std::vector<std::pair<uint64_t, uint32_t>> *const out)
+                             IndexSource *__restrict__ const src, masked_documents_registry *const __restrict__ maskedDocumentsRegistry, std::vector<std::pair<uint64_t, uint32_t>> *const out,
+                             const uint32_t samplingRate)
 {
+        // The sampled windows phase is rotated across calls, so that repeated estimates don't all share the same bias
+        static std::atomic<uint32_t> nextPhase{0};
+        const uint32_t sampling = samplingRate ?: 1;
+        const uint32_t phase = sampling > 1 ? nextPhase.fetch_add(1, std::memory_order_relaxed) % sampling : 0;
 
         static constexpr bool trace{false};
         struct tracked
@@ -50,177 +57,205 @@ void Trinity::intersect_impl(const uint64_t stopwordsMask,
 
         if (!rem)
                 return;
-	
-	if (anyUnknown)
-		origMask = 0;
-		
 
+        if (anyUnknown)
+                origMask = 0;
+
+        // Documents are processed in windows of SIZE document IDs, like DocsSetSpan does.
+        // For each window, we OR the tokens mask of each iterator into masks[] for the documents it matches in it, tracking
+        // the matched documents in a bitmap, and then we consider the matched documents in ascending order.
+        // Their translated IDs(see IndexSource::translate_docid()) are not necessarily ascending though, e.g for index-sorted segments, in which case
+        // we rely on the masked documents registry rewinding its scanners(see masked_documents_registry::rewind()).
+        // This is far cheaper than looking for the lowest document ID among all iterators for every matched document.
+        //
+        // Windows are aligned to SIZE. If sampling > 1, only every sampling-th window, starting from window `phase`, is considered(systematic sampling), and
+        // the iterators advance() past the others using their skiplists.
+        static constexpr std::size_t SHIFT{13};
+        static constexpr std::size_t SIZE{1 << SHIFT};
+        static constexpr std::size_t SET_SIZE{SIZE / 64};
+        std::unique_ptr<uint64_t[]> masksStorage(new uint64_t[SIZE]());
+        uint64_t matched[SET_SIZE]{0};
+        const auto masks = masksStorage.get();
+        // mask => number of documents that matched exactly the tokens in mask
+        ska::flat_hash_map<uint64_t, uint32_t> histogram;
+        const auto before = Timings::Microseconds::Tick();
+        // the registry tracks global document IDs
+        const bool requireDocIDTranslation = src->require_docid_translation();
 
-        struct ctx
+        while (rem)
         {
-                uint64_t mapPrev{0};
-                uint8_t indexPrev{0};
+                isrc_docid_t lowest = remaining[0].it->curDocument.id;
 
-                struct match
-                {
-                        uint64_t v;
-                        uint32_t cnt;
-                };
+                for (uint16_t i{1}; i != rem; ++i)
+                        lowest = std::min(lowest, remaining[i].it->curDocument.id);
 
-                std::vector<match> matches;
+                const isrc_docid_t base = lowest & ~isrc_docid_t(SIZE - 1);
 
-                void consider(const uint64_t map)
+                if (const uint64_t w = base >> SHIFT; sampling > 1 && w % sampling != phase)
                 {
-                        if (map == mapPrev)
-                                ++matches[indexPrev].cnt;
-                        else
+                        // the next sampled window
+                        const auto r = w % sampling;
+                        const auto target = (w - r + phase + (r < phase ? 0 : sampling)) << SHIFT;
+
+                        if (target >= DocIDsEND)
+                                break;
+
+                        for (uint16_t i{0}; i < rem;)
                         {
-                                auto matchesCnt = matches.size();
-                                auto all = matches.data();
+                                auto &t = remaining[i];
 
-                                mapPrev = map;
-                                for (uint8_t i{0}; i < matchesCnt;)
+                                if (t.it->curDocument.id < target && t.it->advance(target) == DocIDsEND)
                                 {
-#if 1
-                                        if (const auto v = all[i].v; (v & map) == map)
-                                        {
-                                                // [wars jedi] [star wars jedi]
-                                                if (map == v)
-                                                        ++all[i].cnt;
-                                                indexPrev = i;
-                                                return;
-                                        }
-                                        else if ((map & v) == v)
-                                        {
-                                                // [star wars return jedi] [wars jedi]
-                                                matches[i] = matches.back();
-                                                matches.pop_back();
-                                                --matchesCnt;
-                                        }
-#else
-                                        if (all[i].v == map)
-                                        {
-                                                ++all[i].cnt;
-                                                indexPrev = i;
-                                                return;
-                                        }
-#endif
-                                        else
-                                                ++i;
+                                        delete t.it;
+                                        delete t.dec;
+                                        t = remaining[--rem];
                                 }
-
-                                indexPrev = matchesCnt;
-                                matches.push_back({map, 1});
+                                else
+                                        ++i;
                         }
+                        continue;
                 }
 
-                void finalize()
+                const auto upto = std::min<uint64_t>(uint64_t(base) + SIZE, DocIDsEND);
+
+                for (uint16_t i{0}; i < rem;)
                 {
-                        std::sort(matches.begin(), matches.end(), [](const auto &a, const auto &b) noexcept {
-                                const auto r = int8_t(SwitchBitOps::PopCnt(b.v)) - int8_t(SwitchBitOps::PopCnt(a.v));
+                        auto &t = remaining[i];
+                        const auto m = uint64_t(1) << t.tokenIdx;
+                        auto id = t.it->curDocument.id;
 
-                                return r < 0 || (!r && b.cnt < a.cnt);
-                        });
-                }
-        };
+                        for (; id < upto; id = t.it->next())
+                        {
+                                const auto rel = id - base;
 
-        uint16_t selected[sizeof_array(remaining)];
-        ctx c;
-        const auto before = Timings::Microseconds::Tick();
+                                masks[rel] |= m;
+                                matched[rel >> 6] |= uint64_t(1) << (rel & 63);
+                        }
 
-	// TODO: use Switch::priority_queue<>
-        for (;;)
-        {
-                uint16_t cnt{1};
-                isrc_docid_t lowest;
-                const auto &it = remaining[0];
-                uint64_t mask = uint64_t(1u) << it.tokenIdx;
-                uint8_t first{0}, last{0};
-
-                selected[0] = 0;
-                lowest = it.it->curDocument.id;
-                for (uint32_t i{1}; i != rem; ++i)
+                        if (id == DocIDsEND)
+                        {
+                                delete t.it;
+                                delete t.dec;
+                                t = remaining[--rem];
+                        }
+                        else
+                                ++i;
+                }
+
+                for (uint32_t k{0}; k != SET_SIZE; ++k)
                 {
-                        const auto &it = remaining[i];
+                        for (auto w = matched[k]; w; w &= w - 1)
+                        {
+                                const auto rel = (k << 6) + SwitchBitOps::TrailingZeros(w);
+                                const auto mask = masks[rel];
 
+                                masks[rel] = 0;
+                                if (mask == origMask)
+                                {
+                                        // we don't want to match the original query
+                                        continue;
+                                }
 
-                        if (const auto docID = it.it->curDocument.id; docID == lowest)
-                        {
-                                const auto m = uint64_t(1u) << it.tokenIdx;
+                                // first and last token of the intersection
+                                if (stopwordsMask & ((uint64_t(1) << SwitchBitOps::TrailingZeros(mask)) | (uint64_t(1) << (63 - SwitchBitOps::LeadingZeros(mask)))))
+                                        continue;
 
-                                mask |= m;
-                                selected[cnt++] = i;
-                                last = i;
-                        }
-                        else if (docID < lowest)
-                        {
-                                mask = uint64_t(1u) << it.tokenIdx;
-                                selected[0] = i;
-                                cnt = 1;
-                                lowest = docID;
-                                first = last = i;
+                                if (!maskedDocumentsRegistry->test(requireDocIDTranslation ? src->translate_docid(base + rel) : base + rel))
+                                        ++histogram[mask];
                         }
 
-                l100:;
+                        matched[k] = 0;
                 }
+        }
 
-		[[maybe_unused]] static constexpr bool trace{false};
-		//const bool trace = lowest == 2153560102;
-		//const bool trace = cnt == 4;
+        while (rem)
+        {
+                auto &t = remaining[--rem];
+
+                delete t.it;
+                delete t.dec;
+        }
+
+        // We ignore intersections that are masked completely by other intersections
+        // e.g [wars jedi] is masked by [star wars jedi], so we only retain maximal masks, along with
+        // the number of documents that matched exactly them
+        std::vector<std::pair<uint64_t, uint32_t>> all(histogram.begin(), histogram.end());
+        const auto base = out->size();
 
-		//if (trace) SLog("matched ", cnt, " for ", lowest, " (", mask != origMask, ")\n");
+        std::sort(all.begin(), all.end(), [](const auto &a, const auto &b) noexcept {
+                return SwitchBitOps::PopCnt(b.first) < SwitchBitOps::PopCnt(a.first);
+        });
+
+        for (const auto &it : all)
+        {
+                const auto mask = it.first;
+                bool masked{false};
 
-                if (mask != origMask)
+                for (auto i{base}; i != out->size(); ++i)
                 {
-                        if (0 == (stopwordsMask & ((uint64_t(1) << first) | (uint64_t(1) << last))))
+                        if (((*out)[i].first & mask) == mask)
                         {
-                                if (!maskedDocumentsRegistry->test(lowest))
-                                        c.consider(mask);
+                                masked = true;
+                                break;
                         }
                 }
 
-                while (cnt)
+                if (!masked)
                 {
-                        const auto idx = selected[--cnt];
-
-                        if (unlikely(DocIDsEND == remaining[idx].it->next()))
-                        {
-                                delete remaining[idx].dec;
-                                delete remaining[idx].it;
-
-                                if (--rem == 0)
-                                        goto l10;
-                                else
-                                        remaining[idx] = remaining[rem];
-                        }
+                        // saturate, instead of wrapping around, if the scaled count doesn't fit
+                        out->push_back({mask, uint32_t(std::min<uint64_t>(uint64_t(it.second) * sampling, std::numeric_limits<uint32_t>::max()))});
                 }
         }
 
-l10:
-        c.finalize();
-	if (trace)
-	        SLog(duration_repr(Timings::Microseconds::Since(before)), " to intersect, c.matches.size = ", c.matches.size(), "\n");
+        std::sort(out->begin() + base, out->end(), [](const auto &a, const auto &b) noexcept {
+                const auto r = int8_t(SwitchBitOps::PopCnt(b.first)) - int8_t(SwitchBitOps::PopCnt(a.first));
 
-        for (const auto &it : c.matches)
+                return r < 0 || (!r && b.second < a.second);
+        });
+
+        if (trace)
         {
-                if (trace)
-                        SLog("output:", it.v, ", cnt = ", it.cnt, ", popcnt = ", SwitchBitOps::PopCnt(uint64_t(it.v)), "\n");
-                out->push_back({it.v, it.cnt});
+                SLog(duration_repr(Timings::Microseconds::Since(before)), " to intersect, ", out->size() - base, " intersections\n");
+
+                for (auto i{base}; i != out->size(); ++i)
+                        SLog("output:", (*out)[i].first, ", cnt = ", (*out)[i].second, ", popcnt = ", SwitchBitOps::PopCnt((*out)[i].first), "\n");
         }
 }
 
-std::vector<std::pair<uint64_t, uint32_t>> Trinity::intersect(const uint64_t stopwordsMask, const std::vector<std::unordered_set<str8_t>> &tokens, IndexSourcesCollection *collection)
+std::vector<std::pair<uint64_t, uint32_t>> Trinity::intersect(const uint64_t stopwordsMask, const std::vector<std::unordered_set<str8_t>> &tokens, IndexSourcesCollection *collection, const uint32_t sampling)
 {
         std::vector<std::pair<uint64_t, uint32_t>> out;
+        std::vector<std::future<std::vector<std::pair<uint64_t, uint32_t>>>> futures;
         const auto n = collection->sources.size();
 
-        // TODO: use std::async()?
-        for (uint32_t i{0}; i != n; ++i)
+        // Schedule all but the first via std::async()
+        // we 'll handle the first here
+        for (uint32_t i{1}; i < n; ++i)
+        {
+                futures.push_back(
+                    std::async(std::launch::async, [&](const uint32_t i) {
+                            std::vector<std::pair<uint64_t, uint32_t>> res;
+                            auto scanner = collection->scanner_registry_for(i);
+
+                            intersect_impl(stopwordsMask, tokens, collection->sources[i], scanner.get(), &res, sampling);
+                            return res;
+                    },
+                               i));
+        }
+
+        if (n)
+        {
+                auto scanner = collection->scanner_registry_for(0);
+
+                intersect_impl(stopwordsMask, tokens, collection->sources[0], scanner.get(), &out, sampling);
+        }
+
+        while (futures.size())
         {
-                auto source = collection->sources[i];
-                auto scanner = collection->scanner_registry_for(i);
+                const auto res = futures.back().get();
 
-                intersect_impl(stopwordsMask, tokens, source, scanner.get(), &out);
+                out.insert(out.end(), res.begin(), res.end());
+                futures.pop_back();
         }
 
         std::sort(out.begin(), out.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
@@ -233,8 +268,8 @@ std::vector<std::pair<uint64_t, uint32_t>> Trinity::intersect(const uint64_t sto
 
                 for (++p; p != e && p->first == mask; ++p)
 		{
-			cnt += p->second;
-                        continue;
+			// saturate, like intersect_impl() does for the scaled counts
+			cnt = std::numeric_limits<uint32_t>::max() - cnt < p->second ? std::numeric_limits<uint32_t>::max() : cnt + p->second;
 		}
 
 		//SLog("FOR ", mask, " (popcnt = ", SwitchBitOps::PopCnt(mask), ") ", cnt, "\n");
@@ -264,7 +299,7 @@ uint8_t Trinity::intersection_indices(uint64_t mask, uint8_t *const out)
         return collected;
 }
 
-std::vector<std::pair<range_base<str8_t *, uint8_t>, std::pair<uint8_t, std::size_t>>> Trinity::intersection_alternatives(const query &originalQuery, query &rewrittenQuery, IndexSourcesCollection &collection, simple_allocator *const a)
+std::vector<std::pair<range_base<str8_t *, uint8_t>, std::pair<uint8_t, std::size_t>>> Trinity::intersection_alternatives(const query &originalQuery, query &rewrittenQuery, IndexSourcesCollection &collection, simple_allocator *const a, const uint32_t sampling)
 {
         static constexpr bool trace{false};
         std::vector<std::pair<range_base<str8_t *, uint8_t>, std::pair<uint8_t, std::size_t>>> resp;
@@ -325,7 +360,7 @@ std::vector<std::pair<range_base<str8_t *, uint8_t>, std::pair<uint8_t, std::siz
                 }
         }
 
-        auto res = Trinity::intersect(0, V, &collection);
+        auto res = Trinity::intersect(0, V, &collection, sampling);
 
 	// by order of tokens in the query ASC,  total matched tokens DESC, total products DESC
         std::sort(res.begin(), res.end(), [](const auto &a, const auto &b) {
@@ -23,20 +23,27 @@ namespace Trinity
         // if we don't, we 'll return (world of warcraft, of gears war, of war)
         // neither of them is optimal, but then again, there is not much we do around this except perhaps
         // consider past queries compsied of those tokens and figure out which is the most popular arrangement of tokens
-        void intersect_impl(const uint64_t stopwordsMask, const std::vector<std::unordered_set<str8_t>> &tokens, IndexSource *src, masked_documents_registry *, std::vector<std::pair<uint64_t, uint32_t>> *);
+        //
+        // sampling: if > 1, only 1 in `sampling` windows of 8192 document IDs is considered, and the counts are scaled by `sampling`(0 is treated as 1).
+        // The first sampled window is rotated across calls, so that repeated estimates are not all biased the same way.
+        // Iterators skip the other windows via advance(), so this is much faster for long postings lists. The counts are estimates, and
+        // rare intersections may be missed, but that's usually good enough for ranking alternatives. The relative error of a count c
+        // is roughly 1/sqrt(c / sampling).
+        void intersect_impl(const uint64_t stopwordsMask, const std::vector<std::unordered_set<str8_t>> &tokens, IndexSource *src, masked_documents_registry *, std::vector<std::pair<uint64_t, uint32_t>> *, const uint32_t sampling = 1);
 
-        inline std::vector<std::pair<uint64_t, uint32_t>> intersect(const uint64_t stopwordsMask, const std::vector<std::unordered_set<str8_t>> &tokens, IndexSource *src, masked_documents_registry *reg)
+        inline std::vector<std::pair<uint64_t, uint32_t>> intersect(const uint64_t stopwordsMask, const std::vector<std::unordered_set<str8_t>> &tokens, IndexSource *src, masked_documents_registry *reg, const uint32_t sampling = 1)
         {
                 std::vector<std::pair<uint64_t, uint32_t>> res;
 
-                intersect_impl(stopwordsMask, tokens, src, reg, &res);
+                intersect_impl(stopwordsMask, tokens, src, reg, &res, sampling);
                 return res;
         }
 
         // Should just merge from the collection and then return that
         std::vector<std::pair<uint64_t, uint32_t>> intersect(const uint64_t stopwordsMask,
                                                              const std::vector<std::unordered_set<str8_t>> &tokens,
-                                                             IndexSourcesCollection *collection);
+                                                             IndexSourcesCollection *collection,
+                                                             const uint32_t sampling = 1);
 
 	// Returns the index (bits offsets in bitmap)
         uint8_t intersection_indices(uint64_t bitmap, uint8_t *indices);
@@ -56,5 +63,7 @@ namespace Trinity
 	// You must set K = 1 when invoking rewrite_query(), and only accept single word token expansions.
 	// e.g for [macbook], it's correct to expand to [macbooks] but not correct to expand to [mac book](two words expansion)
 	// Those restrictions are required for interesections where query rewrites are applied .
-	std::vector<std::pair<range_base<str8_t *, uint8_t>, std::pair<uint8_t, std::size_t>>> intersection_alternatives(const query &originalQuery, query &rewrittenQuery, IndexSourcesCollection &collection, simple_allocator *const a);
+	//
+	// See intersect_impl() for sampling
+	std::vector<std::pair<range_base<str8_t *, uint8_t>, std::pair<uint8_t, std::size_t>>> intersection_alternatives(const query &originalQuery, query &rewrittenQuery, IndexSourcesCollection &collection, simple_allocator *const a, const uint32_t sampling = 1);
 }
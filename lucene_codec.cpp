@@ -423,6 +423,39 @@ Trinity::Codecs::Encoder *Trinity::Codecs::Lucene::IndexSession::new_encoder()
         return new Trinity::Codecs::Lucene::Encoder(this);
 }
 
+Trinity::Codecs::IndexSession *Trinity::Codecs::Lucene::IndexSession::new_worker_session()
+{
+        // flushFreq is 0 for the new session, so that positionsOut will never be flushed
+        return new Trinity::Codecs::Lucene::IndexSession(basePath);
+}
+
+void Trinity::Codecs::Lucene::IndexSession::append_worker_session(Trinity::Codecs::IndexSession *ws_, term_index_ctx *tctxs, const std::size_t n)
+{
+        auto ws = static_cast<Trinity::Codecs::Lucene::IndexSession *>(ws_);
+        const uint32_t indexBase = indexOut.size() + indexOutFlushed;
+        const uint32_t positionsBase = positionsOut.size() + positionsOutFlushed;
+
+        require(ws->indexOutFlushed == 0);
+        require(ws->positionsOutFlushed == 0);
+
+        indexOut.serialize(ws->indexOut.data(), ws->indexOut.size());
+        positionsOut.serialize(ws->positionsOut.data(), ws->positionsOut.size());
+        ws->indexOut.clear();
+        ws->positionsOut.clear();
+
+        for (uint32_t i{0}; i != n; ++i)
+        {
+                auto &tctx = tctxs[i];
+
+                tctx.indexChunk.offset += indexBase;
+                // the chunk header begins with the absolute offset of the term's hits in positionsOut; see Encoder::begin_term()
+                *(uint32_t *)(indexOut.data() + (tctx.indexChunk.offset - indexOutFlushed)) += positionsBase;
+        }
+
+        if (flushFreq && unlikely(positionsOut.size() > flushFreq))
+                flush_positions_data();
+}
+
 Trinity::Codecs::Decoder *Trinity::Codecs::Lucene::AccessProxy::new_decoder(const term_index_ctx &tctx)
 {
         auto d = std::make_unique<Trinity::Codecs::Lucene::Decoder>();
@@ -67,7 +67,7 @@ namespace Trinity
                                 void flush_positions_data();
 
                                 IndexSession(const char *bp)
-                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge)}, positionsOutFlushed{0}, positionsOutFd{-1}, flushFreq{0}
+                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge) | unsigned(Capabilities::ParallelEncode)}, positionsOutFlushed{0}, positionsOutFd{-1}, flushFreq{0}
                                 {
                                 }
 
@@ -96,6 +96,10 @@ namespace Trinity
                                 range32_t append_index_chunk(const Trinity::Codecs::AccessProxy *, const term_index_ctx srcTCTX) override final;
 
                                 void merge(merge_participant *, const uint16_t, Trinity::Codecs::Encoder *) override final;
+
+                                Trinity::Codecs::IndexSession *new_worker_session() override final;
+
+                                void append_worker_session(Trinity::Codecs::IndexSession *, term_index_ctx *, const std::size_t) override final;
                         };
 
                         class Encoder final
@@ -191,7 +195,8 @@ namespace Trinity
                                 uint16_t docsIndex, hitsIndex;
                                 uint16_t bufferedDocs, bufferedHits;
                                 uint32_t skippedHits;
-                                uint32_t docDeltas[BLOCK_SIZE], docFreqs[BLOCK_SIZE], hitsPositionDeltas[BLOCK_SIZE], hitsPayloadLengths[BLOCK_SIZE];
+                                // decoded blocks; cache-aligned(C++17 aligned new) for the SIMD decoders
+                                alignas(64) uint32_t docDeltas[BLOCK_SIZE], docFreqs[BLOCK_SIZE], hitsPositionDeltas[BLOCK_SIZE], hitsPayloadLengths[BLOCK_SIZE];
                                 uint32_t skipListIdx;
                                 isrc_docid_t curSkipListLastDocID{DocIDsEND};
 
@@ -289,6 +294,17 @@ namespace Trinity
                                 void init(const term_index_ctx &tctx, Trinity::Codecs::AccessProxy *access) override final;
 
                                 Trinity::Codecs::PostingsListIterator *new_iterator() override final;
+
+                                uint32_t skiplist_granularity() const noexcept override final
+                                {
+#ifdef LUCENE_LAZY_SKIPLIST_INIT
+                                        const bool haveSkiplist = skiplist.size || skiplistSize;
+#else
+                                        const bool haveSkiplist = skiplist.size;
+#endif
+
+                                        return haveSkiplist ? SKIPLIST_STEP * BLOCK_SIZE : 0;
+                                }
                         };
 
                         isrc_docid_t PostingsListIterator::next()
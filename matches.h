@@ -1,4 +1,5 @@
 #pragma once
+#include "docidupdates.h"
 #include "docwordspace.h"
 #include "runtime.h"
 
@@ -147,6 +148,15 @@ namespace Trinity
         {
                 const query_index_terms **queryIndicesTerms;
 
+                // Set by exec_query() if the deadline passed to it was reached before all documents were considered; the
+                // documents considered are then only those with the lowest IDs in the index source
+                bool truncated{false};
+
+                // If not 0, and the index source's documents are ordered by a field(see IndexSource::documents_order()), exec_query()
+                // stops once that many documents have been considered; the remaining matches can't rank higher by that field.
+                // It is ignored for sources that are not ordered.
+                std::size_t limit{0};
+
 
 		// There are 3 different consider() implementations, and which is invoked by the exec. enginedepends on the
 		// ExecFlags passed to Trinity::exec_query().
@@ -215,9 +225,58 @@ namespace Trinity
         // query on a document you will eventually disregard anyway - you get to do that before the query is evaluated.
         //
         // In addition to that, you may have your own rules for ignoring documents and that can be implemented in your filter.
+        class IndexSource;
+
+        // A pre-materialized filter; a set of documents of an IndexSource(i.e in its documents space, see IndexSource::translate_docid())
+        // that are either the only documents that may match(Include), or that should be disregarded(Exclude).
+        //
+        // See IndexDocumentsFilter::filter_set()
+        struct documents_filter_set final
+        {
+                enum class Mode : uint8_t
+                {
+                        Include = 0,
+                        Exclude
+                } mode;
+
+                docids_set set;
+                std::vector<std::unique_ptr<uint64_t[]>> storage;
+
+                documents_filter_set(const Mode m, std::vector<isrc_docid_t> &ids)
+                    : mode{m}
+                {
+                        set = docids_set::make(ids, &storage);
+                }
+        };
+
         struct IndexDocumentsFilter
         {
                 // return true if you want to disregard/ignore the document
                 virtual bool filter(const docid_t) = 0;
+
+                // Optional batch variant of filter(), for all documents in [base, base + size)
+                // If you can efficiently determine which of those documents you want to disregard, set their bits
+                // (i.e bit (id - base)) in out[] and return true; bits already set in out[] must be retained.
+                // Otherwise return false, and filter() will be used for each matched document instead.
+                //
+                // See MatchesProxy::window_mask()
+                virtual bool filter_window(const docid_t base, const uint32_t size, uint64_t *out)
+                {
+                        return false;
+                }
+
+                // If you have materialized the documents of `src` this filter accepts or rejects(e.g all
+                // available products, all documents in a date range), return them here, and the execution engine
+                // will push the set down to the iterators tree as an iterator, for the query on that source.
+                // For Include sets, the query is intersected with the set, so that iterators will skip ahead(advance()) to documents
+                // of the set, and for Exclude sets, a filter(NOT) is used, so that either the query or the set leads
+                // depending on their costs. That is, documents that would be filtered are not even considered.
+                //
+                // filter() and filter_window() are not used for that source if you do.
+                // The set must outlive the exec_query() call.
+                virtual const documents_filter_set *filter_set(IndexSource *src)
+                {
+                        return nullptr;
+                }
         };
 }
@@ -1,8 +1,133 @@
 #include "merge.h"
+#include "docvalues.h"
 #include "docwordspace.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unordered_set>
 #include <text.h>
 
+namespace // static/local this module
+{
+        // mmap()ed file of a candidate segment, if it exists
+        struct segment_file final
+        {
+                range_base<const uint8_t *, std::size_t> content;
+
+                segment_file(const char *basePath, const char *name)
+                {
+                        if (!basePath)
+                                return;
+
+                        const auto path = Buffer{}.append(basePath, "/", name);
+                        int fd = open(path.c_str(), O_RDONLY | O_LARGEFILE);
+
+                        if (fd == -1)
+                        {
+                                if (errno != ENOENT)
+                                        throw Switch::system_error("Failed to access ", path.AsS32());
+                                return;
+                        }
+
+                        const auto fileSize = lseek64(fd, 0, SEEK_END);
+
+                        if (fileSize <= 0)
+                        {
+                                close(fd);
+                                return;
+                        }
+
+                        auto fileData = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+                        close(fd);
+                        if (fileData == MAP_FAILED)
+                                throw Switch::data_error("Failed to access ", path.AsS32());
+
+                        content.Set(reinterpret_cast<const uint8_t *>(fileData), fileSize);
+                }
+
+                segment_file(const segment_file &) = delete;
+
+                ~segment_file()
+                {
+                        if (auto ptr = (void *)content.offset)
+                                munmap(ptr, content.size());
+                }
+        };
+
+        // Iterates the postings list of a candidate with segment-local document IDs(see SegmentIndexSession::set_local_docids()) in
+        // ascending global IDs order, so that they can be merged with the postings of other candidates.
+        // All postings are read and translated up-front, because if the segment was index sorted, global IDs are not in the order of local IDs.
+        struct translated_postings_iterator final
+            : public Trinity::Codecs::PostingsListIterator
+        {
+                struct posting final
+                {
+                        Trinity::docid_t id;
+                        Trinity::tokenpos_t freq;
+                        uint32_t hitsOffset;
+                };
+
+                std::vector<posting> postings;
+                std::vector<Trinity::term_hit> hits;
+                uint32_t idx{0};
+
+                translated_postings_iterator(Trinity::Codecs::Decoder *const d, const range_base<const Trinity::docid_t *, std::size_t> globalIDs, Trinity::DocWordsSpace *const dws)
+                    : Trinity::Codecs::PostingsListIterator{d}
+                {
+                        std::unique_ptr<Trinity::Codecs::PostingsListIterator> it(d->new_iterator());
+
+                        for (auto id = it->next(); id != Trinity::DocIDsEND; id = it->next())
+                        {
+                                const auto freq = it->freq;
+                                const uint32_t offset = hits.size();
+
+                                if (id >= globalIDs.size())
+                                        throw Switch::data_error("Unexpected segment-local document ID ", id);
+
+                                hits.resize(offset + freq);
+                                it->materialize_hits(dws, hits.data() + offset);
+                                postings.push_back({globalIDs.offset[id], freq, offset});
+                        }
+
+                        std::sort(postings.begin(), postings.end(), [](const auto &a, const auto &b) noexcept {
+                                return a.id < b.id;
+                        });
+                }
+
+                Trinity::isrc_docid_t next() override final
+                {
+                        if (idx == postings.size())
+                        {
+                                freq = 0;
+                                return curDocument.id = Trinity::DocIDsEND;
+                        }
+
+                        const auto &p = postings[idx++];
+
+                        freq = p.freq;
+                        return curDocument.id = p.id;
+                }
+
+                Trinity::isrc_docid_t advance(const Trinity::isrc_docid_t target) override final
+                {
+                        const auto it = std::lower_bound(postings.begin() + idx, postings.end(), target, [](const auto &p, const Trinity::isrc_docid_t id) noexcept {
+                                return p.id < id;
+                        });
+
+                        idx = it - postings.begin();
+                        return next();
+                }
+
+                void materialize_hits(Trinity::DocWordsSpace *, Trinity::term_hit *out) override final
+                {
+                        const auto &p = postings[idx - 1];
+
+                        memcpy(out, hits.data() + p.hitsOffset, sizeof(Trinity::term_hit) * p.freq);
+                }
+        };
+}
+
 void Trinity::MergeCandidatesCollection::commit()
 {
         std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
@@ -30,6 +155,77 @@ std::unique_ptr<Trinity::masked_documents_registry> Trinity::MergeCandidatesColl
 }
 
 
+// Merges the docvalues of all candidates into the merged segment's docvalues file
+// Values are keyed by global IDs, like the merged postings, and values of documents masked by more recent candidates are dropped.
+// Candidates are processed from the oldest to the most recent one, so that if more than one has a value for a document, the most recent value wins.
+static void merge_docvalues(Trinity::MergeCandidatesCollection *const mcc, const char *const outBasePath)
+{
+        Trinity::DocValues::Writer out;
+        // (global ID, index of the value in the column)
+        std::vector<std::pair<Trinity::docid_t, uint32_t>> docs;
+
+        for (uint32_t i = mcc->candidates.size(); i--;)
+        {
+                const auto ap = mcc->candidates[i].ap;
+
+                if (!ap)
+                        continue;
+
+                segment_file dvFile(ap->basePath, "docvalues");
+
+                if (!dvFile.content.size())
+                        continue;
+
+                // See translated_postings_iterator
+                segment_file idsFile(ap->basePath, "docids");
+                const auto globalIDs = reinterpret_cast<const Trinity::docid_t *>(idsFile.content.offset);
+                const std::size_t globalIDsCnt = idsFile.content.size() / sizeof(Trinity::docid_t);
+                const Trinity::DocValues::Reader reader(dvFile.content);
+
+                for (const auto &c : reader.all())
+                {
+                        // scanners expect ascending IDs, so we need a new one for each column
+                        auto maskedDocsReg = mcc->scanner_registry_for(i);
+
+                        docs.clear();
+                        for (uint32_t k{0}; k != c.cnt; ++k)
+                        {
+                                const Trinity::isrc_docid_t id = c.dense ? c.base + k : c.docIDs[k];
+
+                                if (!globalIDs)
+                                        docs.push_back({id, k});
+                                else if (id < globalIDsCnt)
+                                        docs.push_back({globalIDs[id], k});
+                        }
+
+                        if (globalIDs)
+                                std::sort(docs.begin(), docs.end());
+
+                        for (const auto &it : docs)
+                        {
+                                if (maskedDocsReg->test(it.first))
+                                        continue;
+
+                                const auto v = c.value_at(it.second);
+
+                                if (c.type == Trinity::DocValues::FieldType::String)
+                                        out.set(it.first, c.name, c.string(v));
+                                else
+                                        out.set(it.first, c.name, v);
+                        }
+                }
+        }
+
+        if (out.empty())
+                return;
+
+        IOBuffer buf;
+
+        out.serialize(&buf);
+        if (Trinity::Utilities::to_file(buf.data(), buf.size(), Buffer{}.append(outBasePath, "/docvalues").c_str()) == -1)
+                throw Switch::system_error("Failed to persist docvalues");
+}
+
 // Make sure you have commited first
 // Unlike with e.g SegmentIndexSession where the order of postlists in the index is based on our translation(term=>integer id) and the ascending order of that id
 // here the order will match the order the terms are found in `tersm`, because we perform a merge-sort and so we process terms in lexicograpphic order
@@ -41,15 +237,21 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
         {
                 uint16_t idx;
                 merge_candidate candidate;
+                // If the candidate has segment-local document IDs, globalIDs[localID] is the global ID
+                // Those are translated to global IDs(see translated_postings_iterator), and so the codec's fast paths can't be used for them.
+                range_base<const docid_t *, std::size_t> globalIDs;
         };
 
         std::vector<tracked_candidate> all_;
+        std::vector<std::unique_ptr<segment_file>> docIDsFiles;
 
         if (trace)
                 SLog("Merging ", candidates.size(), " candidates\n");
 
         require(candidates.size() < std::numeric_limits<uint16_t>::max());
 
+        merge_docvalues(this, is->basePath);
+
         for (uint16_t i{0}; i != candidates.size(); ++i)
         {
                 if (trace)
@@ -61,7 +263,19 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                 if (candidates[i].terms && false == candidates[i].terms->done() && candidates[i].ap)
 		{
 			// ap may be nullptr if we only wanted to e.g mask documents
-                        all_.push_back({i, candidates[i]});
+                        auto f = std::make_unique<segment_file>(candidates[i].ap->basePath, "docids");
+                        range_base<const docid_t *, std::size_t> globalIDs;
+
+                        if (const auto content = f->content; content.size())
+                        {
+                                if (content.size() % sizeof(docid_t))
+                                        throw Switch::data_error("Unexpected docids contents");
+
+                                globalIDs.Set(reinterpret_cast<const docid_t *>(content.offset), content.size() / sizeof(docid_t));
+                                docIDsFiles.push_back(std::move(f));
+                        }
+
+                        all_.push_back({i, candidates[i], globalIDs});
 		}
         }
 
@@ -138,9 +352,10 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                 if (toAdvanceCnt == 1)
                 {
                         auto c = all[toAdvance[0]].candidate;
+                        const auto globalIDs = all[toAdvance[0]].globalIDs;
                         auto maskedDocsReg = scanner_registry_for(all[toAdvance[0]].idx);
 
-                        if (fastPath && maskedDocsReg->empty() && haveAppendIndexChunk)
+                        if (fastPath && maskedDocsReg->empty() && haveAppendIndexChunk && !globalIDs.size())
                         {
                                 if (likely(selected.second.documents))
                                 {
@@ -172,7 +387,7 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                                 else
                                 {
                                         std::unique_ptr<Trinity::Codecs::Decoder> dec(c.ap->new_decoder(selected.second));
-					std::unique_ptr<Trinity::Codecs::PostingsListIterator> it(dec->new_iterator());
+					std::unique_ptr<Trinity::Codecs::PostingsListIterator> it(globalIDs.size() ? new translated_postings_iterator(dec.get(), globalIDs, &dws) : dec->new_iterator());
 
 					it->next();
                                         enc->begin_term();
@@ -236,7 +451,12 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                 }
                 else
                 {
-                        if (fastPath && haveMerge)
+                        bool translate{false};
+
+                        for (uint16_t i{0}; i != toAdvanceCnt; ++i)
+                                translate |= all[toAdvance[i]].globalIDs.size() != 0;
+
+                        if (fastPath && haveMerge && !translate)
                         {
                                 mergeParticipants.clear();
 
@@ -285,7 +505,7 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                                                 // see earlier comments for why this is possible
                                                 auto ap = all[idx].candidate.ap;
                                                 auto dec = ap->new_decoder(all[idx].candidate.terms->cur().second);
-						auto it = dec->new_iterator();
+						Trinity::Codecs::PostingsListIterator *it = all[idx].globalIDs.size() ? new translated_postings_iterator(dec, all[idx].globalIDs, &dws) : dec->new_iterator();
                                                 auto reg = scanner_registry_for(all[idx].idx).release();
 
                                                 require(reg);
@@ -67,6 +67,12 @@ namespace Trinity
                 // You are expected to outIndexSess->begin() before you merge(), and outIndexSess->end() afterwards, though you may
                 // want to use Trinity::persist_segment(outIndexSess) which will persist and invoke end() for you
 		//
+		//
+		// The candidates docvalues(see DocValues) are also merged, into outIndexSess->basePath's docvalues file.
+		//
+		// Candidates with segment-local document IDs(see SegmentIndexSession::set_local_docids()) are detected by the docids file
+		// in their AccessProxy::basePath; their IDs are translated to global IDs, so the merged segment is always in the global space.
+		//
 		// You may want to explicitly disable use of IndexSession::append_index_chunk() and IndexSession::merge(), even if it is supported by the outIndexSess's codec.
 		// If you are going to use ExecFlags::AccumulatedScoreScheme, and your scorer depends on IndexSource::field_statistics, those are
 		// only computed, during merge, for terms that are not handled by append_index_chunk(), so you may want to disable it, so that
@@ -0,0 +1,108 @@
+#pragma once
+#include "common.h"
+#include "trinity_limits.h"
+
+namespace Trinity
+{
+        // Numeric fields are indexed as trie-encoded terms; for each value, one term for (value >> shift) for every
+        // shift in [0, 64) in PrecisionStep increments. This allows for expressing any range [lo, hi] as a small set of terms
+        // (at most 2 * ((1 << PrecisionStep) - 1) for each precision level), instead of one term for each distinct value in the
+        // range, which is what ast_node::Type::NumericRange nodes are compiled to.
+        //
+        // See SegmentIndexSession::document_proxy::insert_numeric()
+        //
+        // Terms are encoded as [field][Separator][shift][(value >> shift) big-endian, without the zero high-order bytes the shift produced]
+        namespace NumericTerms
+        {
+                static constexpr uint8_t PrecisionStep{4};
+                static constexpr uint8_t Levels{64 / PrecisionStep};
+                static constexpr char_t Separator{0x1f};
+                static constexpr std::size_t MaxFieldLength{Limits::MaxTermLength - sizeof(uint64_t) - 2};
+
+                static_assert(64 % PrecisionStep == 0);
+
+                // Returns the length of the term stored in out[]
+                inline uint8_t encode(const str8_t field, const uint64_t value, const uint8_t shift, char_t *const out) noexcept
+                {
+                        const auto v = value >> shift;
+                        const uint8_t bytes = (64 - shift + 7) >> 3;
+                        uint8_t len = field.size();
+
+                        memcpy(out, field.data(), len);
+                        out[len++] = Separator;
+                        out[len++] = shift;
+                        for (int32_t i = bytes - 1; i >= 0; --i)
+                                out[len++] = (v >> (i << 3)) & 0xff;
+
+                        return len;
+                }
+
+                // So that signed values sort and compare as unsigned values
+                constexpr uint64_t from_signed(const int64_t v) noexcept
+                {
+                        return uint64_t(v) ^ (uint64_t(1) << 63);
+                }
+
+                // Invokes l(term) for each of the Levels terms `value` is to be indexed as
+                template <typename L>
+                void for_value(const str8_t field, const uint64_t value, L &&l)
+                {
+                        char_t buf[Limits::MaxTermLength];
+
+                        expect(field.size() <= MaxFieldLength);
+                        for (uint8_t shift{0}; shift < 64; shift += PrecisionStep)
+                                l(str8_t(buf, encode(field, value, shift, buf)));
+                }
+
+                // Invokes l(term) for each term of the set of terms that matches all values in [lo, hi]
+                // This is Lucene's NumericUtils::splitRange() algorithm.
+                template <typename L>
+                void for_range(const str8_t field, uint64_t lo, uint64_t hi, L &&l)
+                {
+                        char_t buf[Limits::MaxTermLength];
+                        const auto emit = [&](const uint64_t from, const uint64_t to, const uint8_t shift) {
+                                for (auto v = from >> shift, last = to >> shift;; ++v)
+                                {
+                                        l(str8_t(buf, encode(field, v << shift, shift, buf)));
+                                        if (v == last)
+                                                break;
+                                }
+                        };
+
+                        expect(field.size() <= MaxFieldLength);
+                        if (lo > hi)
+                                return;
+
+                        for (uint8_t shift{0};; shift += PrecisionStep)
+                        {
+                                if (shift + PrecisionStep >= 64)
+                                {
+                                        emit(lo, hi, shift);
+                                        return;
+                                }
+
+                                const uint64_t diff = uint64_t(1) << (shift + PrecisionStep);
+                                const uint64_t mask = ((uint64_t(1) << PrecisionStep) - 1) << shift;
+                                const bool hasLower = (lo & mask) != 0;
+                                const bool hasUpper = (hi & mask) != mask;
+                                const uint64_t nextLo = (hasLower ? lo + diff : lo) & ~mask;
+                                const uint64_t nextHi = (hasUpper ? hi - diff : hi) & ~mask;
+
+                                if (nextLo > nextHi || nextLo < lo || nextHi > hi)
+                                {
+                                        // no more precision levels to consider(or wrapped around)
+                                        emit(lo, hi, shift);
+                                        return;
+                                }
+
+                                if (hasLower)
+                                        emit(lo, lo | mask, shift);
+                                if (hasUpper)
+                                        emit(hi & ~mask, hi, shift);
+
+                                lo = nextLo;
+                                hi = nextHi;
+                        }
+                }
+        }
+}
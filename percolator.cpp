@@ -35,6 +35,7 @@ bool percolator_query::exec(const exec_node n, percolator_document_proxy &src) c
                 break;
 
                 case ENT::matchanyterms:
+                case ENT::matchrange:
                 {
                         const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
 
@@ -158,3 +159,495 @@ bool percolator_query::exec(const exec_node n, percolator_document_proxy &src) c
                         std::abort();
         }
 }
+
+percolator_batch::percolator_batch(const percolator_query &query)
+    : q{query}, terms(query.distinct_terms().size() + 1)
+{
+        clear();
+}
+
+void percolator_batch::set_term(const uint32_t document, const str8_t term)
+{
+        const auto &m = q.comp_ctx.localMap;
+
+        if (const auto it = m.find(term); it != m.end())
+                terms[it->second].set(document);
+}
+
+void percolator_query::match_batch(const percolator_batch &b, percolator_batch_proxy *const proxy, percolator_batch::mask *const out) const
+{
+        expect(&b.q == this);
+
+        exec_batch(root, b, proxy, out);
+        *out &= b.live;
+}
+
+void percolator_query::exec_batch(const exec_node n, const percolator_batch &b, percolator_batch_proxy *const proxy, percolator_batch::mask *const out) const
+{
+        // Documents in m that contain all phrase terms are candidates; the proxy is consulted for those
+        const auto match_phrase = [&](const compilation_ctx::phrase *const p, percolator_batch::mask *const m) {
+                m->fill();
+                for (uint32_t i{0}; i != p->size; ++i)
+                        *m &= b.terms[p->termIDs[i]];
+
+                if (m->any())
+                {
+                        expect(proxy);
+                        m->for_each([&](const uint32_t document) {
+                                if (!proxy->match_phrase(document, p->termIDs, p->size))
+                                        m->unset(document);
+                        });
+                }
+        };
+
+        switch (n.fp)
+        {
+                case ENT::matchterm:
+                        *out = b.terms[n.u16];
+                        break;
+
+                case ENT::constfalse:
+                        out->clear();
+                        break;
+
+                case ENT::consttrue:
+                case ENT::consttrueexpr:
+                        out->fill();
+                        break;
+
+                case ENT::matchallterms:
+                {
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                        out->fill();
+                        for (uint32_t i{0}; i != run->size; ++i)
+                                *out &= b.terms[run->terms[i]];
+                }
+                break;
+
+                case ENT::matchanyterms:
+                case ENT::matchrange:
+                {
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                        out->clear();
+                        for (uint32_t i{0}; i != run->size; ++i)
+                                *out |= b.terms[run->terms[i]];
+                }
+                break;
+
+                case ENT::unaryand:
+                        exec_batch(static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr)->expr, b, proxy, out);
+                        break;
+
+                case ENT::unarynot:
+                        exec_batch(static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr)->expr, b, proxy, out);
+                        out->flip();
+                        break;
+
+                case ENT::matchphrase:
+                        match_phrase(static_cast<const compilation_ctx::phrase *>(n.ptr), out);
+                        break;
+
+                case ENT::matchanyphrases:
+                {
+                        const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+                        percolator_batch::mask m;
+
+                        out->clear();
+                        for (uint32_t i{0}; i != run->size; ++i)
+                        {
+                                match_phrase(run->phrases[i], &m);
+                                *out |= m;
+                        }
+                }
+                break;
+
+                case ENT::matchallphrases:
+                {
+                        const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+                        percolator_batch::mask m;
+
+                        out->fill();
+                        for (uint32_t i{0}; i != run->size && out->any(); ++i)
+                        {
+                                match_phrase(run->phrases[i], &m);
+                                *out &= m;
+                        }
+                }
+                break;
+
+                case ENT::logicaland:
+                {
+                        const auto ctx = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                        percolator_batch::mask m;
+
+                        exec_batch(ctx->lhs, b, proxy, out);
+                        if (out->any())
+                        {
+                                exec_batch(ctx->rhs, b, proxy, &m);
+                                *out &= m;
+                        }
+                }
+                break;
+
+                case ENT::logicalnot:
+                {
+                        const auto ctx = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                        percolator_batch::mask m;
+
+                        exec_batch(ctx->lhs, b, proxy, out);
+                        if (out->any())
+                        {
+                                exec_batch(ctx->rhs, b, proxy, &m);
+                                out->and_not(m);
+                        }
+                }
+                break;
+
+                case ENT::logicalor:
+                {
+                        const auto ctx = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                        percolator_batch::mask m;
+
+                        exec_batch(ctx->lhs, b, proxy, out);
+                        exec_batch(ctx->rhs, b, proxy, &m);
+                        *out |= m;
+                }
+                break;
+
+                case ENT::matchsome:
+                {
+                        const auto pm = static_cast<const compilation_ctx::partial_match_ctx *>(n.ptr);
+                        uint16_t matched[percolator_batch::Capacity]{0};
+                        percolator_batch::mask m;
+
+                        out->clear();
+                        for (uint32_t i{0}; i != pm->size; ++i)
+                        {
+                                exec_batch(pm->nodes[i], b, proxy, &m);
+                                m.for_each([&](const uint32_t document) {
+                                        if (++matched[document] == pm->min)
+                                                out->set(document);
+                                });
+                        }
+                }
+                break;
+
+                case ENT::matchallnodes:
+                {
+                        const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+                        percolator_batch::mask m;
+
+                        out->fill();
+                        for (uint32_t i{0}; i != g->size && out->any(); ++i)
+                        {
+                                exec_batch(g->nodes[i], b, proxy, &m);
+                                *out &= m;
+                        }
+                }
+                break;
+
+                case ENT::matchanynodes:
+                {
+                        const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+                        percolator_batch::mask m;
+
+                        out->clear();
+                        for (uint32_t i{0}; i != g->size; ++i)
+                        {
+                                exec_batch(g->nodes[i], b, proxy, &m);
+                                *out |= m;
+                        }
+                }
+                break;
+
+                case ENT::dummyop:
+                case ENT::SPECIALIMPL_COLLECTION_LOGICALOR:
+                case ENT::SPECIALIMPL_COLLECTION_LOGICALAND:
+                        std::abort();
+        }
+}
+
+bool percolator_index::trigger_terms(const percolator_query &q, const exec_node n, std::vector<exec_term_id_t> *const out) const
+{
+        // Longer terms tend to be rarer, so we prefer them when any single term of a set will do
+        const auto longest = [&q](const exec_term_id_t *const ids, const uint16_t cnt) {
+                auto res = ids[0];
+
+                for (uint16_t i{1}; i < cnt; ++i)
+                {
+                        if (q.term_by_index(ids[i]).size() > q.term_by_index(res).size())
+                                res = ids[i];
+                }
+                return res;
+        };
+        // Returns false if none of the nodes can be triggered; otherwise appends the smallest set to out
+        const auto smallest = [&](const exec_node *const nodes, const uint16_t cnt) {
+                std::vector<exec_term_id_t> t, best;
+                bool any{false};
+
+                for (uint16_t i{0}; i != cnt; ++i)
+                {
+                        t.clear();
+                        if (trigger_terms(q, nodes[i], &t) && (!any || t.size() < best.size()))
+                        {
+                                best = t;
+                                any = true;
+                        }
+                }
+
+                out->insert(out->end(), best.begin(), best.end());
+                return any;
+        };
+
+        switch (n.fp)
+        {
+                case ENT::matchterm:
+                        out->push_back(n.u16);
+                        return true;
+
+                case ENT::constfalse:
+                        // can never match
+                        return true;
+
+                case ENT::consttrue:
+                case ENT::consttrueexpr:
+                case ENT::unarynot:
+                        return false;
+
+                case ENT::dummyop:
+                        return true;
+
+                case ENT::matchallterms:
+                {
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                        out->push_back(longest(run->terms, run->size));
+                        return true;
+                }
+
+                case ENT::matchanyterms:
+                case ENT::matchrange:
+                {
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                        out->insert(out->end(), run->terms, run->terms + run->size);
+                        return true;
+                }
+
+                case ENT::unaryand:
+                        return trigger_terms(q, static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr)->expr, out);
+
+                case ENT::matchphrase:
+                {
+                        const auto p = static_cast<const compilation_ctx::phrase *>(n.ptr);
+
+                        out->push_back(longest(p->termIDs, p->size));
+                        return true;
+                }
+
+                case ENT::matchallphrases:
+                {
+                        const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+                        const auto p = run->phrases[0];
+
+                        out->push_back(longest(p->termIDs, p->size));
+                        return true;
+                }
+
+                case ENT::matchanyphrases:
+                {
+                        const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+
+                        for (uint32_t i{0}; i != run->size; ++i)
+                                out->push_back(longest(run->phrases[i]->termIDs, run->phrases[i]->size));
+                        return true;
+                }
+
+                case ENT::logicalnot:
+                        return trigger_terms(q, static_cast<const compilation_ctx::binop_ctx *>(n.ptr)->lhs, out);
+
+                case ENT::logicaland:
+                {
+                        const auto b = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                        const exec_node nodes[] = {b->lhs, b->rhs};
+
+                        return smallest(nodes, 2);
+                }
+
+                case ENT::matchallnodes:
+                {
+                        const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+
+                        return smallest(g->nodes, g->size);
+                }
+
+                case ENT::logicalor:
+                {
+                        const auto b = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+
+                        return trigger_terms(q, b->lhs, out) && trigger_terms(q, b->rhs, out);
+                }
+
+                case ENT::matchanynodes:
+                {
+                        const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+
+                        for (uint32_t i{0}; i != g->size; ++i)
+                        {
+                                if (!trigger_terms(q, g->nodes[i], out))
+                                        return false;
+                        }
+                        return true;
+                }
+
+                case ENT::matchsome:
+                {
+                        // At least min of the nodes must match, so any (size - min + 1) of them will do; we pick the smallest sets
+                        const auto pm = static_cast<const compilation_ctx::partial_match_ctx *>(n.ptr);
+                        std::vector<std::vector<exec_term_id_t>> all;
+
+                        for (uint32_t i{0}; i != pm->size; ++i)
+                        {
+                                std::vector<exec_term_id_t> t;
+
+                                if (trigger_terms(q, pm->nodes[i], &t))
+                                        all.push_back(std::move(t));
+                        }
+
+                        const uint32_t required = pm->size - std::max<uint16_t>(pm->min, 1) + 1;
+
+                        if (all.size() < required)
+                                return false;
+
+                        std::sort(all.begin(), all.end(), [](const auto &a, const auto &b) noexcept {
+                                return a.size() < b.size();
+                        });
+
+                        for (uint32_t i{0}; i != required; ++i)
+                                out->insert(out->end(), all[i].begin(), all[i].end());
+                        return true;
+                }
+
+                case ENT::SPECIALIMPL_COLLECTION_LOGICALOR:
+                case ENT::SPECIALIMPL_COLLECTION_LOGICALAND:
+                        std::abort();
+        }
+
+        return false;
+}
+
+uint32_t percolator_index::add(const Trinity::query &q)
+{
+        const uint32_t id = queries.size();
+        auto pq = std::make_unique<percolator_query>(q);
+        std::vector<exec_term_id_t> ids;
+        stored_query sq;
+
+        if (*pq && !trigger_terms(*pq, pq->root, &ids))
+                unconditional.push_back(id);
+        else
+        {
+                std::sort(ids.begin(), ids.end());
+                ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+                for (const auto termID : ids)
+                {
+                        const auto term = pq->term_by_index(termID);
+                        auto res = index.insert({term, {}});
+
+                        if (res.second)
+                                res.first->first.Set(allocator.CopyOf(term.data(), term.size()), term.size());
+
+                        res.first->second.push_back(id);
+                        sq.triggers.push_back(res.first->first);
+                }
+        }
+
+        sq.q = std::move(pq);
+        queries.push_back(std::move(sq));
+        ++size_;
+        return id;
+}
+
+void percolator_index::erase(const uint32_t id)
+{
+        if (id >= queries.size() || !queries[id].q)
+                return;
+
+        auto &sq = queries[id];
+        const auto remove = [id](auto &v) {
+                if (const auto it = std::lower_bound(v.begin(), v.end(), id); it != v.end() && *it == id)
+                        v.erase(it);
+        };
+
+        if (sq.triggers.empty())
+                remove(unconditional);
+        else
+        {
+                for (const auto term : sq.triggers)
+                {
+                        // we keep the (possibly now empty) entry, because its key may be shared with other queries' triggers
+                        remove(index.find(term)->second);
+                }
+        }
+
+        sq.q.reset();
+        sq.triggers.clear();
+        sq.triggers.shrink_to_fit();
+        --size_;
+}
+
+std::size_t percolator_index::match(const str8_t *const terms, const std::size_t termsCnt, percolator_document &doc, std::vector<uint32_t> *const out)
+{
+        struct proxy final
+            : public percolator_document_proxy
+        {
+                percolator_document &doc;
+                const percolator_query *q;
+
+                proxy(percolator_document &d)
+                    : doc{d}
+                {
+                }
+
+                bool match_term(const uint16_t term) override final
+                {
+                        return doc.match_term(q->term_by_index(term));
+                }
+
+                bool match_phrase(const uint16_t *const ids, const uint16_t cnt) override final
+                {
+                        str8_t phraseTerms[Limits::MaxPhraseSize];
+
+                        for (uint16_t i{0}; i != cnt; ++i)
+                                phraseTerms[i] = q->term_by_index(ids[i]);
+
+                        return doc.match_phrase(phraseTerms, cnt);
+                }
+        } p(doc);
+
+        candidates.clear();
+        for (std::size_t i{0}; i != termsCnt; ++i)
+        {
+                if (const auto it = index.find(terms[i]); it != index.end())
+                        candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+        }
+
+        candidates.insert(candidates.end(), unconditional.begin(), unconditional.end());
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        out->clear();
+        for (const auto id : candidates)
+        {
+                const auto q = queries[id].q.get();
+
+                p.q = q;
+                if (q->match(p))
+                        out->push_back(id);
+        }
+
+        return candidates.size();
+}
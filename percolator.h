@@ -1,10 +1,12 @@
 // See https://www.youtube.com/watch?v=f4lqBb1d7no&list=PLcGKfGEEONaDzd0Hkn2f1talsTu1HLDYu&index=21
 //  Describes the Predicate Index Twitter employs to reduce number of distinct rules to 
 // attempt to match against a new tweet.
+#pragma once
 #include "common.h"
 #include "compilation_ctx.h"
 #include "queries.h"
 #include <ext/flat_hash_map.h>
+#include <switch_bitops.h>
 
 namespace Trinity
 {
@@ -19,6 +21,150 @@ namespace Trinity
                 virtual bool match_phrase(const uint16_t *, const uint16_t cnt) = 0;
 	};
 
+        class percolator_query;
+
+        // A batch of up to Capacity documents, for percolator_query::match_batch()
+        //
+        // Each document's terms are resolved once, into a bitmap over the query's distinct_terms(); for each term
+        // we track the documents of the batch that contain it, so that a termsrun is evaluated for all documents with
+        // a few bitwise AND/OR operations over the term masks(which the compiler vectorizes), instead of a
+        // virtual call for each term of each document.
+        class percolator_batch final
+        {
+              public:
+                static constexpr uint32_t Capacity{256};
+                static constexpr uint32_t Words{Capacity / 64};
+
+                struct alignas(32) mask final
+                {
+                        uint64_t w[Words];
+
+                        inline void clear() noexcept
+                        {
+                                for (uint32_t i{0}; i != Words; ++i)
+                                        w[i] = 0;
+                        }
+
+                        inline void fill() noexcept
+                        {
+                                for (uint32_t i{0}; i != Words; ++i)
+                                        w[i] = std::numeric_limits<uint64_t>::max();
+                        }
+
+                        inline void operator&=(const mask &o) noexcept
+                        {
+                                for (uint32_t i{0}; i != Words; ++i)
+                                        w[i] &= o.w[i];
+                        }
+
+                        inline void operator|=(const mask &o) noexcept
+                        {
+                                for (uint32_t i{0}; i != Words; ++i)
+                                        w[i] |= o.w[i];
+                        }
+
+                        inline void and_not(const mask &o) noexcept
+                        {
+                                for (uint32_t i{0}; i != Words; ++i)
+                                        w[i] &= ~o.w[i];
+                        }
+
+                        inline void flip() noexcept
+                        {
+                                for (uint32_t i{0}; i != Words; ++i)
+                                        w[i] = ~w[i];
+                        }
+
+                        inline bool any() const noexcept
+                        {
+                                uint64_t r{0};
+
+                                for (uint32_t i{0}; i != Words; ++i)
+                                        r |= w[i];
+                                return r;
+                        }
+
+                        inline bool is_set(const uint32_t i) const noexcept
+                        {
+                                return w[i >> 6] & (uint64_t(1) << (i & 63));
+                        }
+
+                        inline void set(const uint32_t i) noexcept
+                        {
+                                w[i >> 6] |= uint64_t(1) << (i & 63);
+                        }
+
+                        inline void unset(const uint32_t i) noexcept
+                        {
+                                w[i >> 6] &= ~(uint64_t(1) << (i & 63));
+                        }
+
+                        // Invokes l(index) for each set bit, in ascending order
+                        template <typename L>
+                        void for_each(L &&l) const
+                        {
+                                for (uint32_t i{0}; i != Words; ++i)
+                                {
+                                        for (auto v = w[i]; v; v &= v - 1)
+                                                l((i << 6) + SwitchBitOps::TrailingZeros(v));
+                                }
+                        }
+                };
+
+              private:
+                const percolator_query &q;
+                // indexed by term index(see percolator_query::term_by_index()); terms[0] is not used
+                std::vector<mask> terms;
+                // documents in the batch
+                mask live;
+                uint32_t size_{0};
+
+                friend class percolator_query;
+
+              public:
+                percolator_batch(const percolator_query &);
+
+                void clear() noexcept
+                {
+                        for (auto &m : terms)
+                                m.clear();
+                        live.clear();
+                        size_ = 0;
+                }
+
+                auto size() const noexcept
+                {
+                        return size_;
+                }
+
+                auto full() const noexcept
+                {
+                        return size_ == Capacity;
+                }
+
+                // Returns the index of the new document in the batch
+                uint32_t new_document()
+                {
+                        expect(!full());
+                        live.set(size_);
+                        return size_++;
+                }
+
+                void set_term(const uint32_t document, const uint16_t termIdx) noexcept
+                {
+                        terms[termIdx].set(document);
+                }
+
+                // Terms that are not in the query's distinct_terms() are ignored
+                void set_term(const uint32_t document, const str8_t term);
+        };
+
+        // match_batch() only needs this for evaluating phrases, and only for documents that contain all phrase terms
+        struct percolator_batch_proxy
+        {
+                virtual bool match_phrase(const uint32_t document, const uint16_t *, const uint16_t cnt) = 0;
+        };
+
         class percolator_query final
         {
               protected:
@@ -51,6 +197,8 @@ namespace Trinity
               protected:
                 bool exec(const exec_node, percolator_document_proxy &) const;
 
+                void exec_batch(const exec_node, const percolator_batch &, percolator_batch_proxy *, percolator_batch::mask *) const;
+
               public:
                 auto term_by_index(const uint16_t idx) const
                 {
@@ -96,5 +244,71 @@ namespace Trinity
                 }
 
                 bool match(percolator_document_proxy &) const;
+
+                // Evaluates the query for all documents in the batch; out is set to the mask of matching documents
+                // proxy can be nullptr if the query has no phrases
+                void match_batch(const percolator_batch &, percolator_batch_proxy *proxy, percolator_batch::mask *out) const;
+
+                friend class percolator_index;
+                friend class percolator_batch;
+        };
+
+        // Used by percolator_index, where the terms are not known in advance and
+        // are identified by their value instead.
+        struct percolator_document
+        {
+                virtual bool match_term(const str8_t term) = 0;
+
+                virtual bool match_phrase(const str8_t *terms, const uint16_t cnt) = 0;
+        };
+
+        // Predicate index of percolator_querys, for matching a document against many(e.g millions) stored queries
+        // without evaluating each of them.
+        //
+        // For each query, we determine a set of terms(triggers), at least one of which must be present in a document for the query
+        // to match it. For example, for [apple AND (iphone OR ipad)] that's either {apple} or {iphone, ipad}; we choose the smaller set.
+        // Queries are indexed by their trigger terms, and for an incoming document only those queries indexed by
+        // any of the document's terms are evaluated.
+        // Queries where no such set exists(e.g [NOT apple]) are evaluated for every document.
+        class percolator_index final
+        {
+              private:
+                struct stored_query final
+                {
+                        std::unique_ptr<percolator_query> q;
+                        std::vector<str8_t> triggers;
+                };
+
+                simple_allocator allocator{4096 * 8};
+                std::vector<stored_query> queries;
+                ska::flat_hash_map<str8_t, std::vector<uint32_t>> index;
+                // queries that need to be evaluated for every document
+                std::vector<uint32_t> unconditional;
+                std::vector<uint32_t> candidates;
+                uint32_t size_{0};
+
+              private:
+                bool trigger_terms(const percolator_query &, const exec_node, std::vector<exec_term_id_t> *) const;
+
+              public:
+                // Returns the ID of the query, which is passed to match()
+                // IDs are assigned sequentially, starting from 0, and are not reused
+                uint32_t add(const Trinity::query &q);
+
+                void erase(const uint32_t id);
+
+                const percolator_query *query_by_id(const uint32_t id) const noexcept
+                {
+                        return id < queries.size() ? queries[id].q.get() : nullptr;
+                }
+
+                auto size() const noexcept
+                {
+                        return size_;
+                }
+
+                // `terms` are the distinct terms of the document; out is populated with the IDs of the matching queries, in ascending order.
+                // Returns the number of queries evaluated.
+                std::size_t match(const str8_t *terms, const std::size_t termsCnt, percolator_document &doc, std::vector<uint32_t> *out);
         };
 }
@@ -1,4 +1,5 @@
 #include "queries.h"
+#include "numeric_terms.h"
 #include <unordered_set>
 #include <ext/flat_hash_map.h>
 #include <mutex>
@@ -78,9 +79,111 @@ static std::pair<str32_t, range_base<uint16_t, uint16_t>> parse_term(ast_parser
         }
 }
 
+// [field:[lo TO hi]]
+// Bounds are inclusive, and either can be `*` for an open-ended range
+// Returns nullptr without consuming any input if this is not a numeric range
+static ast_node *parse_numeric_range(ast_parser &ctx)
+{
+        const auto *p = ctx.content.begin(), *const e = ctx.content.end();
+        const auto *const fieldBegin = p;
+        // magnitudes, until both bounds have been parsed
+        uint64_t bounds[2];
+        bool negative[2]{false, false};
+        bool isSigned{false}, unbounded[2]{false, false};
+
+        while (p != e && (isalnum(*p) || *p == '_' || *p == '.'))
+                ++p;
+
+        const auto fieldLen = p - fieldBegin;
+
+        if (!fieldLen || fieldLen > NumericTerms::MaxFieldLength || e - p < 2 || p[0] != ':' || p[1] != '[')
+                return nullptr;
+
+        p += 2;
+        for (uint32_t i{0}; i != 2; ++i)
+        {
+                while (p != e && isspace(*p))
+                        ++p;
+
+                if (p == e)
+                        return nullptr;
+                else if (*p == '*')
+                {
+                        unbounded[i] = true;
+                        ++p;
+                }
+                else
+                {
+                        if (*p == '-' || *p == '+')
+                        {
+                                negative[i] = *p == '-';
+                                isSigned = true;
+                                ++p;
+                        }
+
+                        if (p == e || !isdigit(*p))
+                                return nullptr;
+
+                        uint64_t v{0};
+
+                        do
+                        {
+                                const uint64_t d = *p - '0';
+
+                                if (v > (std::numeric_limits<uint64_t>::max() - d) / 10)
+                                {
+                                        // overflow
+                                        return nullptr;
+                                }
+
+                                v = v * 10 + d;
+                        } while (++p != e && isdigit(*p));
+
+                        bounds[i] = v;
+                }
+
+                while (p != e && isspace(*p))
+                        ++p;
+
+                if (i == 0)
+                {
+                        if (e - p < 2 || p[0] != 'T' || p[1] != 'O')
+                                return nullptr;
+
+                        p += 2;
+                }
+                else if (p == e || *p != ']')
+                        return nullptr;
+                else
+                        ++p;
+        }
+
+        for (uint32_t i{0}; i != 2; ++i)
+        {
+                if (unbounded[i])
+                        bounds[i] = i ? std::numeric_limits<uint64_t>::max() : 0;
+                else if (isSigned)
+                {
+                        // magnitude must fit in an int64_t
+                        static constexpr uint64_t limit = uint64_t(1) << 63;
+
+                        if (negative[i] ? bounds[i] > limit : bounds[i] >= limit)
+                                return nullptr;
+
+                        bounds[i] = NumericTerms::from_signed(negative[i] ? int64_t(0 - bounds[i]) : int64_t(bounds[i]));
+                }
+        }
+
+        ctx.content.strip_prefix(p - ctx.content.begin());
+        return ast_node::make_numeric_range(ctx.allocator, {fieldBegin, uint8_t(fieldLen)}, bounds[0], bounds[1], isSigned);
+}
+
 static ast_node *parse_phrase_or_token(ast_parser &ctx)
 {
         ctx.skip_ws();
+        if (auto n = parse_numeric_range(ctx))
+                return n;
+
         if (ctx.content && ctx.content.StripPrefix(_S("\"")))
         {
                 auto &terms = ctx.terms;
@@ -327,6 +430,17 @@ void PrintImpl(Buffer &b, const Trinity::ast_node &n)
 			b.append('[', n.match_some.min, '/', n.match_some.size, ']');
 			break;
 
+                case ast_node::Type::NumericRange:
+                        if (n.range->isSigned)
+                        {
+                                const auto lo = int64_t(n.range->lo ^ (uint64_t(1) << 63)), hi = int64_t(n.range->hi ^ (uint64_t(1) << 63));
+
+                                b.append(n.range->field, ":[", lo >= 0 ? "+" : "", lo, " TO ", hi >= 0 ? "+" : "", hi, ']');
+                        }
+                        else
+                                b.append(n.range->field, ":[", n.range->lo, " TO ", n.range->hi, ']');
+                        break;
+
                 case ast_node::Type::ConstFalse:
                         b.append("<FALSE>"_s8);
                         break;
@@ -1069,6 +1183,14 @@ static void normalize(ast_node *const n, normalizer_ctx &ctx)
                         ++ctx.updates;
                 }
         }
+        else if (n->type == ast_node::Type::NumericRange)
+        {
+                if (n->range->lo > n->range->hi)
+                {
+                        n->set_const_false();
+                        ++ctx.updates;
+                }
+        }
         else if (n->type == ast_node::Type::Token || n->type == ast_node::Type::Phrase)
                 ctx.tokensCnt += n->p->size;
 }
@@ -1384,6 +1506,11 @@ ast_node *ast_node::copy(simple_allocator *const a)
                                 res->match_some.nodes[i] = n->match_some.nodes[i]->copy(a);
                         break;
 
+                case ast_node::Type::NumericRange:
+                        res->range = a->Alloc<numeric_range>();
+                        *res->range = *n->range;
+                        break;
+
                 case ast_node::Type::ConstTrueExpr:
                         res->expr = n->expr->copy(a);
                         break;
@@ -1417,6 +1544,10 @@ ast_node *ast_node::shallow_copy(simple_allocator *const a)
                         res->p = n->p;
                         break;
 
+                case ast_node::Type::NumericRange:
+                        res->range = n->range;
+                        break;
+
 		case ast_node::Type::MatchSome:
                         res->match_some.size = n->match_some.size;
                         res->match_some.min = n->match_some.min;
@@ -1724,6 +1855,7 @@ bool ast_node::any_leader_tokens() const
                 {
                         case ast_node::Type::Token:
                         case ast_node::Type::Phrase:
+                        case ast_node::Type::NumericRange:
                                 return true;
 
                         case ast_node::Type::BinOp:
@@ -1875,6 +2007,14 @@ void query::bind_tokens_to_allocator(ast_node *n, simple_allocator *a)
 				stack.insert(stack.end(), n->match_some.nodes, n->match_some.nodes + n->match_some.size);
 				break;
 
+                        case ast_node::Type::NumericRange:
+                        {
+                                auto &f = n->range->field;
+
+                                f.p = a->CopyOf(f.data(), f.size());
+                        }
+                        break;
+
                         case ast_node::Type::Dummy:
                         case ast_node::Type::ConstFalse:
                                 break;
@@ -19,6 +19,16 @@ namespace Trinity
 
         struct phrase;
 
+        // See ast_node::Type::NumericRange
+        struct numeric_range final
+        {
+                str8_t field;
+                // inclusive
+                // If isSigned is set, those are NumericTerms::from_signed() values
+                uint64_t lo, hi;
+                bool isSigned;
+        };
+
         // A query is an ASTree
 	//
 	// Choice of AST vs Lucene's Query Interface:
@@ -64,6 +74,8 @@ namespace Trinity
 
                         // for both type::Token and type::Phrase
                         phrase *p;
+                        // for type::NumericRange
+                        numeric_range *range;
                         ast_node *expr;
                 };
 
@@ -99,6 +111,14 @@ namespace Trinity
 			// its own features, and use MatchSome ast_node with all the features extracted from the input image, and a threshold set to say 50% of the total features in that input image, and then execute
 			// the query; it will match all images that have at least 50% common features with the input image. This is going to be very fast and very handy.
 			MatchSome,
+
+                        // Matches documents with a value in [range->lo, range->hi] for a numeric field(e.g price:[10 TO 50]).
+                        // Bounds can be * (unbounded), and signed(e.g temperature:[-10 TO +5]); if either bound is signed(prefixed with - or +), both
+                        // are, and they are mapped via NumericTerms::from_signed(), so the field is expected to have been indexed with from_signed() values.
+                        // Numeric fields are indexed as trie-encoded terms(see NumericTerms), and the range is compiled to the few terms
+                        // that cover it. The engine materializes the union of their postings into a single iterator, as opposed to
+                        // expanding the range into an OR of those terms, and it doesn't participate in matched terms/scoring.
+                        NumericRange,
                 } type;
 
                 // this is handy if you want to delete a node
@@ -165,6 +185,19 @@ namespace Trinity
 			return res;
 		}
 
+                static ast_node *make_numeric_range(simple_allocator &a, const str8_t field, const uint64_t lo, const uint64_t hi, const bool isSigned = false)
+                {
+                        auto res = make(a, Type::NumericRange);
+                        auto r = a.Alloc<numeric_range>();
+
+                        r->field.Set(a.CopyOf(field.data(), field.size()), field.size());
+                        r->lo = lo;
+                        r->hi = hi;
+                        r->isSigned = isSigned;
+                        res->range = r;
+                        return res;
+                }
+
                 static ast_node *make_binop(simple_allocator &a)
                 {
 			auto res =  make(a, Type::BinOp);
@@ -666,6 +699,7 @@ namespace Trinity
                                         case ast_node::Type::Dummy:
                                         case ast_node::Type::ConstFalse:
                                         case ast_node::Type::ConstTrueExpr:
+                                        case ast_node::Type::NumericRange:
                                                 break;
                                 }
                         }
@@ -3,13 +3,21 @@
 // be extremely concpet, many 100s of nodes in size, so you need to compromise and accept tradeoffs.
 #pragma once
 #include "queries.h"
+#include <atomic>
+#include <list>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace Trinity
 {
         enum class RewriteFlags : uint8_t
         {
-                NoShallowCopy = 1
+                NoShallowCopy = 1,
+                // Memoize the alternatives the rewrite_query() callback produces for each sequence of tokens, and reuse them
+                // across rewrite_query() calls(on the same thread, and for the same callback type), instead of invoking the callback again.
+                // Only use this if the alternatives only depend on the tokens, i.e not on the run context or any other state you may have captured.
+                // See invalidate_rewrite_memos()
+                MemoizeAlternatives = 2
         };
 
         struct flow;
@@ -213,10 +221,68 @@ namespace Trinity
 
         inline flow *flow_for_node(const std::pair<range32_t, ast_node *> p, gen_ctx &, std::vector<flow *> &, uint32_t &);
 
+        // Bumped by invalidate_rewrite_memos(); gen_ctx::alternatives_memo compares against it
+        inline std::atomic<uint64_t> rewriteMemosEpoch{0};
+
+        // Invalidates all alternatives memoized by rewrite_query() on all threads, e.g when the rules your callback is based on are updated
+        inline void invalidate_rewrite_memos() noexcept
+        {
+                rewriteMemosEpoch.fetch_add(1, std::memory_order_relaxed);
+        }
+
         struct gen_ctx
         {
                 uint32_t logicalIndex;
                 uint32_t K;
+                bool memoizeAlternatives{false};
+
+                // LRU; see RewriteFlags::MemoizeAlternatives
+                // A gen_ctx is thread-local to each rewrite_query() instantiation, so no locking is required, and
+                // memoized alternatives of different callback types are not mixed.
+                struct alternatives_memo final
+                {
+                        using alternatives = std::vector<std::pair<std::string, query_term_flags_t>>;
+                        using lru_list = std::list<std::pair<std::string, alternatives>>;
+
+                        static constexpr std::size_t Capacity{8192};
+
+                        uint64_t epoch{0};
+                        lru_list lru;
+                        std::unordered_map<std::string, lru_list::iterator> map;
+
+                        void validate()
+                        {
+                                if (const auto e = rewriteMemosEpoch.load(std::memory_order_relaxed); e != epoch)
+                                {
+                                        map.clear();
+                                        lru.clear();
+                                        epoch = e;
+                                }
+                        }
+
+                        const alternatives *find(const std::string &key)
+                        {
+                                if (const auto it = map.find(key); it != map.end())
+                                {
+                                        lru.splice(lru.begin(), lru, it->second);
+                                        return &it->second->second;
+                                }
+                                else
+                                        return nullptr;
+                        }
+
+                        void insert(const std::string &key, alternatives &&alts)
+                        {
+                                lru.emplace_front(key, std::move(alts));
+                                map.emplace(key, lru.begin());
+
+                                if (lru.size() > Capacity)
+                                {
+                                        map.erase(lru.back().first);
+                                        lru.pop_back();
+                                }
+                        }
+                } memo;
 
                 simple_allocator allocator, flowsAllocator{4096};
                 // Could have used just one container insted of two, and a map or multimap for tracking flows by range
@@ -286,6 +352,8 @@ namespace Trinity
                 auto &alts{altsTLS};
                 static thread_local simple_allocator altAllocatorInstanceTLS;
                 auto &altAllocator{altAllocatorInstanceTLS};
+                static thread_local std::string memoKeyTLS;
+                auto &memoKey{memoKeyTLS};
                 const auto normalizedMaxSpan = std::min<uint8_t>(maxSpan, genCtx.K);
                 strwlen8_t tokens[normalizedMaxSpan];
                 std::vector<std::pair<Trinity::ast_node *, uint8_t>> expressions;
@@ -335,7 +403,35 @@ namespace Trinity
                 while (n)
                 {
                         alts.clear();
-                        l(runCtx, tokens, n, altAllocator, &alts);
+
+                        if (genCtx.memoizeAlternatives)
+                        {
+                                memoKey.clear();
+                                for (uint32_t k{0}; k != n; ++k)
+                                {
+                                        memoKey.push_back(char(tokens[k].size()));
+                                        memoKey.append(tokens[k].data(), tokens[k].size());
+                                }
+
+                                if (const auto memoized = genCtx.memo.find(memoKey))
+                                {
+                                        // copied, because the entry may be evicted before we are done with them here
+                                        for (const auto &it : *memoized)
+                                                alts.push_back({{altAllocator.CopyOf(it.first.data(), it.first.size()), uint32_t(it.first.size())}, it.second});
+                                }
+                                else
+                                {
+                                        gen_ctx::alternatives_memo::alternatives copy;
+
+                                        l(runCtx, tokens, n, altAllocator, &alts);
+                                        copy.reserve(alts.size());
+                                        for (const auto &it : alts)
+                                                copy.push_back({std::string(it.first.data(), it.first.size()), it.second});
+                                        genCtx.memo.insert(memoKey, std::move(copy));
+                                }
+                        }
+                        else
+                                l(runCtx, tokens, n, altAllocator, &alts);
 
                         if (trace)
                                 SLog("FOR n = ", n, " => ", alts.size(), "\n");
@@ -534,6 +630,11 @@ namespace Trinity
                 static thread_local std::vector<std::pair<range32_t, ast_node *>> list_tl;
                 auto &list{list_tl};
                 const auto baseIndex{i};
+                // budget is adjusted in run_next() for every expression generated, so that we stop considering alternatives once it's depleted, and
+                // here for every copy we need to make. Once the expression for the run is materialized, we account for exactly the nodes
+                // it is comprised of, instead of those estimates; see rewrite_query()
+                const bool budgeted = budget != std::numeric_limits<std::size_t>::max();
+                const auto initialBudget{budget};
 
                 genCtx.prepare_run_capture();
 
@@ -782,6 +883,22 @@ namespace Trinity
                                                                         SLog("No common ancestor\n");
                                                         }
 
+                                                        if (budgeted && p.first.size() > 1)
+                                                        {
+                                                                // An alternative for a sequence of tokens; we need a copy for each of the flows, and an AND node for each.
+                                                                // If we can't afford that, disregard it, as if it wasn't produced; the tokens it spans are covered anyway
+                                                                const auto required = p.second->nodes_count() * (atStop.size() - 1) + atStop.size();
+
+                                                                if (required > budget)
+                                                                {
+                                                                        if (trace)
+                                                                                SLog("Over budget(", required, " > ", budget, "), ignoring ", *p.second, "\n");
+                                                                        continue;
+                                                                }
+
+                                                                budget -= required;
+                                                        }
+
                                                         for (auto f : atStop)
                                                         {
                                                                 // XXX: we are making shallow copies here, which mean that the token's phrase may be shared among
@@ -1011,6 +1128,17 @@ namespace Trinity
 
                 auto res = root->materialize(genCtx.allocator);
 
+                if (budgeted)
+                {
+                        // The tokens of the run [baseIndex, run.size()) are replaced by res
+                        const auto available = initialBudget + (run.size() - baseIndex);
+
+                        if (const auto n = res->nodes_count(); n < available)
+                                budget = available - n;
+                        else
+                                budget = 0;
+                }
+
 #if 0
 		SLog("ROOT:", *root, "\n");
                 SLog(ansifmt::bold, ansifmt::color_green, "FINAL:", ansifmt::reset, *res, "\n"); exit(0);
@@ -1050,12 +1178,12 @@ namespace Trinity
 		You probably want another runs pass in order to e.g convert all stop word nodes to
 		<stopword> so that <the> becomes optional.
 
-		Currently, the budget is an approximate threshold which controls our run sequence=>expressions extrapolation.
-		If it's set to std::numeric_limits<std::size_t>::max(), it's not taken into account, otherwise, for every expression we 'll compute the number
-		of nodes it is comprised of, and deduct that from the budget; once the budget has reached 0, we will not attempt to match a sequence to multiple alternatives.
+		The budget is the number of nodes the rewritten query may be comprised of.
+		If it's set to std::numeric_limits<std::size_t>::max(), it's not taken into account, otherwise, for every expression and for every copy of an expression
+		run_capture() needs to make, we 'll deduct the nodes it is comprised of from the budget; once the budget has reached 0, we will not attempt to match a sequence to multiple alternatives.
+		Once a run has been rewritten, the budget reflects the exact number of nodes of its expression.
 
-		TODO: In a future revision, budget semantics should be implemented in run_capture() where this makes a lot more sense, because we are bound to rewrite, extend, duplicate etc there
-		and that would be more appropriate, and accurate, to adjust the budget there.
+		If the alternatives produced by your callback only depend on the tokens, you can set RewriteFlags::MemoizeAlternatives so that they are reused across queries.
   	*	
 	*/
         static inline void dummy_rcb(const std::vector<ast_node *> &)
@@ -1076,6 +1204,9 @@ namespace Trinity
                 auto &genCtx = genCtxTL;
 
                 genCtx.clear(K);
+                genCtx.memoizeAlternatives = rewriteFlags & unsigned(RewriteFlags::MemoizeAlternatives);
+                if (genCtx.memoizeAlternatives)
+                        genCtx.memo.validate();
 
                 if (trace)
                         SLog("Initial budget: ", budget, "\n");
@@ -21,12 +21,20 @@ void Trinity::queryexec_ctx::track_docref(candidate_document *doc)
 
         if (tracked_docrefs.size == tracked_docrefs.capacity)
         {
-                tracked_docrefs.capacity = (tracked_docrefs.capacity * 2) + 128;
-                tracked_docrefs.data = (candidate_document **)realloc(tracked_docrefs.data,
-                                                                      sizeof(candidate_document *) * tracked_docrefs.capacity);
+                // grow, and unwrap the ring so that front is 0 again
+                const uint32_t capacity = tracked_docrefs.capacity ? tracked_docrefs.capacity * 2 : 128;
+                auto data = (candidate_document **)malloc(sizeof(candidate_document *) * capacity);
+
+                for (uint32_t i{0}; i != tracked_docrefs.size; ++i)
+                        data[i] = tracked_docrefs.at(i);
+
+                std::free(tracked_docrefs.data);
+                tracked_docrefs.data = data;
+                tracked_docrefs.capacity = capacity;
+                tracked_docrefs.front = 0;
         }
 
-        tracked_docrefs.data[tracked_docrefs.size++] = doc;
+        tracked_docrefs.at(tracked_docrefs.size++) = doc;
 
 	if constexpr (trace_docrefs)
 		SLog("now ", tracked_docrefs.size, " ", doc->id, "\n");
@@ -45,13 +53,12 @@ void Trinity::queryexec_ctx::gc_retained_docs(const isrc_docid_t base)
 	// The only problem is that we are likely tracking too many candidate_document instances
 	// and this could mean more memory pressure.
 	//
-	// TODO: we can eliminate memmove() by using a ring instead (front_index, back_index), and making
-	// ring size a power of a 2. That way, we will only need to manipulate two indices, and not bother
-	// with memmove(), at the expense of higher iteration costs. Need to consider that alternative impl.
+	// tracked_docrefs is a ring(its capacity is a power of 2), so trimming the front only requires advancing
+	// the front index, instead of memmove()ing the remaining documents.
 
 	while (cnt)
         {
-                if (auto r = tracked_docrefs.data[cnt - 1]; base > r->id)
+                if (auto r = tracked_docrefs.at(cnt - 1); base > r->id)
                 {
                         forget_document(r);
                         cds_release(r);
@@ -63,7 +70,7 @@ void Trinity::queryexec_ctx::gc_retained_docs(const isrc_docid_t base)
 
         while (n < cnt)
         {
-                if (auto r = tracked_docrefs.data[n]; base > r->id)
+                if (auto r = tracked_docrefs.at(n); base > r->id)
                 {
                         forget_document(r);
                         cds_release(r);
@@ -73,18 +80,14 @@ void Trinity::queryexec_ctx::gc_retained_docs(const isrc_docid_t base)
                         break;
         }
 
-        tracked_docrefs.size = cnt;
+        tracked_docrefs.size = cnt - n;
+        if (n)
+                tracked_docrefs.front = (tracked_docrefs.front + n) & (tracked_docrefs.capacity - 1);
 
         if constexpr (trace_docrefs)
 	{
 		SLog("GC: For base = ", base, " n = ", n, " tracked_docrefs.size = ", tracked_docrefs.size, "\n");
 	}
-
-	if (n)
-	{
-		tracked_docrefs.size -= n;
-		memmove(tracked_docrefs.data, tracked_docrefs.data + n, tracked_docrefs.size * sizeof(candidate_document *));
-	}
 }
 
 Codecs::PostingsListIterator *Trinity::queryexec_ctx::reg_pli(Codecs::PostingsListIterator *it)
@@ -119,7 +122,7 @@ queryexec_ctx::~queryexec_ctx()
 
 	while (tracked_docrefs.size)
 	{
-		auto d = tracked_docrefs.data[--tracked_docrefs.size];
+		auto d = tracked_docrefs.at(--tracked_docrefs.size);
 
 		if (unlikely(d->rc != 1))
 		{
@@ -156,6 +159,7 @@ queryexec_ctx::~queryexec_ctx()
                 allIterators.pop_back();
         }
 
+        // Those allocated from itAllocator(see new_docset_it()) are only destroyed here; itAllocator releases their memory
         for (auto ptr : docsetsIterators)
         {
 		// this is not elegant, but its pragmatic enough to be OK
@@ -169,39 +173,43 @@ queryexec_ctx::~queryexec_ctx()
                                 break;
 
                         case DocsSetIterators::Type::Filter:
-                                delete static_cast<DocsSetIterators::Filter *>(ptr);
+                                static_cast<DocsSetIterators::Filter *>(ptr)->~Filter();
                                 break;
 
                         case DocsSetIterators::Type::Optional:
-                                delete static_cast<DocsSetIterators::Optional *>(ptr);
+                                static_cast<DocsSetIterators::Optional *>(ptr)->~Optional();
                                 break;
 
                         case DocsSetIterators::Type::Disjunction:
-                                delete static_cast<DocsSetIterators::Disjunction *>(ptr);
+                                static_cast<DocsSetIterators::Disjunction *>(ptr)->~Disjunction();
                                 break;
 
                         case DocsSetIterators::Type::DisjunctionAllPLI:
-                                delete static_cast<DocsSetIterators::DisjunctionAllPLI *>(ptr);
+                                static_cast<DocsSetIterators::DisjunctionAllPLI *>(ptr)->~DisjunctionAllPLI();
                                 break;
 
                         case DocsSetIterators::Type::DisjunctionSome:
-                                delete static_cast<DocsSetIterators::DisjunctionSome *>(ptr);
+                                static_cast<DocsSetIterators::DisjunctionSome *>(ptr)->~DisjunctionSome();
                                 break;
 
                         case DocsSetIterators::Type::VectorIDs:
                                 delete static_cast<DocsSetIterators::VectorIDs *>(ptr);
                                 break;
 
+                        case DocsSetIterators::Type::DocIDsSet:
+                                static_cast<DocsSetIterators::DocIDsSet *>(ptr)->~DocIDsSet();
+                                break;
+
                         case DocsSetIterators::Type::Conjuction:
-                                delete static_cast<DocsSetIterators::Conjuction *>(ptr);
+                                static_cast<DocsSetIterators::Conjuction *>(ptr)->~Conjuction();
                                 break;
 
                         case DocsSetIterators::Type::ConjuctionAllPLI:
-                                delete static_cast<DocsSetIterators::ConjuctionAllPLI *>(ptr);
+                                static_cast<DocsSetIterators::ConjuctionAllPLI *>(ptr)->~ConjuctionAllPLI();
                                 break;
 
                         case DocsSetIterators::Type::Phrase:
-                                delete static_cast<DocsSetIterators::Phrase *>(ptr);
+                                static_cast<DocsSetIterators::Phrase *>(ptr)->~Phrase();
                                 break;
 
                         case DocsSetIterators::Type::Dummy:
@@ -211,10 +219,25 @@ queryexec_ctx::~queryexec_ctx()
         }
 
         while (auto p = reusableCDS.pop_one())
-                delete p;
+        {
+                // slab allocated documents are destroyed with their slab
+                if (!p->inlineTermHitsCnt)
+                        delete p;
+        }
 
         if (reusableCDS.data)
                 std::free(reusableCDS.data);
+
+        for (uint32_t i{0}; i != cdsSlabs.slabs.size(); ++i)
+        {
+                auto slab = cdsSlabs.slabs[i];
+                const auto n = i + 1 == cdsSlabs.slabs.size() ? cdsSlabs.CDS_PER_SLAB - cdsSlabs.remaining : cdsSlabs.CDS_PER_SLAB;
+
+                for (uint32_t k{0}; k != n; ++k)
+                        reinterpret_cast<candidate_document *>(slab + k * cdsSlabs.stride)->~candidate_document();
+
+                std::free(slab);
+        }
 }
 
 void queryexec_ctx::prepare_decoder(exec_term_id_t termID)
@@ -359,12 +382,51 @@ Trinity::candidate_document::candidate_document(queryexec_ctx *const rctx)
         matchedDocument.matchedTerms = (matched_query_term *)rctx->allocator.Alloc(sizeof(matched_query_term) * maxQueryTermIDPlus1);
 }
 
+Trinity::candidate_document::candidate_document(queryexec_ctx *const rctx, term_hits *const th, isrc_docid_t *const captured, const uint16_t cnt)
+    : curDocQueryTokensCaptured{captured}, inlineTermHitsCnt{cnt}, termHits{th}
+{
+        matchedDocument.matchedTerms = (matched_query_term *)rctx->allocator.Alloc(sizeof(matched_query_term) * cnt);
+}
+
+// Each slab entry is [candidate_document][term_hits x (maxQueryTermID + 1)][isrc_docid_t x (maxQueryTermID + 1)]
+candidate_document *queryexec_ctx::new_candidate_document()
+{
+        static constexpr std::size_t align{alignof(std::max_align_t)};
+        const uint16_t n = termsDict.size() + 1;
+        const std::size_t termHitsOffset = (sizeof(candidate_document) + alignof(term_hits) - 1) & ~(alignof(term_hits) - 1);
+        const std::size_t capturedOffset = termHitsOffset + sizeof(term_hits) * n;
+
+        if (!cdsSlabs.remaining)
+        {
+                // query terms are resolved before execution, so this is the same for all slabs
+                cdsSlabs.stride = (capturedOffset + sizeof(isrc_docid_t) * n + align - 1) & ~(align - 1);
+                cdsSlabs.next = (uint8_t *)malloc(cdsSlabs.stride * cdsSlabs.CDS_PER_SLAB);
+                cdsSlabs.remaining = cdsSlabs.CDS_PER_SLAB;
+                cdsSlabs.slabs.push_back(cdsSlabs.next);
+        }
+
+        auto p = cdsSlabs.next;
+        auto th = reinterpret_cast<term_hits *>(p + termHitsOffset);
+        auto captured = reinterpret_cast<isrc_docid_t *>(p + capturedOffset);
+
+        cdsSlabs.next += cdsSlabs.stride;
+        --cdsSlabs.remaining;
+
+        for (uint16_t i{0}; i != n; ++i)
+                new (th + i) term_hits();
+        memset(captured, 0, sizeof(isrc_docid_t) * n);
+
+        return new (p) candidate_document(this, th, captured, n);
+}
+
 void queryexec_ctx::_reusable_cds::push_back(candidate_document *const d)
 {
         if (unlikely(size_ == capacity))
         {
                 // can't hold no more
-                delete d;
+                // slab allocated documents are destroyed with their slab
+                if (!d->inlineTermHitsCnt)
+                        delete d;
         }
         else
         {
@@ -545,6 +607,10 @@ static void collect_doc_matching_terms(Trinity::DocsSetIterators::Iterator *cons
                 }
                 break;
 
+                case DocsSetIterators::Type::DocIDsSet:
+                        // no terms to collect
+                        break;
+
                 default:
                         SLog("IMPLEMENT ME\n");
                         exit(1);
@@ -715,6 +781,7 @@ Trinity::docstracker_bank *Trinity::queryexec_ctx::new_bank(const Trinity::isrc_
 
                 lastBank = b;
                 banks.push_back(b);
+                banksIndex[(base / docstracker_bank::SIZE) & (BANKS_INDEX_SIZE - 1)] = b;
                 return b;
         }
 
@@ -730,6 +797,7 @@ Trinity::docstracker_bank *Trinity::queryexec_ctx::new_bank(const Trinity::isrc_
 
         lastBank = b;
         banks.push_back(b);
+        banksIndex[(base / docstracker_bank::SIZE) & (BANKS_INDEX_SIZE - 1)] = b;
 
         return b;
 }
@@ -754,6 +822,9 @@ void Trinity::queryexec_ctx::forget_document_inbank(Trinity::candidate_document
                         }
                 }
 
+                if (auto &slot = banksIndex[(b->base / docstracker_bank::SIZE) & (BANKS_INDEX_SIZE - 1)]; slot == b)
+                        slot = nullptr;
+
                 reusableBanks.push_back(b);
                 lastBank = nullptr;
         }
@@ -762,7 +833,7 @@ void Trinity::queryexec_ctx::forget_document_inbank(Trinity::candidate_document
                 const auto idx = id - b->base;
 
 #ifdef BANKS_USE_BM
-                b->bm[idx >> 6] &= ~(uint64_t(1) << (idx & (docstracker_bank::SIZE - 1)));
+                b->bm[idx >> 6] &= ~(uint64_t(1) << (idx & 63));
 #else
                 b->entries[idx].document = nullptr;
 #endif
@@ -776,7 +847,7 @@ Trinity::candidate_document *Trinity::queryexec_ctx::lookup_document_inbank(cons
                 const auto idx = id - b->base;
 
 #ifdef BANKS_USE_BM
-                if (b->bm[idx >> 6] & (uint64_t(1) << (idx & (docstracker_bank::SIZE - 1))))
+                if (b->bm[idx >> 6] & (uint64_t(1) << (idx & 63)))
 #endif
                         return b->entries[idx].document;
         }
@@ -791,7 +862,7 @@ void Trinity::queryexec_ctx::track_document_inbank(Trinity::candidate_document *
         const auto idx = id - b->base;
 
 #ifdef BANKS_USE_BM
-        b->bm[idx >> 6] |= uint64_t(1) << (idx & (docstracker_bank::SIZE - 1));
+        b->bm[idx >> 6] |= uint64_t(1) << (idx & 63);
 #endif
         b->entries[idx].document = d;
         ++(b->setCnt);
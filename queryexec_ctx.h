@@ -1,4 +1,5 @@
 #pragma once
+#include "arena.h"
 #include "docwordspace.h"
 #include "exec.h"
 #include "matches.h"
@@ -7,9 +8,8 @@
 
 namespace Trinity
 {
-        // 64bytes alignment seems to yield good results, but crashes if optimizer is enabled (i.e struct alignas(64) exec_node {})
-        // (this is because we use simple_allocator::New<> which doesn't respect the specified alignment. Not sure
-        // if we should implement support for alignment allocations in simple_allocator)
+        // 64bytes alignment seems to yield good results. exec_node contexts and DocsSetIterators are allocated from an aligned_arena
+        // and are aligned to cache lines(see aligned_arena::NewCacheAligned()), so that none of them straddles cache lines unless it is larger than one.
         struct queryexec_ctx;
 
         // This is more aking to a short-memory implemented as a stack-sort-of system
@@ -22,14 +22,27 @@ namespace Trinity
                 bool dwsInUse{false};	 // we are only going to reset if we are going to use it
                 isrc_docid_t *curDocQueryTokensCaptured;
                 uint16_t curDocSeq{UINT16_MAX};
+                // If set, termHits[] and curDocQueryTokensCaptured[] are not allocated separately; they follow
+                // this candidate_document in a slab(see queryexec_ctx::new_candidate_document())
+                uint16_t inlineTermHitsCnt{0};
                 term_hits *termHits{nullptr};
 
                 candidate_document(queryexec_ctx *const rctx);
 
+                candidate_document(queryexec_ctx *const rctx, term_hits *const th, isrc_docid_t *const captured, const uint16_t cnt);
+
                 ~candidate_document()
                 {
-                        std::free(curDocQueryTokensCaptured);
-                        delete[] termHits;
+                        if (inlineTermHitsCnt)
+                        {
+                                for (uint16_t i{0}; i != inlineTermHitsCnt; ++i)
+                                        termHits[i].~term_hits();
+                        }
+                        else
+                        {
+                                std::free(curDocQueryTokensCaptured);
+                                delete[] termHits;
+                        }
                 }
 
                 term_hits *materialize_term_hits(queryexec_ctx *, Codecs::PostingsListIterator *, const exec_term_id_t termID);
@@ -113,9 +126,11 @@ namespace Trinity
                 IndexSource *const idxsrc;
                 iterators_collector collectedIts;
                 Similarity::IndexSourceTermsScorer *scorer{nullptr};
+                // Total documents of the index source, for selectivity estimates(see costs.h); 0 if not known
+                const uint32_t docsCnt;
 
                 queryexec_ctx(IndexSource *src, const bool documentsOnly_, const bool accumScoreMode_)
-                    : documentsOnly{documentsOnly_}, accumScoreMode{accumScoreMode_}, idxsrc{src}
+                    : documentsOnly{documentsOnly_}, accumScoreMode{accumScoreMode_}, idxsrc{src}, docsCnt{src->default_field_stats().docsCnt}
                 {
                 }
 
@@ -141,7 +156,17 @@ namespace Trinity
                 // See Termspaces in CONCEPTS.md
                 exec_term_id_t resolve_term(const str8_t term);
 
-                DocsSetIterators::Iterator *build_iterator(const exec_node n, const uint32_t execFlags);
+                // targets is the estimated number of documents the iterator will be advanced to, if it doesn't lead a conjunction(UINT64_MAX otherwise)
+                // It is used to choose among alternative iterators for the node; e.g a union is only materialized if it will be accessed exhaustively enough
+                DocsSetIterators::Iterator *build_iterator(const exec_node n, const uint32_t execFlags, const uint64_t targets = std::numeric_limits<uint64_t>::max());
+
+                // See exec_query(); 0 for no deadline
+                // build_iterator() may materialize the union of many postings lists, so it checks it too and throws deadline_reached
+                uint64_t deadline{0};
+
+                struct deadline_reached final
+                {
+                };
 
                 // Instead of having a virtual DocsSetIterators::Iterator::~Iterator()
                 // which means we would need another entry in the vtable, which means an higher chance for cache misses, for no really good reason
@@ -150,6 +175,17 @@ namespace Trinity
 
                 Codecs::PostingsListIterator *reg_pli(Codecs::PostingsListIterator *it);
 
+                // DocsSetIterators are allocated from itAllocator, in the order build_iterator() creates them, so that
+                // they are laid out contiguously, each aligned to a cache line. ~queryexec_ctx() invokes their destructors.
+                aligned_arena itAllocator{8192};
+
+                // arguments are passed by value, so that arrays(including VLAs) decay to pointers
+                template <typename T, typename... Arg>
+                inline T *new_docset_it(Arg... args)
+                {
+                        return itAllocator.NewCacheAligned<T>(args...);
+                }
+
                 // indexed by termID
                 query_term_ctx **originalQueryTermCtx;
 
@@ -163,6 +199,7 @@ namespace Trinity
                         ~decode_ctx_struct();
                 } decode_ctx;
 
+		// A ring; see track_docref() and gc_retained_docs()
 		struct 
 		{
 			candidate_document **data{nullptr};
@@ -171,9 +208,31 @@ namespace Trinity
 			// [ ' apple OR "iphone x" OR "apple iphone x" OR ipod OR "apple ipad" OR "world of warcraft"  OR "world of" OR blizzard OR games OR "apple iphone x" OR "iphone X"  OR "Samsung galaxy" OR "32 GB" OR HTC OR "galaxy s8"  OR "phaistos networks" OR "las vegas" OR cid:806' ]
 			// this query could be used to reproduce the problem
 			uint32_t size{0};
+			// always a power of two
 			uint32_t capacity{0};
+			uint32_t front{0};
+
+			// i is relative to front
+			inline candidate_document *&at(const uint32_t i) noexcept
+			{
+				return data[(front + i) & (capacity - 1)];
+			}
 		} tracked_docrefs;
 
+                // candidate_documents are allocated in slabs of CDS_PER_SLAB, each followed by its term_hits[] and
+                // captured tokens, so that we won't need 3 allocations for each, and so that they are close to each other in memory
+                struct cds_slabs_struct final
+                {
+                        static constexpr uint16_t CDS_PER_SLAB{64};
+
+                        std::vector<uint8_t *> slabs;
+                        uint8_t *next{nullptr};
+                        uint16_t remaining{0};
+                        std::size_t stride{0};
+                } cdsSlabs;
+
+                candidate_document *new_candidate_document();
+
 
                 struct _reusable_cds
                 {
@@ -227,7 +286,7 @@ namespace Trinity
 				}
                         }
 
-                        auto *const res = reusableCDS.pop_one() ?: new candidate_document(this);
+                        auto *const res = reusableCDS.pop_one() ?: new_candidate_document();
 
 
 			require(res->id == 0);
@@ -262,6 +321,11 @@ namespace Trinity
                 simple_allocator allocator{4096 * 6};
                 ska::flat_hash_map<exec_term_id_t, std::pair<term_index_ctx, str8_t>> tctxMap;
                 std::vector<DocsSetIterators::Iterator *> docsetsIterators;
+                // materialized sets, e.g for ENT::matchrange; see build_iterator()
+                std::vector<std::unique_ptr<docids_set>> docIDsSets;
+                std::vector<std::unique_ptr<uint64_t[]>> docIDsSetsStorage;
+                // termsrun => materialized set, so that runs shared by multiple exec_nodes(see share_execnodes()) are only materialized once
+                ska::flat_hash_map<const void *, const docids_set *> materializedRuns;
                 std::vector<Codecs::PostingsListIterator *> allIterators;
                 docstracker_bank *lastBank{nullptr};
 
@@ -269,12 +333,19 @@ namespace Trinity
 // 393ms down to 340ms. Not a huge difference, but it's welcome(~13%)
 #define USE_BANKS 1
 
+#ifdef USE_BANKS
+                static constexpr std::size_t BANKS_INDEX_SIZE{256};
+#endif
+
                 struct
                 {
 #ifndef USE_BANKS
                         std::vector<candidate_document *> trackedDocuments[16];
 #else
                         std::vector<docstracker_bank *> banks, reusableBanks;
+                        // Direct-mapped index of banks, by (base / docstracker_bank::SIZE); documents are mostly tracked in ascending order, so
+                        // there are usually only a few banks, close to each other, in use at any time, and bank_for() won't need to scan banks
+                        docstracker_bank *banksIndex[BANKS_INDEX_SIZE]{};
 #endif
                         isrc_docid_t maxTrackedDocumentID{0}, lastMatchedDocumentID{0};
                 };
@@ -286,10 +357,14 @@ namespace Trinity
 
                         if (lastBank && lastBank->base == base)
                                 return lastBank;
+                        else if (auto b = banksIndex[(base / docstracker_bank::SIZE) & (BANKS_INDEX_SIZE - 1)]; b && b->base == base)
+                        {
+                                lastBank = b;
+                                return b;
+                        }
                         else
                         {
-                                // consider using counting linear search
-                                // may make more sense because it's going to be branchless
+                                // Only if another bank is indexed in the same slot
                                 for (auto b : banks)
                                 {
                                         if (b->base == base)
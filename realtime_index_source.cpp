@@ -0,0 +1,192 @@
+#include "realtime_index_source.h"
+
+using namespace Trinity;
+
+Trinity::Codecs::Realtime::Decoder::Decoder(const SegmentIndexSession::realtime_state *const rt, const uint32_t termID, const uint32_t documents, const uint32_t watermark)
+{
+        using realtime_state = SegmentIndexSession::realtime_state;
+        const auto pl = rt->postings(termID);
+
+        if (!pl || !documents)
+                return;
+
+        // the first `documents` postings are those visible in the snapshot; see RealtimeIndexSource::resolve_term_ctx()
+        uint32_t remaining{documents};
+
+        for (const auto *c = pl->head; remaining; c = c->next)
+        {
+                const auto n = std::min(remaining, realtime_state::chunk::Capacity);
+
+                spans.push_back({c->postings, n});
+                remaining -= n;
+        }
+
+        if (pl->firstUnorderedSeq.load(std::memory_order_relaxed) < watermark)
+        {
+                // Documents were not indexed in order of their IDs
+                sorted.reserve(documents);
+                for (const auto &it : spans)
+                        sorted.insert(sorted.end(), it.offset, it.offset + it.size());
+
+                std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) noexcept {
+                        return a.documentID < b.documentID;
+                });
+
+                spans.clear();
+                spans.push_back({sorted.data(), uint32_t(sorted.size())});
+        }
+}
+
+isrc_docid_t Trinity::Codecs::Realtime::PostingsListIterator::next()
+{
+        const auto d = static_cast<const Codecs::Realtime::Decoder *>(dec);
+        const auto &spans = d->spans;
+
+        while (span != spans.size() && idx == spans[span].size())
+        {
+                ++span;
+                idx = 0;
+        }
+
+        if (span == spans.size())
+        {
+                freq = 0;
+                return curDocument.id = DocIDsEND;
+        }
+
+        cur = spans[span].offset + idx++;
+        freq = cur->hitsCnt;
+        return curDocument.id = cur->documentID;
+}
+
+isrc_docid_t Trinity::Codecs::Realtime::PostingsListIterator::advance(const isrc_docid_t target)
+{
+        const auto d = static_cast<const Codecs::Realtime::Decoder *>(dec);
+        const auto &spans = d->spans;
+
+        // skip spans where all documents are lower than target
+        while (span != spans.size() && (idx == spans[span].size() || spans[span].offset[spans[span].size() - 1].documentID < target))
+        {
+                ++span;
+                idx = 0;
+        }
+
+        if (span == spans.size())
+        {
+                freq = 0;
+                return curDocument.id = DocIDsEND;
+        }
+
+        const auto s = spans[span];
+        const auto it = std::lower_bound(s.offset + idx, s.offset + s.size(), target, [](const auto &p, const isrc_docid_t id) noexcept {
+                return p.documentID < id;
+        });
+
+        cur = it;
+        idx = (it - s.offset) + 1;
+        freq = it->hitsCnt;
+        return curDocument.id = it->documentID;
+}
+
+void Trinity::Codecs::Realtime::PostingsListIterator::materialize_hits(DocWordsSpace *dwspace, term_hit *out)
+{
+        const auto d = static_cast<const Codecs::Realtime::Decoder *>(dec);
+        const auto termID = d->execCtxTermID;
+        const auto &it = *cur;
+        const auto *const hits = it.hits;
+
+        for (uint32_t i{0}; i != it.hitsCnt; ++i)
+        {
+                const auto &th = hits[i];
+
+                if (th.pos)
+                        dwspace->set(termID, th.pos);
+
+                out[i] = th;
+        }
+}
+
+RealtimeIndexSource::RealtimeIndexSource(SegmentIndexSession *const sess, const uint64_t generation)
+    : state{sess->realtime()}
+{
+        std::vector<isrc_docid_t> updatedDocumentIDs;
+
+        expect(state); // see SegmentIndexSession::enable_realtime()
+        gen = generation;
+        watermark = state->watermark.load(std::memory_order_acquire);
+
+        {
+                std::lock_guard<std::mutex> g(state->lock);
+
+                for (const auto &it : state->updatedDocuments)
+                {
+                        if (it.first < watermark)
+                                updatedDocumentIDs.push_back(it.second);
+                }
+        }
+
+        if (updatedDocumentIDs.size())
+        {
+                pack_updates(updatedDocumentIDs, &maskedDocumentsBuf);
+                new (&maskedDocuments) updated_documents(unpack_updates({reinterpret_cast<const uint8_t *>(maskedDocumentsBuf.data()), maskedDocumentsBuf.size()}));
+        }
+}
+
+term_index_ctx RealtimeIndexSource::resolve_term_ctx(const str8_t term)
+{
+        using realtime_state = SegmentIndexSession::realtime_state;
+        uint32_t termID;
+
+        {
+                std::lock_guard<std::mutex> g(state->lock);
+                const auto it = state->terms.find(term);
+
+                if (it == state->terms.end())
+                        return {};
+
+                termID = it->second;
+        }
+
+        const auto pl = state->postings(termID);
+
+        if (!pl)
+                return {};
+
+        // Postings are in seq order, so we only need to binary search the chunk where they cross the watermark
+        uint32_t documents{0};
+        auto remaining = pl->size.load(std::memory_order_acquire);
+
+        for (const auto *c = pl->head; remaining; c = c->next)
+        {
+                const auto n = std::min(remaining, realtime_state::chunk::Capacity);
+
+                if (c->postings[n - 1].seq < watermark)
+                {
+                        documents += n;
+                        remaining -= n;
+                }
+                else
+                {
+                        const auto it = std::lower_bound(c->postings, c->postings + n, watermark, [](const auto &p, const uint32_t seq) noexcept {
+                                return p.seq < seq;
+                        });
+
+                        documents += it - c->postings;
+                        break;
+                }
+        }
+
+        if (!documents)
+                return {};
+
+        // indexChunk is used to identify the term; see new_postings_decoder()
+        return {documents, {termID, 1}};
+}
+
+Trinity::Codecs::Decoder *RealtimeIndexSource::new_postings_decoder(const str8_t, const term_index_ctx ctx)
+{
+        auto d = std::make_unique<Trinity::Codecs::Realtime::Decoder>(state, ctx.indexChunk.offset, ctx.documents, watermark);
+
+        d->init(ctx, nullptr);
+        return d.release();
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "index_source.h"
+#include "indexer.h"
+
+namespace Trinity
+{
+        namespace Codecs
+        {
+                // Postings lists of RealtimeIndexSource
+                // Those are not encoded; the decoder accesses the session's postings chunks directly(see SegmentIndexSession::realtime_state), unless
+                // documents were not indexed in order of their IDs, in which case it holds a copy of the term's snapshot postings, ordered by document ID
+                namespace Realtime
+                {
+                        class Decoder;
+
+                        struct PostingsListIterator final
+                            : public Trinity::Codecs::PostingsListIterator
+                        {
+                                friend class Decoder;
+
+                              private:
+                                // index of the next posting in spans[span]
+                                uint32_t span{0};
+                                uint32_t idx{0};
+                                const SegmentIndexSession::realtime_state::posting *cur{nullptr};
+
+                              public:
+                                PostingsListIterator(Trinity::Codecs::Decoder *const d)
+                                    : Trinity::Codecs::PostingsListIterator{d}
+                                {
+                                }
+
+                                isrc_docid_t next() override final;
+
+                                isrc_docid_t advance(const isrc_docid_t) override final;
+
+                                void materialize_hits(DocWordsSpace *dwspace, term_hit *out) override final;
+                        };
+
+                        class Decoder final
+                            : public Trinity::Codecs::Decoder
+                        {
+                                friend struct PostingsListIterator;
+
+                              private:
+                                // The term's postings visible in the snapshot(seq < watermark), ordered by document ID
+                                std::vector<range_base<const SegmentIndexSession::realtime_state::posting *, uint32_t>> spans;
+                                // If documents were not indexed in order
+                                std::vector<SegmentIndexSession::realtime_state::posting> sorted;
+
+                              public:
+                                // documents is the number of the term's postings visible in the snapshot; see RealtimeIndexSource::resolve_term_ctx()
+                                Decoder(const SegmentIndexSession::realtime_state *, const uint32_t termID, const uint32_t documents, const uint32_t watermark);
+
+                                void init(const term_index_ctx &tctx, Trinity::Codecs::AccessProxy *) override final
+                                {
+                                        indexTermCtx = tctx;
+                                }
+
+                                Trinity::Codecs::PostingsListIterator *new_iterator() override final
+                                {
+                                        return new PostingsListIterator(this);
+                                }
+                        };
+                }
+        }
+
+        // Near real-time search; queries are executed against the state of a SegmentIndexSession that has not been committed yet.
+        // See SegmentIndexSession::enable_realtime()
+        //
+        // A RealtimeIndexSource is a snapshot of the session: it only considers documents committed to the session
+        // before it was created, so that queries will see a consistent view of the session even while more documents are indexed.
+        // Just create a new RealtimeIndexSource and replace the previous one in your IndexSourcesCollection whenever you
+        // want to reflect more recent updates; that's cheap, and there is no need to commit() tiny segments frequently.
+        //
+        // You provide its generation, which should be higher than the generation of all other sources
+        // that existed when it was created(e.g the generation the session will be committed as), so that its masked documents will mask documents in them.
+        //
+        // The session must outlive all RealtimeIndexSource created for it.
+        class RealtimeIndexSource final
+            : public IndexSource
+        {
+              private:
+                SegmentIndexSession::realtime_state *const state;
+                uint32_t watermark;
+                IOBuffer maskedDocumentsBuf;
+                updated_documents maskedDocuments{};
+
+              public:
+                RealtimeIndexSource(SegmentIndexSession *sess, const uint64_t generation);
+
+                term_index_ctx resolve_term_ctx(const str8_t term) override final;
+
+                Trinity::Codecs::Decoder *new_postings_decoder(const str8_t term, const term_index_ctx ctx) override final;
+
+                updated_documents masked_documents() override final
+                {
+                        return maskedDocuments;
+                }
+
+                bool index_empty() const noexcept override final
+                {
+                        return watermark == 0;
+                }
+
+                auto snapshot_watermark() const noexcept
+                {
+                        return watermark;
+                }
+        };
+}
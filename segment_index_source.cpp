@@ -44,6 +44,97 @@ Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
                 else
                         close(fd);
 
+                snprintf(path, sizeof(path), "%s/docids", basePath);
+                fd = open(path, O_RDONLY | O_LARGEFILE);
+
+                if (fd == -1)
+                {
+                        if (errno != ENOENT)
+                                throw Switch::system_error("open() failed for docids");
+                }
+                else if (const auto fileSize = lseek64(fd, 0, SEEK_END); fileSize > 0)
+                {
+                        if (fileSize % sizeof(docid_t))
+                        {
+                                close(fd);
+                                throw Switch::data_error("Unexpected docids contents");
+                        }
+
+                        auto fileData = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+                        close(fd);
+                        if (unlikely(fileData == MAP_FAILED))
+                                throw Switch::data_error("Failed to access ", path, ":", strerror(errno));
+
+                        madvise(fileData, fileSize, MADV_DONTDUMP);
+                        globalDocIDs.fileData.Set(reinterpret_cast<uint8_t *>(fileData), fileSize);
+                        globalDocIDs.ids = reinterpret_cast<const docid_t *>(fileData);
+
+                        // ids[0] is not a valid ID
+                        if (const uint32_t n = fileSize / sizeof(docid_t); !std::is_sorted(globalDocIDs.ids + 1, globalDocIDs.ids + n))
+                        {
+                                auto &inverse = globalDocIDs.inverse;
+
+                                inverse.reserve(n - 1);
+                                for (uint32_t i{1}; i < n; ++i)
+                                        inverse.push_back({globalDocIDs.ids[i], i});
+
+                                std::sort(inverse.begin(), inverse.end());
+                        }
+                }
+                else
+                        close(fd);
+
+                snprintf(path, sizeof(path), "%s/docvalues", basePath);
+                fd = open(path, O_RDONLY | O_LARGEFILE);
+
+                if (fd == -1)
+                {
+                        if (errno != ENOENT)
+                                throw Switch::system_error("open() failed for docvalues");
+                }
+                else if (const auto fileSize = lseek64(fd, 0, SEEK_END); fileSize > 0)
+                {
+                        auto fileData = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+                        close(fd);
+                        if (unlikely(fileData == MAP_FAILED))
+                                throw Switch::data_error("Failed to access ", path, ":", strerror(errno));
+
+                        madvise(fileData, fileSize, MADV_DONTDUMP);
+                        docValues.fileData.Set(reinterpret_cast<uint8_t *>(fileData), fileSize);
+                        docValues.reader.reset(new DocValues::Reader(docValues.fileData));
+                }
+                else
+                        close(fd);
+
+                snprintf(path, sizeof(path), "%s/bigrams", basePath);
+                fd = open(path, O_RDONLY | O_LARGEFILE);
+
+                if (fd == -1)
+                {
+                        if (errno != ENOENT)
+                                throw Switch::system_error("open() failed for bigrams");
+                }
+                else if (const auto fileSize = lseek64(fd, 0, SEEK_END); fileSize > 0)
+                {
+                        auto fileData = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+                        close(fd);
+                        if (unlikely(fileData == MAP_FAILED))
+                                throw Switch::data_error("Failed to access ", path, ":", strerror(errno));
+
+                        // the set copies the terms, so we don't need to retain the file
+                        Defer({
+                                munmap(fileData, fileSize);
+                        });
+
+                        bigrams.reset(new Bigrams::terms_set());
+                        bigrams->init({reinterpret_cast<const uint8_t *>(fileData), std::size_t(fileSize)});
+                }
+                else
+                        close(fd);
+
                 terms.reset(new SegmentTerms(basePath));
 
                 snprintf(path, sizeof(path), "%s/index", basePath);
@@ -166,6 +257,21 @@ Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
                         defaultFieldStats.docsCnt = *(uint32_t *)p;
                         p += sizeof(uint32_t);
 
+                        if (p + sizeof(uint8_t) * 2 <= b + fileSize)
+                        {
+                                // documents order; see SegmentIndexSession::set_index_sort()
+                                const bool descending = *p++;
+                                const uint8_t len = *p++;
+
+                                if (p + len > b + fileSize)
+                                        throw Switch::data_error("Unexpected ID contents");
+
+                                memcpy(sortFieldStorage, p, len);
+                                p += len;
+                                documentsOrder.field.Set(reinterpret_cast<const char *>(sortFieldStorage), len);
+                                documentsOrder.descending = descending;
+                        }
+
                         // SLog("Restored codec '", codec, "' sumTermHits = ", dotnotation_repr(defaultFieldStats.sumTermHits), ", totalTerms = ", dotnotation_repr(defaultFieldStats.totalTerms), ", sumTermsDocs = ", dotnotation_repr(defaultFieldStats.sumTermsDocs), ", docsCnt = ", dotnotation_repr(defaultFieldStats.docsCnt), "\n");
                 }
 
@@ -184,3 +290,25 @@ Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
 		throw;
         }
 }
+
+Trinity::isrc_docid_t Trinity::SegmentIndexSource::index_source_docid(const docid_t id)
+{
+        if (!globalDocIDs.ids)
+                return id;
+
+        if (const auto &inverse = globalDocIDs.inverse; !inverse.empty())
+        {
+                const auto it = std::lower_bound(inverse.begin(), inverse.end(), id, [](const auto &a, const docid_t id) noexcept {
+                        return a.first < id;
+                });
+
+                return it != inverse.end() && it->first == id ? it->second : 0;
+        }
+        else
+        {
+                const auto b = globalDocIDs.ids + 1, e = globalDocIDs.ids + globalDocIDs.fileData.size() / sizeof(docid_t);
+                const auto it = std::lower_bound(b, e, id);
+
+                return it != e && *it == id ? it - globalDocIDs.ids : 0;
+        }
+}
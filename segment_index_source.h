@@ -33,6 +33,44 @@ namespace Trinity
 			}
                 } maskedDocuments;
 
+                // If the segment was created with SegmentIndexSession::set_local_docids(), this
+                // is the mmap()ed docids file; ids[localID] is the global document ID
+                struct docids_map_struct final
+                {
+                        const docid_t *ids{nullptr};
+                        range_base<const uint8_t *, std::size_t> fileData;
+                        // See index_source_docid()
+                        // If ids[] is not ascending(i.e the segment was index sorted), (global ID, local ID) sorted by global ID
+                        std::vector<std::pair<docid_t, isrc_docid_t>> inverse;
+
+                        ~docids_map_struct()
+                        {
+                                if (auto ptr = (void *)(fileData.offset))
+                                        munmap(ptr, fileData.size());
+                        }
+                } globalDocIDs;
+
+                // mmap()ed docvalues file, if any
+                struct docvalues_struct final
+                {
+                        std::unique_ptr<DocValues::Reader> reader;
+                        range_base<const uint8_t *, std::size_t> fileData;
+
+                        ~docvalues_struct()
+                        {
+                                reader.reset();
+                                if (auto ptr = (void *)(fileData.offset))
+                                        munmap(ptr, fileData.size());
+                        }
+                } docValues;
+
+                // The common terms set the segment was indexed with, if any; see SegmentIndexSession::set_bigrams()
+                std::unique_ptr<Bigrams::terms_set> bigrams;
+
+                // See documents_order()
+                char_t sortFieldStorage[256];
+                index_sort documentsOrder;
+
               public:
                 SegmentIndexSource(const char *basePath);
 
@@ -76,6 +114,33 @@ namespace Trinity
                         return maskedDocuments.set;
                 }
 
+                bool require_docid_translation() const override final
+                {
+                        return globalDocIDs.ids;
+                }
+
+                docid_t translate_docid(const isrc_docid_t localId) override final
+                {
+                        return globalDocIDs.ids[localId];
+                }
+
+                isrc_docid_t index_source_docid(const docid_t id) override final;
+
+                const DocValues::Reader *doc_values() override final
+                {
+                        return docValues.reader.get();
+                }
+
+                index_sort documents_order() const override final
+                {
+                        return documentsOrder;
+                }
+
+                const Bigrams::terms_set *indexed_bigrams() const override final
+                {
+                        return bigrams.get();
+                }
+
                 ~SegmentIndexSource()
 		{
 			if (auto ptr = (void *)index.offset)
@@ -1,6 +1,7 @@
 #pragma once
 #include <switch.h>
 #include <compress.h>
+#include <type_traits>
 
 namespace Trinity
 {
@@ -9,5 +10,64 @@ namespace Trinity
 		int8_t to_file(const char *p, uint64_t len, const char *path);
 
 		int8_t to_file(const char *p, uint64_t len, int fd);
+
+		// LSD radix sort of [data, data + n) by the u64 key() of each value, 8 bits at a time.
+		// `tmp` must have room for n values; it's used as scratch space.
+		//
+		// The sort is stable, and digits that are the same for all keys are skipped, so that
+		// keys where only a few bits are set(e.g (termID << 16) | position) require fewer passes.
+		// For very few values, std::sort() is likely faster.
+		template <typename T, typename L>
+		void radix_sort(T *const data, T *const tmp, const std::size_t n, L &&key)
+		{
+			static_assert(std::is_trivially_copyable<T>::value);
+			uint32_t histogram[8][256];
+			T *src{data}, *dst{tmp};
+
+			if (n < 2)
+				return;
+
+			require(n <= UINT32_MAX);
+			memset(histogram, 0, sizeof(histogram));
+			for (std::size_t i{0}; i != n; ++i)
+			{
+				const uint64_t k = key(data[i]);
+
+				for (uint8_t d{0}; d != 8; ++d)
+					++histogram[d][(k >> (d << 3)) & 0xff];
+			}
+
+			for (uint8_t d{0}; d != 8; ++d)
+			{
+				const uint8_t shift = d << 3;
+				auto *const h = histogram[d];
+
+				if (h[(uint64_t(key(src[0])) >> shift) & 0xff] == n)
+				{
+					// all keys share this digit
+					continue;
+				}
+
+				for (uint32_t i{0}, sum{0}; i != 256; ++i)
+				{
+					const auto c = h[i];
+
+					h[i] = sum;
+					sum += c;
+				}
+
+				for (std::size_t i{0}; i != n; ++i)
+				{
+					const auto &v = src[i];
+
+					dst[h[(uint64_t(key(v)) >> shift) & 0xff]++] = v;
+				}
+
+				std::swap(src, dst);
+			}
+
+			if (src != data)
+				memcpy(data, src, n * sizeof(T));
+		}
 	}
 }